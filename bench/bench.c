@@ -0,0 +1,346 @@
+// Time babygit's main commands on generated repositories and report the
+// results as JSON.
+//
+//   bench [-g babygit] [-x genrepo] [-o out.json] [-k] <scale>...
+//
+// A scale is a file count such as 1k, 100k or 1m. For each one a tree is
+// generated and these steps run in order, each measured on its own:
+//
+//   init, add (of every file), commit, status (clean), branch,
+//   checkout (after main moved on by a commit), merge (of a branch that
+//   has its own commit)
+//
+// Every step is run twice on identical trees: once plainly for wall time
+// and peak RSS, and once under ptrace to count system calls, so that the
+// tracing does not distort the times. Syscall counts are null where
+// ptrace is not permitted.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STEP_MAX 16
+
+typedef struct StepResult {
+    const char* name;
+    double wall_ms;
+    long max_rss_kb;
+    long long syscalls;  // -1 when not counted
+    int exit_status;
+} StepResult;
+
+typedef struct ScaleResult {
+    const char* name;
+    long files;
+    int depth;
+    StepResult steps[STEP_MAX];
+    int step_count;
+} ScaleResult;
+
+typedef struct Bench {
+    const char* babygit;
+    const char* genrepo;
+    int trace_ok;
+} Bench;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void child_exec(const char* dir, char* const argv[], int traced) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) dup2(null, STDOUT_FILENO);
+    if (chdir(dir) != 0) _exit(127);
+    if (traced) {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) _exit(126);
+        raise(SIGSTOP);
+    }
+    execv(argv[0], argv);
+    _exit(127);
+}
+
+// Follow the process and every thread it starts, counting syscall entries.
+static long long trace_syscalls(pid_t pid, int* status_out) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) return -1;
+    long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK |
+                   PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL;
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void*)options) != 0 ||
+        ptrace(PTRACE_SYSCALL, pid, NULL, NULL) != 0)
+        return -1;
+
+    long long count = 0;
+    pid_t tid;
+    while ((tid = waitpid(-1, &status, __WALL)) > 0) {
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid == pid) *status_out = status;
+            continue;
+        }
+        int sig = WSTOPSIG(status);
+        if (sig == (SIGTRAP | 0x80)) {
+            struct __ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, (void*)sizeof(info), &info) > 0 &&
+                info.op == PTRACE_SYSCALL_INFO_ENTRY)
+                count++;
+            sig = 0;
+        } else if (status >> 16 != 0 || sig == SIGSTOP) {
+            // Exec, fork and clone events, and the stop new threads start with
+            sig = 0;
+        }
+        ptrace(PTRACE_SYSCALL, tid, NULL, (void*)(long)sig);
+    }
+    return count;
+}
+
+static int run(Bench* bench, const char* dir, char* const argv[], int traced, StepResult* result) {
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) child_exec(dir, argv, traced);
+
+    int status = 0;
+    if (traced) {
+        result->syscalls = trace_syscalls(pid, &status);
+        if (result->syscalls < 0) {
+            bench->trace_ok = 0;
+            kill(pid, SIGKILL);
+            while (waitpid(pid, &status, __WALL) > 0) {
+            }
+        }
+    } else {
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) < 0) return -1;
+        result->wall_ms = now_ms() - start;
+        result->max_rss_kb = usage.ru_maxrss;
+        result->exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    return 0;
+}
+
+static int run_babygit(Bench* bench, const char* dir, const char* a, const char* b,
+                       const char* c, int traced, StepResult* result) {
+    char* argv[] = {(char*)bench->babygit, (char*)a, (char*)b, (char*)c, NULL};
+    StepResult ignored = {0};
+    return run(bench, dir, argv, traced, result ? result : &ignored);
+}
+
+static int genrepo(Bench* bench, const char* dir, const ScaleResult* scale, const char* extra) {
+    char files[32], depth[32];
+    snprintf(files, sizeof(files), "%ld", scale->files);
+    snprintf(depth, sizeof(depth), "%d", scale->depth);
+    char* argv[16] = {(char*)bench->genrepo, "-f", files, "-d", depth};
+    int argc = 5;
+    char* copy = extra ? strdup(extra) : NULL;
+    for (char* tok = copy ? strtok(copy, " ") : NULL; tok && argc < 14; tok = strtok(NULL, " "))
+        argv[argc++] = tok;
+    argv[argc++] = (char*)dir;
+    argv[argc] = NULL;
+
+    StepResult result = {0};
+    int failed = run(bench, ".", argv, 0, &result) != 0 || result.exit_status != 0;
+    free(copy);
+    if (failed) fprintf(stderr, "bench: genrepo failed for %s\n", dir);
+    return failed ? -1 : 0;
+}
+
+static StepResult* step(ScaleResult* scale, int pass, const char* name) {
+    StepResult* result = NULL;
+    for (int i = 0; i < scale->step_count; i++) {
+        if (strcmp(scale->steps[i].name, name) == 0) result = &scale->steps[i];
+    }
+    if (!result && pass == 0 && scale->step_count < STEP_MAX) {
+        result = &scale->steps[scale->step_count++];
+        result->name = name;
+        result->syscalls = -1;
+    }
+    return result;
+}
+
+// Run one step: pass 0 times it, pass 1 counts its syscalls.
+static int measure(Bench* bench, ScaleResult* scale, const char* dir, int pass,
+                   const char* label, const char* a, const char* b, const char* c) {
+    StepResult* result = step(scale, pass, label);
+    if (!result) return -1;
+    if (pass == 0) {
+        if (run_babygit(bench, dir, a, b, c, 0, result) != 0) return -1;
+        fprintf(stderr, "bench: %-5s %-9s %10.1f ms\n", scale->name, label, result->wall_ms);
+        return 0;
+    }
+    StepResult counted = {.syscalls = -1};
+    if (run_babygit(bench, dir, a, b, c, bench->trace_ok, &counted) != 0) return -1;
+    result->syscalls = counted.syscalls;
+    return 0;
+}
+
+// Commit an edit of every hundredth file, starting from file offset.
+static int commit_edit(Bench* bench, ScaleResult* scale, const char* dir, const char* edit,
+                       const char* message) {
+    if (genrepo(bench, dir, scale, edit) != 0) return -1;
+    if (run_babygit(bench, dir, "add", ".", NULL, 0, NULL) != 0) return -1;
+    return run_babygit(bench, dir, "commit", message, "bench", 0, NULL);
+}
+
+// One pass over a fresh tree. The two edits touch different files, so the
+// merge has no conflicts.
+static int run_pass(Bench* bench, ScaleResult* scale, const char* dir, int pass) {
+    if (genrepo(bench, dir, scale, NULL) != 0) return -1;
+
+    if (measure(bench, scale, dir, pass, "init", "init", NULL, NULL) != 0 ||
+        measure(bench, scale, dir, pass, "add", "add", ".", NULL) != 0 ||
+        measure(bench, scale, dir, pass, "commit", "commit", "initial", "bench") != 0 ||
+        measure(bench, scale, dir, pass, "status", "status", NULL, NULL) != 0 ||
+        measure(bench, scale, dir, pass, "branch", "branch", "topic", NULL) != 0)
+        return -1;
+
+    if (commit_edit(bench, scale, dir, "-m 100 -o 1 -v 1", "main edit") != 0 ||
+        measure(bench, scale, dir, pass, "checkout", "checkout", "topic", NULL) != 0)
+        return -1;
+
+    if (commit_edit(bench, scale, dir, "-m 100 -o 2 -v 2", "topic edit") != 0 ||
+        run_babygit(bench, dir, "checkout", "main", NULL, 0, NULL) != 0 ||
+        measure(bench, scale, dir, pass, "merge", "merge", "topic", NULL) != 0)
+        return -1;
+    return 0;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void remove_tree(const char* dir) {
+    nftw(dir, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static int parse_scale(const char* arg, ScaleResult* scale) {
+    char* end;
+    double n = strtod(arg, &end);
+    if (end == arg || n <= 0) return -1;
+    if (*end == 'k' || *end == 'K') {
+        n *= 1e3;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        n *= 1e6;
+        end++;
+    }
+    if (*end != '\0') return -1;
+    scale->name = arg;
+    scale->files = (long)n;
+    // About a hundred files per directory, ten subdirectories per level
+    scale->depth = 0;
+    for (long dirs = 1; dirs * 100 < scale->files; dirs *= 10) scale->depth++;
+    return 0;
+}
+
+static void print_json(FILE* out, const Bench* bench, const ScaleResult* scales, int count) {
+    fprintf(out, "{\n  \"babygit\": \"%s\",\n  \"scales\": [", bench->babygit);
+    for (int i = 0; i < count; i++) {
+        const ScaleResult* scale = &scales[i];
+        fprintf(out, "%s\n    {\n      \"scale\": \"%s\",\n      \"files\": %ld,\n",
+                i ? "," : "", scale->name, scale->files);
+        fprintf(out, "      \"steps\": [");
+        for (int j = 0; j < scale->step_count; j++) {
+            const StepResult* r = &scale->steps[j];
+            fprintf(out,
+                    "%s\n        {\"step\": \"%s\", \"wall_ms\": %.3f, \"max_rss_kb\": %ld, "
+                    "\"syscalls\": ",
+                    j ? "," : "", r->name, r->wall_ms, r->max_rss_kb);
+            if (r->syscalls < 0) {
+                fprintf(out, "null");
+            } else {
+                fprintf(out, "%lld", r->syscalls);
+            }
+            fprintf(out, ", \"exit_status\": %d}", r->exit_status);
+        }
+        fprintf(out, "\n      ]\n    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-g babygit] [-x genrepo] [-o out.json] [-k] <scale>...\n", prog);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* babygit = "bin/babygit";
+    const char* generator = "bench/genrepo";
+    const char* output = NULL;
+    int keep = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:x:o:k")) != -1) {
+        switch (opt) {
+        case 'g': babygit = optarg; break;
+        case 'x': generator = optarg; break;
+        case 'o': output = optarg; break;
+        case 'k': keep = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    int count = argc - optind;
+    if (count < 1) usage(argv[0]);
+
+    ScaleResult* scales = calloc((size_t)count, sizeof(ScaleResult));
+    if (!scales) return 1;
+    for (int i = 0; i < count; i++) {
+        if (parse_scale(argv[optind + i], &scales[i]) != 0) {
+            fprintf(stderr, "bench: bad scale '%s'\n", argv[optind + i]);
+            usage(argv[0]);
+        }
+    }
+
+    // The commands run inside the generated trees
+    Bench bench = {realpath(babygit, NULL), realpath(generator, NULL), 1};
+    if (!bench.babygit || !bench.genrepo) {
+        perror(!bench.babygit ? babygit : generator);
+        return 1;
+    }
+
+    const char* tmp = getenv("TMPDIR");
+    char work[4096];
+    snprintf(work, sizeof(work), "%s/babygit-bench.XXXXXX", tmp && *tmp ? tmp : "/tmp");
+    if (!mkdtemp(work)) {
+        perror(work);
+        return 1;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count && !failed; i++) {
+        for (int pass = 0; pass < 2 && !failed; pass++) {
+            if (pass == 1 && !bench.trace_ok) break;
+            char dir[4200];
+            snprintf(dir, sizeof(dir), "%s/%s-%s", work, scales[i].name, pass ? "trace" : "time");
+            failed = run_pass(&bench, &scales[i], dir, pass) != 0;
+            if (!keep) remove_tree(dir);
+        }
+    }
+    if (!keep) rmdir(work);
+    if (!bench.trace_ok) fprintf(stderr, "bench: ptrace not permitted; syscalls not counted\n");
+
+    FILE* out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        perror(output);
+        return 1;
+    }
+    print_json(out, &bench, scales, count);
+    if (out != stdout) fclose(out);
+    free(scales);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+// Generate a synthetic working tree, and optionally a history, for
+// benchmarking babygit. The same options and seed always produce the same
+// files, so a tree can be regenerated instead of copied.
+//
+//   genrepo [options] <dir>
+//     -f files      number of files (default 1000)
+//     -d depth      directory levels above the files (default 2)
+//     -w width      subdirectories per directory (default 10)
+//     -s min-max    file size range in bytes (default 64-2048)
+//     -r seed       seed for names and contents (default 1)
+//     -m every      rewrite every nth file of an existing tree instead
+//     -o offset     first file rewritten by -m (default 0)
+//     -v version    contents generation written by -m (default 1)
+//     -c commits    commit the tree, then commits-1 more rounds of edits
+//     -b branches   branches, each with one commit of its own, off main
+//     -g babygit    the babygit to run for -c and -b (default bin/babygit)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct Shape {
+    long files;
+    int depth;
+    int width;
+    size_t min_size;
+    size_t max_size;
+    uint64_t seed;
+} Shape;
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static long leaf_count(const Shape* shape) {
+    long leaves = 1;
+    for (int i = 0; i < shape->depth; i++) leaves *= shape->width;
+    return leaves;
+}
+
+// Files are dealt round-robin into the leaf directories, so every
+// directory ends up with about the same number of them.
+static void file_path(const Shape* shape, long index, char* out, size_t size) {
+    long leaf = index % leaf_count(shape);
+    size_t len = 0;
+    for (int level = 0; level < shape->depth; level++) {
+        len += (size_t)snprintf(out + len, size - len, "d%ld/", leaf % shape->width);
+        leaf /= shape->width;
+    }
+    snprintf(out + len, size - len, "f%07ld.txt", index);
+}
+
+static int make_dirs(const Shape* shape, const char* root) {
+    char path[4096];
+    long leaves = leaf_count(shape);
+    for (long leaf = 0; leaf < leaves; leaf++) {
+        size_t len = (size_t)snprintf(path, sizeof(path), "%s", root);
+        long rest = leaf;
+        for (int level = 0; level < shape->depth; level++) {
+            len += (size_t)snprintf(path + len, sizeof(path) - len, "/d%ld", rest % shape->width);
+            rest /= shape->width;
+            if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+                perror(path);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Lines of lowercase words, so the contents compress and diff like text.
+static int write_file(const Shape* shape, const char* root, long index, uint64_t version) {
+    char rel[256], path[4096];
+    file_path(shape, index, rel, sizeof(rel));
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+
+    uint64_t state = mix(shape->seed ^ mix((uint64_t)index) ^ mix(version + 0x9e37)) | 1;
+    size_t size = shape->min_size;
+    if (shape->max_size > shape->min_size)
+        size += next_random(&state) % (shape->max_size - shape->min_size + 1);
+
+    char* data = malloc(size + 1);
+    if (!data) return -1;
+    size_t line = 0;
+    for (size_t i = 0; i < size; i++) {
+        uint64_t r = next_random(&state);
+        if (line >= 60 && r % 8 == 0) {
+            data[i] = '\n';
+            line = 0;
+        } else {
+            data[i] = r % 6 == 0 ? ' ' : (char)('a' + r % 26);
+            line++;
+        }
+    }
+    if (size) data[size - 1] = '\n';
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int failed = fd < 0 || write(fd, data, size) != (ssize_t)size;
+    if (fd >= 0 && close(fd) != 0) failed = 1;
+    if (failed) perror(path);
+    free(data);
+    return failed ? -1 : 0;
+}
+
+static int rewrite_files(const Shape* shape, const char* root, long every, long offset,
+                         uint64_t version) {
+    for (long i = offset; i < shape->files; i += every) {
+        if (write_file(shape, root, i, version) != 0) return -1;
+    }
+    return 0;
+}
+
+static int run_babygit(const char* babygit, const char* root, const char* a, const char* b,
+                       const char* c) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDOUT_FILENO);
+        if (chdir(root) != 0) _exit(127);
+        execl(babygit, babygit, a, b, c, (char*)NULL);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0) return -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "genrepo: babygit %s failed\n", a);
+        return -1;
+    }
+    return 0;
+}
+
+static int commit_all(const char* babygit, const char* root, const char* message) {
+    if (run_babygit(babygit, root, "add", ".", NULL) != 0) return -1;
+    return run_babygit(babygit, root, "commit", message, "genrepo");
+}
+
+// Each commit after the first edits about 1% of the files, a different
+// 1% each time.
+static int make_history(const Shape* shape, const char* root, const char* babygit,
+                        long commits, long branches) {
+    long every = shape->files >= 100 ? 100 : 1;
+    char message[64];
+
+    if (run_babygit(babygit, root, "init", NULL, NULL) != 0) return -1;
+    if (commit_all(babygit, root, "commit 1") != 0) return -1;
+    for (long i = 2; i <= commits; i++) {
+        if (rewrite_files(shape, root, every, i % every, (uint64_t)i) != 0) return -1;
+        snprintf(message, sizeof(message), "commit %ld", i);
+        if (commit_all(babygit, root, message) != 0) return -1;
+    }
+
+    for (long i = 1; i <= branches; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "branch%ld", i);
+        if (run_babygit(babygit, root, "branch", name, NULL) != 0 ||
+            run_babygit(babygit, root, "checkout", name, NULL) != 0)
+            return -1;
+        if (rewrite_files(shape, root, every, (commits + i) % every,
+                          (uint64_t)(commits + i)) != 0)
+            return -1;
+        snprintf(message, sizeof(message), "work on %s", name);
+        if (commit_all(babygit, root, message) != 0 ||
+            run_babygit(babygit, root, "checkout", "main", NULL) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [-f files] [-d depth] [-w width] [-s min-max] [-r seed]\n"
+            "       [-m every [-o offset] [-v version]] [-c commits] [-b branches]\n"
+            "       [-g babygit] <dir>\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    Shape shape = {1000, 2, 10, 64, 2048, 1};
+    long every = 0, offset = 0, commits = 0, branches = 0;
+    uint64_t version = 1;
+    const char* babygit = "bin/babygit";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:d:w:s:r:m:o:v:c:b:g:")) != -1) {
+        switch (opt) {
+        case 'f': shape.files = atol(optarg); break;
+        case 'd': shape.depth = atoi(optarg); break;
+        case 'w': shape.width = atoi(optarg); break;
+        case 's':
+            if (sscanf(optarg, "%zu-%zu", &shape.min_size, &shape.max_size) != 2) usage(argv[0]);
+            break;
+        case 'r': shape.seed = strtoull(optarg, NULL, 10); break;
+        case 'm': every = atol(optarg); break;
+        case 'o': offset = atol(optarg); break;
+        case 'v': version = strtoull(optarg, NULL, 10); break;
+        case 'c': commits = atol(optarg); break;
+        case 'b': branches = atol(optarg); break;
+        case 'g': babygit = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || shape.files < 1 || shape.depth < 0 || shape.width < 1 ||
+        shape.min_size > shape.max_size || every < 0 || offset < 0)
+        usage(argv[0]);
+    const char* root = argv[optind];
+
+    // Rewriting needs the tree made earlier with the same shape and seed
+    if (every > 0) return rewrite_files(&shape, root, every, offset, version) == 0 ? 0 : 1;
+
+    if (mkdir(root, 0755) != 0 && errno != EEXIST) {
+        perror(root);
+        return 1;
+    }
+    if (make_dirs(&shape, root) != 0) return 1;
+    for (long i = 0; i < shape.files; i++) {
+        if (write_file(&shape, root, i, 0) != 0) return 1;
+    }
+
+    if (commits > 0 || branches > 0) {
+        // The commands run inside root
+        char* path = realpath(babygit, NULL);
+        if (!path) {
+            perror(babygit);
+            return 1;
+        }
+        int failed = make_history(&shape, root, path, commits > 0 ? commits : 1, branches);
+        free(path);
+        if (failed) return 1;
+    }
+    return 0;
+}
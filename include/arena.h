@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Repository-scoped allocator for parsed objects and strings. Memory is
+// bump-allocated from chunks that grow geometrically and is all released
+// at once by arena_destroy. Small blocks are rounded up to a power-of-two
+// size class so a freed block (an evicted commit, say) can be reused by
+// the next allocation of that class; larger blocks are only reclaimed by
+// arena_destroy.
+#define ARENA_ALIGN 16
+#define ARENA_MIN_CHUNK (64 * 1024)
+#define ARENA_MAX_CHUNK (4 * 1024 * 1024)
+#define ARENA_SIZE_CLASSES 9  // 16 bytes up to 4 KiB
+#define ARENA_MAX_CLASS_SIZE (ARENA_ALIGN << (ARENA_SIZE_CLASSES - 1))
+
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct Arena {
+  ArenaChunk *chunks;
+  size_t next_chunk_size;
+  void *free_lists[ARENA_SIZE_CLASSES];
+  // Interned strings, open addressing
+  const char **interned;
+  size_t intern_count;
+  size_t intern_capacity;
+  size_t reserved;  // bytes obtained from malloc
+} Arena;
+
+void arena_init(Arena *arena);
+void arena_destroy(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+void arena_free(Arena *arena, void *ptr, size_t size);
+char *arena_strndup(Arena *arena, const char *str, size_t len);
+char *arena_strdup(Arena *arena, const char *str);
+void arena_free_string(Arena *arena, char *str);
+const char *arena_intern(Arena *arena, const char *str, size_t len);
+
+#endif
@@ -6,7 +6,10 @@
 Branch* create_branch(Repository* repo, const char* branch_name);
 Branch* find_branch(Repository* repo, const char* branch_name);
 void checkout_branch(Repository* repo, const char* branch_name);
-void free_branch(Branch* branch);
 Branch* create_branch_silent(Repository* repo, const char* name);
+Commit* branch_head(Repository* repo, Branch* branch);
+int update_branch_ref(Branch* branch);
+void assign_branch_head(Repository* repo, Branch* branch, Commit* commit);
+void set_branch_head(Repository* repo, Branch* branch, Commit* commit);
 
 #endif
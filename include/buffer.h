@@ -0,0 +1,26 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+
+// Growable byte buffer used to serialize objects before they are hashed
+// and written in one go. Capacity doubles, so appends are amortized O(1).
+// data is kept NUL-terminated so text objects can be used as strings.
+typedef struct Buffer {
+    char* data;
+    size_t len;
+    size_t cap;
+} Buffer;
+
+#define BUFFER_INIT { NULL, 0, 0 }
+
+int buffer_grow(Buffer* buf, size_t extra);
+int buffer_put(Buffer* buf, const void* data, size_t len);
+int buffer_puts(Buffer* buf, const char* str);
+int buffer_putf(Buffer* buf, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+int buffer_put_varint(Buffer* buf, size_t n);
+void buffer_reset(Buffer* buf);
+void buffer_free(Buffer* buf);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef CHECKOUT_H
+#define CHECKOUT_H
+
+#include "object_types.h"
+
+int checkout_tree(Repository* repo, const ObjectId* from, const ObjectId* to);
+
+#endif
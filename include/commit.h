@@ -2,12 +2,20 @@
 #define COMMIT_H
 
 #include <time.h>
+#include "buffer.h"
 #include "object_types.h"
 
+int serialize_commit(const Commit* commit, Buffer* out);
+int write_commit_object(Commit* commit);
+Commit* alloc_commit(Repository* repo, const char* author, size_t author_len,
+                     const char* message, size_t message_len);
 Commit* create_commit(Repository* repo, const char* message, const char* author);
-Commit* find_commit(Repository* repo, const char* hash);
-void free_commit(Commit* commit);
-Commit* load_commit(const char* hash);
+Commit* find_commit(Repository* repo, const ObjectId* oid);
+void free_commit(Arena* arena, Commit* commit);
+Commit* load_commit(Repository* repo, const ObjectId* oid);
+Commit* lookup_commit(Repository* repo, const ObjectId* oid);
 Commit* find_commit_by_hash(Repository* repo, const char* hash);
+Commit* commit_parent(Repository* repo, const Commit* commit, int which);
+void print_log(Repository* repo);
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "object_store.h"
+#include "object_types.h"
+
+// The commit graph records the shape of history so that ancestry queries
+// need not parse commit objects: "BCGR", version, commit count, a 256-entry
+// fan-out table, then one column per field: the sorted commit IDs, the
+// positions of each commit's first and second parents, generation numbers
+// and commit times, and finally a hash of everything before it. IDs and
+// the trailing hash have the repository's object format. A root commit
+// has generation 1 and every other commit one more than its highest
+// parent, so a commit can only be an ancestor of commits with a strictly
+// larger generation.
+#define COMMIT_GRAPH_FILE OBJECTS_DIR "/info/commit-graph"
+#define COMMIT_GRAPH_SIGNATURE 0x42434752u  // "BCGR"
+#define COMMIT_GRAPH_VERSION 2
+#define GRAPH_NO_PARENT 0xffffffffu
+// Commits made since the graph was written have no known generation
+#define GENERATION_INFINITY 0xffffffffu
+
+int commit_graph_write(Repository* repo);
+int is_ancestor(Repository* repo, const Commit* ancestor, const Commit* descendant);
+Commit* merge_base(Repository* repo, const Commit* a, const Commit* b);
+
+#endif
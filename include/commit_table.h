@@ -0,0 +1,17 @@
+#ifndef COMMIT_TABLE_H
+#define COMMIT_TABLE_H
+
+#include "object_types.h"
+
+#define COMMIT_CACHE_DEFAULT_SIZE 4096
+#define COMMIT_CACHE_MIN_SIZE 16
+
+size_t commit_cache_default_size(void);
+void commit_table_init(CommitTable* table, size_t max_cached, Arena* arena);
+void commit_table_free(CommitTable* table);
+Commit* commit_table_get(CommitTable* table, const ObjectId* oid);
+Commit* commit_table_put(CommitTable* table, Commit* commit);
+void commit_pin(CommitTable* table, Commit* commit);
+void commit_unpin(CommitTable* table, Commit* commit);
+
+#endif
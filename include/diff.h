@@ -0,0 +1,15 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include "line_diff.h"
+#include "object_types.h"
+
+// `babygit diff`: the working tree against the index, the index against
+// HEAD (--cached), or one commit against another, as unified diffs on
+// stdout.
+int diff_worktree(Repository* repo, const DiffOptions* opts);
+int diff_cached(Repository* repo, const DiffOptions* opts);
+int diff_commits(Repository* repo, const char* old_rev, const char* new_rev,
+                 const DiffOptions* opts);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+#include "object_types.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// An optional daemon (`babygit fsmonitor start`) watches the working tree
+// with inotify and keeps a journal of the paths that changed. Each query
+// over its socket returns a token for the journal's current position and
+// every path changed since the token passed in. A path ending in '/'
+// stands for everything below that directory. When the token is too old
+// for the journal, or from an earlier daemon, the answer is "full":
+// anything may have changed.
+//
+// The index keeps the token of the last query, a bit per entry saying the
+// file was found unchanged since then, and the untracked files seen then,
+// so status and `add .` only look at what changed.
+#define FSMONITOR_SOCKET ".babygit/fsmonitor.sock"
+#define FSMONITOR_LOG ".babygit/fsmonitor.log"
+
+// Index extension: the token, NUL-terminated; the number of entries and a
+// bitmap of their fsmonitor_valid bits; the number of untracked files and
+// their NUL-terminated paths. Counts are 32-bit big-endian.
+#define INDEX_EXT_FSMONITOR 0x46534d4eu  // "FSMN"
+
+typedef struct FsmonitorChanges {
+    char* token;   // position of the journal when the query was answered
+    int full;      // the old token was stale
+    char** paths;  // sorted
+    size_t count;
+    char* data;    // storage for token and paths
+} FsmonitorChanges;
+
+int fsmonitor_connect(void);
+ssize_t fsmonitor_request(const char* request, char** reply);
+int fsmonitor_query(const char* token, FsmonitorChanges* out);
+void fsmonitor_changes_free(FsmonitorChanges* changes);
+int fsmonitor_refresh(Repository* repo, FsmonitorChanges* changes);
+int fsmonitor_changed(const FsmonitorChanges* changes, const char* path);
+void fsmonitor_set_untracked(Repository* repo, char** paths, size_t count);
+void fsmonitor_clear(Repository* repo);
+
+size_t fsmonitor_ext_size(const Repository* repo);
+void fsmonitor_ext_write(const Repository* repo, unsigned char* out);
+void fsmonitor_ext_read(Repository* repo, const unsigned char* data, size_t len);
+
+int fsmonitor_daemon_start(void);
+int fsmonitor_daemon_stop(void);
+int fsmonitor_daemon_status(void);
+
+#endif
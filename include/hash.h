@@ -0,0 +1,78 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "oid.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+
+#define HASH_BLOCK_SIZE 64  // the same for SHA-1 and SHA-256
+
+// A repository names its objects with SHA-1 or SHA-256, chosen when it is
+// created. Everything that depends on the width of an ID reads it from
+// hash_algo, which is set once before the repository is opened.
+typedef enum ObjectFormat {
+    OBJECT_FORMAT_SHA1,
+    OBJECT_FORMAT_SHA256
+} ObjectFormat;
+
+// Each format is computed by one of several backends, picked once per
+// process:
+//   shani     the x86 SHA extensions, when the CPU has them
+//   openssl   libcrypto, which has its own assembly for most CPUs
+//   portable  plain C
+// BABYGIT_HASH names a backend to use instead.
+typedef enum HashBackend {
+    HASH_SHANI,
+    HASH_OPENSSL,
+    HASH_PORTABLE
+} HashBackend;
+
+typedef struct HashContext HashContext;
+
+// A backend's routines for one format. Each is compiled separately for
+// its format, so no format or backend checks remain inside them.
+typedef struct HashOps {
+    int (*init)(HashContext* ctx);
+    void (*update)(HashContext* ctx, const void* data, size_t len);
+    void (*final)(HashContext* ctx, unsigned char* out);
+} HashOps;
+
+typedef struct HashAlgo {
+    const char* name;
+    ObjectFormat format;
+    size_t rawsz;
+    size_t hexsz;
+    const HashOps* ops;
+    HashBackend backend;
+} HashAlgo;
+
+extern const HashAlgo* hash_algo;
+
+// Incremental hash state, so large inputs can be hashed in pieces.
+struct HashContext {
+    const HashOps* ops;
+    uint32_t state[8];
+    uint64_t length;                        // bytes hashed so far
+    unsigned char block[HASH_BLOCK_SIZE];   // partial block
+    EVP_MD_CTX* md;                         // openssl backend only
+};
+
+int object_format_from_name(const char* name, ObjectFormat* out);
+void hash_set_format(ObjectFormat format);
+const char* hash_backend_name(void);
+
+int hash_init(HashContext* ctx);
+void hash_update(HashContext* ctx, const void* data, size_t len);
+void hash_final(HashContext* ctx, ObjectId* out);
+void hash_discard(HashContext* ctx);
+
+void calculate_hash(const void* content, size_t len, ObjectId* out);
+
+// Hash count independent buffers. The shani backend runs two SHA-1
+// messages through the rounds side by side, so many small buffers hash
+// faster this way than one at a time.
+void hash_buffers(const void* const* data, const size_t* len, ObjectId* out, size_t count);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "object_types.h"
+
+#include <sys/stat.h>
+
+// On-disk index: header, fixed-width entries sorted by path, a table of
+// NUL-terminated paths, optional extensions (signature, length, data),
+// then a hash of everything before it. Object IDs and the checksum have the
+// repository's object format, and entries are padded to 8 bytes.
+#define INDEX_SIGNATURE 0x42474958u  // "BGIX"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 16
+#define INDEX_ENTRY_SIZE ((48 + hash_algo->rawsz + 7) & ~(size_t)7)
+#define INDEX_CHECKSUM_SIZE (hash_algo->rawsz)
+#define INDEX_EXT_HEADER_SIZE 8
+
+#define INDEX_PATH ".babygit/index"
+
+int save_index(Repository* repo);
+int load_index(Repository* repo);
+
+int index_entry_pos(const Repository* repo, const char* filepath);
+FileStatus* find_index_entry(Repository* repo, const char* filepath);
+FileStatus* index_insert_entry(Repository* repo, int pos, const char* filepath);
+
+void index_fill_stat_data(FileStatus* entry, const struct stat* st);
+int index_stat_data_matches(const FileStatus* entry, const struct stat* st);
+int index_entry_is_racy(const Repository* repo, const FileStatus* entry);
+int index_entry_up_to_date(const Repository* repo, const FileStatus* entry,
+                           const struct stat* st);
+
+#endif
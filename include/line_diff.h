@@ -0,0 +1,27 @@
+#ifndef LINE_DIFF_H
+#define LINE_DIFF_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Line diffs of two buffers. Lines are compared by equivalence class,
+// found by hashing each line once, so the algorithms only ever compare
+// integers. Every per-line array is allocated once per side; nothing is
+// allocated per line.
+typedef enum DiffAlgorithm {
+    DIFF_MYERS,      // shortest edit script, as git's default
+    DIFF_HISTOGRAM,  // anchors on the rarest common lines, falls back to Myers
+} DiffAlgorithm;
+
+typedef struct DiffOptions {
+    DiffAlgorithm algorithm;
+    int context;  // unchanged lines shown around each change
+} DiffOptions;
+
+#define DIFF_OPTIONS_INIT {DIFF_MYERS, 3}
+
+int diff_is_binary(const char* data, size_t len);
+int diff_unified(const char* old_data, size_t old_len, const char* new_data, size_t new_len,
+                 const DiffOptions* opts, FILE* out);
+
+#endif
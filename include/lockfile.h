@@ -0,0 +1,39 @@
+#ifndef LOCKFILE_H
+#define LOCKFILE_H
+
+#include <stddef.h>
+
+// A file is updated by writing its new contents to "<path>.lock", created
+// exclusively so that concurrent writers fail instead of clobbering each
+// other, and renaming that over the file. Readers see the old or the new
+// contents, never a partial one.
+#define LOCK_SUFFIX ".lock"
+
+// How hard writes are pushed to disk, from BABYGIT_FSYNC:
+//   batch (default)  one syncfs before files are renamed into place and
+//                    one after, however many objects and refs were written;
+//                    until then new objects wait in a staging directory
+//   file             fsync every file and its directory as it is written
+//   off              leave it to the kernel
+typedef enum FsyncMode {
+    FSYNC_OFF,
+    FSYNC_FILE,
+    FSYNC_BATCH
+} FsyncMode;
+
+typedef struct LockFile LockFile;
+
+LockFile* hold_lock_file(const char* path);
+LockFile* try_lock_file(const char* path);
+int write_lock_file(LockFile* lock, const void* data, size_t len);
+int commit_lock_file(LockFile* lock);
+void rollback_lock_file(LockFile* lock);
+int commit_lock_files(void);
+
+FsyncMode fsync_mode(void);
+int fsync_written(int fd);
+void fsync_renamed(const char* path);
+void fsync_after_barrier(int (*fn)(void));
+int fsync_barrier(void);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef OBJECT_STORE_H
+#define OBJECT_STORE_H
+
+#include "oid.h"
+
+#include <stddef.h>
+
+// Objects are stored zlib-compressed as "<type> <size>\0<content>" under
+// .babygit/objects/<first 2 hex digits>/<remaining digits>, and are named by
+// the hash of that uncompressed form in the repository's object format.
+#define OBJECTS_DIR ".babygit/objects"
+
+// Largest file write_blob_files() hashes from memory alongside others
+#define BLOB_BATCH_MAX (64 * 1024)
+
+typedef enum ObjectType {
+    OBJ_NONE = 0,
+    OBJ_BLOB,
+    OBJ_COMMIT,
+    OBJ_TREE
+} ObjectType;
+
+const char* object_type_name(ObjectType type);
+void object_path(const ObjectId* oid, char* out, size_t out_size);
+int object_exists(const ObjectId* oid);
+
+int write_object(ObjectType type, const void* data, size_t len, ObjectId* oid_out);
+int read_object(const ObjectId* oid, ObjectType* type, char** data, size_t* len);
+int read_object_to_fd(const ObjectId* oid, ObjectType type, int fd);
+
+int hash_blob_file(const char* path, ObjectId* oid_out);
+int write_blob_file(const char* path, ObjectId* oid_out);
+void write_blob_files(const char* const* paths, size_t count, ObjectId* oids_out, int* errors);
+
+#endif
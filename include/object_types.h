@@ -1,45 +1,101 @@
 #ifndef MYGIT_TYPES_H
 #define MYGIT_TYPES_H
 
+#include "arena.h"
+#include "oid.h"
+
+#include <stddef.h>
 #include <time.h>
 
+// 176 bytes, since IDs are sized for SHA-256, so the arena hands each
+// commit a block from its 256-byte size class.
 typedef struct Commit {
-    char hash[41];
-    char parent_hash[41];
-    char second_parent[41];
-    char author[256];
-    char message[1024];
+    ObjectId oid;
+    ObjectId tree;
+    ObjectId parents[2];
     time_t timestamp;
-    struct Commit* parent;
-    struct Commit* next;
+    const char* author;  // interned in the repository arena
+    char* message;       // allocated from the repository arena
+    struct Commit* lru_prev;
+    struct Commit* lru_next;
+    int parent_count;
+    int pin_count;  // pinned commits are never evicted
 } Commit;
 
+// Open-addressing hash table of parsed commits, keyed by binary OID. It
+// owns the commits it holds and doubles as a bounded LRU cache: once more
+// than max_cached unpinned commits are held, the least recently used are
+// freed (parents are re-read on demand by their IDs).
+typedef struct CommitTable {
+    Commit** slots;
+    size_t capacity;  // always a power of two
+    size_t count;
+    size_t max_cached;
+    size_t unpinned;
+    Commit* lru_head;  // most recently used
+    Commit* lru_tail;
+    unsigned long hits;
+    unsigned long misses;
+    Arena* arena;  // where evicted commits are returned
+} CommitTable;
+
+// A branch's commit is only parsed when something asks for it through
+// branch_head(); until then the ID read from its ref is enough.
 typedef struct Branch {
     char name[256];
-    Commit* head;
+    ObjectId oid;   // null while the branch has no commits
+    Commit* head;   // oid's commit once loaded
+    int ref_dirty;  // oid differs from the stored ref
     struct Branch* parent;
     struct Branch* children;
-    struct Branch* next;
+    struct Branch* next_sibling;  // next child of the same parent
+    struct Branch* next;          // every branch of the repository
+    struct Branch* hash_next;     // bucket chain in the branch map
 } Branch;
 
+// Longest path, with its NUL, that the index holds
+#define FILE_PATH_MAX 256
+
 typedef struct FileStatus {
-    char filename[256];
-    char hash[41];
+    const char* filename;  // in the mapped index, or the repository arena
+    ObjectId oid;
     int status;
+    // Cached stat data, used to skip re-hashing unchanged files
+    long long mtime_ns;
+    long long ctime_ns;
+    long long size;
+    unsigned long long ino;
+    unsigned int mode;
+    int fsmonitor_valid;  // unchanged since the index's fsmonitor token
 } FileStatus;
 
 typedef struct Stash {
-    char message[256];
+    char* message;
     Commit* commit;
     struct Stash* next;
 } Stash;
 
+// Everything a Repository points to (commits, branches, stashes and their
+// strings) is allocated from its arena and released with it.
 typedef struct Repository {
+    Arena arena;
     Branch* branches;
+    Branch** branch_map;     // hash buckets of branches by name
+    size_t branch_map_size;  // always a power of two
+    size_t branch_count;
     Branch* current_branch;
-    Commit* commits;
+    int head_dirty;  // HEAD names a different branch than on disk
+    CommitTable commits;
     FileStatus* staged_files;
     int staged_count;
+    long long index_mtime_ns;  // when the loaded index was last written
+    const void* index_map;  // the index file; entries point into its paths
+    size_t index_map_size;
+    struct CacheTree* cache_tree;  // tree IDs of unchanged directories
+    int index_dirty;  // entries or cache tree differ from the index file
+    char* fsmonitor_token;  // NULL unless the fsmonitor daemon was queried
+    char** untracked;       // sorted untracked files as of fsmonitor_token
+    size_t untracked_count;
     Stash* stashes;
 } Repository;
 
@@ -0,0 +1,44 @@
+#ifndef OID_H
+#define OID_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Room for the widest supported ID, SHA-256. The repository's format
+// decides how many of these bytes are used (hash_algo->rawsz); the rest
+// are always zero, so IDs are compared at full width whatever the format.
+#define OID_RAW_SIZE 32
+#define OID_HEX_SIZE 64
+
+// Binary object ID. Object IDs are kept in this form everywhere in memory
+// and only converted to hex when they are printed or used in file names
+// and text objects.
+typedef struct ObjectId {
+    unsigned char hash[OID_RAW_SIZE];
+} ObjectId;
+
+// Compare as four 64-bit words rather than bytewise.
+static inline int oid_eq(const ObjectId* a, const ObjectId* b) {
+    uint64_t x = 0;
+    for (int i = 0; i < OID_RAW_SIZE; i += 8) {
+        uint64_t wa, wb;
+        memcpy(&wa, a->hash + i, 8);
+        memcpy(&wb, b->hash + i, 8);
+        x |= wa ^ wb;
+    }
+    return x == 0;
+}
+
+static inline int oid_cmp(const ObjectId* a, const ObjectId* b) {
+    return memcmp(a->hash, b->hash, OID_RAW_SIZE);
+}
+
+static inline int oid_is_null(const ObjectId* oid) {
+    static const ObjectId null_oid;
+    return oid_eq(oid, &null_oid);
+}
+
+int oid_from_hex(ObjectId* oid, const char* hex);
+char* oid_to_hex(const ObjectId* oid, char* out);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "object_store.h"
+
+// A pack holds many objects in one file: "PACK", version, object count,
+// then each object as a type/size header and zlib data, then a hash of
+// the whole pack. Objects may be stored as a delta against an earlier
+// object in the same pack (OFS_DELTA). The matching .idx has a 256-entry
+// fan-out table, the sorted object IDs and their pack offsets, so lookups
+// are a binary search over an mmapped file.
+#define PACK_DIR OBJECTS_DIR "/pack"
+#define PACK_SIGNATURE 0x5041434bu      // "PACK"
+#define PACK_VERSION 2
+#define PACK_IDX_SIGNATURE 0x42504958u  // "BPIX"
+#define PACK_IDX_VERSION 1
+
+#define PACK_DELTA_WINDOW 10
+#define PACK_MAX_DELTA_DEPTH 16
+// Objects larger than this are left loose rather than packed
+#define PACK_MAX_OBJECT_SIZE (256u * 1024 * 1024)
+
+int pack_has_object(const ObjectId* oid);
+int pack_read_object(const ObjectId* oid, ObjectType* type, char** data, size_t* len);
+int pack_read_object_to_fd(const ObjectId* oid, ObjectType type, int fd);
+int repack_objects(void);
+
+#endif
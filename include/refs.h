@@ -0,0 +1,19 @@
+#ifndef REFS_H
+#define REFS_H
+
+#include "object_types.h"
+
+// Branch refs live either in their own file under refs/heads or, after gc,
+// as lines of packed-refs: a header line, then "<hex id> refs/heads/<name>"
+// for each branch, sorted by name. A loose ref overrides a packed one.
+#define HEAD_FILE ".babygit/HEAD"
+#define REFS_HEADS_DIR ".babygit/refs/heads"
+#define PACKED_REFS_FILE ".babygit/packed-refs"
+#define PACKED_REFS_HEADER "# pack-refs with: sorted\n"
+
+int load_refs(Repository* repo);
+int write_ref(Branch* branch);
+int write_head(Repository* repo);
+int pack_refs(Repository* repo);
+
+#endif
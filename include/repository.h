@@ -2,12 +2,13 @@
 #define REPOSITORY_H
 
 #include "branch.h"
+#include "hash.h"
 #include "object_types.h"
 
 // Repository functions
-Repository* init_repository();
+Repository* init_repository(ObjectFormat format);
 Repository* load_repository();
-void save_repository(Repository* repo);
+int save_repository(Repository* repo);
 void free_repository(Repository* repo);
 
 #endif
@@ -0,0 +1,16 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+typedef void (*thread_job_fn)(void* arg);
+
+typedef struct ThreadPool ThreadPool;
+
+int thread_pool_default_size(void);
+ThreadPool* thread_pool_create(int num_threads);
+int thread_pool_submit(ThreadPool* pool, thread_job_fn fn, void* arg);
+void thread_pool_wait(ThreadPool* pool);
+void thread_pool_destroy(ThreadPool* pool);
+
+#endif
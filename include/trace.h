@@ -0,0 +1,77 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Timers and counters for finding where a command spends its time. They
+// are off unless BABYGIT_TRACE is set:
+//   json     a summary of every region and counter when the command ends
+//   chrome   each timed region as a Chrome trace event, for about:tracing
+//            or Perfetto
+// Either may be followed by ":<file>" to write there instead of stderr.
+// While tracing is off each hook costs one predictable branch; building
+// with NO_TRACE defined removes them altogether.
+
+// Regions nest, so each one's time includes the regions it contains.
+typedef enum TraceRegion {
+    TRACE_COMMAND,
+    TRACE_LOAD_REPOSITORY,
+    TRACE_LOAD_INDEX,
+    TRACE_TRAVERSE,   // walking the working tree
+    TRACE_HASH,
+    TRACE_OBJECT_READ,
+    TRACE_OBJECT_WRITE,
+    TRACE_SERIALIZE,  // building tree, commit and index contents
+    TRACE_DIFF,       // matching lines and writing hunks
+    TRACE_SAVE,       // writing refs, HEAD and the index back
+    TRACE_REGION_COUNT
+} TraceRegion;
+
+typedef enum TraceCounter {
+    TRACE_FILES_STATED,
+    TRACE_BYTES_HASHED,
+    TRACE_OBJECTS_READ,
+    TRACE_OBJECTS_WRITTEN,    // new objects; ones already stored are not counted
+    TRACE_INDEX_STAT_HITS,    // files not rehashed because their stat data matched
+    TRACE_CACHE_TREE_HITS,    // directories whose tree was reused
+    TRACE_FSMONITOR_HITS,     // files not looked at because fsmonitor saw no change
+    TRACE_COMMIT_CACHE_HITS,
+    TRACE_COMMIT_CACHE_MISSES,
+    TRACE_COUNTER_COUNT
+} TraceCounter;
+
+extern int trace_enabled;
+extern uint64_t trace_counters[TRACE_COUNTER_COUNT];
+
+void trace_setup(const char* command);
+uint64_t trace_now_ns(void);
+void trace_record(TraceRegion region, uint64_t start_ns);
+
+#ifdef NO_TRACE
+static inline uint64_t trace_begin(void) { return 0; }
+static inline void trace_end(TraceRegion region, uint64_t start) {
+    (void)region;
+    (void)start;
+}
+static inline void trace_count(TraceCounter counter, uint64_t n) {
+    (void)counter;
+    (void)n;
+}
+#else
+// Start a region; pass the result to trace_end() when it finishes.
+static inline uint64_t trace_begin(void) {
+    return __builtin_expect(trace_enabled, 0) ? trace_now_ns() : 0;
+}
+
+static inline void trace_end(TraceRegion region, uint64_t start) {
+    if (__builtin_expect(trace_enabled, 0)) trace_record(region, start);
+}
+
+// Safe to call from any thread.
+static inline void trace_count(TraceCounter counter, uint64_t n) {
+    if (__builtin_expect(trace_enabled, 0))
+        __atomic_fetch_add(&trace_counters[counter], n, __ATOMIC_RELAXED);
+}
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include "object_types.h"
+
+#include <stddef.h>
+
+// A tree object lists one directory: for each entry "<mode> <name>\0"
+// followed by the entry's raw ID, sorted the way the index is
+// (a subdirectory sorts as if its name ended in '/').
+#define TREE_MODE_FILE "100644"
+#define TREE_MODE_EXECUTABLE "100755"
+#define TREE_MODE_SYMLINK "120000"
+#define TREE_MODE_DIR "40000"
+
+// Index extension holding the cache tree
+#define INDEX_EXT_TREE 0x54524545u  // "TREE"
+
+// The cache tree remembers the tree ID written for every directory of the
+// index. entry_count is how many index entries the directory covers, or -1
+// once something under it has changed; valid directories are reused as-is
+// when the next commit's trees are written.
+typedef struct CacheTree {
+  char *name;  // directory name relative to its parent, "" for the root
+  int entry_count;
+  ObjectId oid;
+  struct CacheTree **subtrees;  // sorted by name
+  int subtree_count;
+  int subtree_alloc;
+  int used;
+} CacheTree;
+
+// A tree object read one entry at a time.
+typedef struct TreeDesc {
+  char *data;
+  size_t len;
+  size_t pos;
+} TreeDesc;
+
+typedef struct TreeEntry {
+  const char *name;  // points into the tree's data, NUL-terminated
+  size_t name_len;
+  unsigned int mode; // S_IFDIR, S_IFLNK or S_IFREG with permission bits
+  ObjectId oid;
+} TreeEntry;
+
+// Called for each path that differs between a tree and the index, in
+// sorted order; status is 1 (modified), 2 (added) or 3 (deleted) as for
+// FileStatus.
+typedef void (*tree_change_fn)(const char *path, int status, void *ctx);
+
+// Called for each file that differs between two trees, in sorted order.
+// old_entry or new_entry is NULL where the path is missing on that side.
+typedef void (*tree_pair_fn)(const char *path, const TreeEntry *old_entry,
+                             const TreeEntry *new_entry, void *ctx);
+
+const char *tree_entry_mode(unsigned int st_mode);
+
+int tree_desc_open(TreeDesc *desc, const ObjectId *oid);
+int tree_desc_next(TreeDesc *desc, TreeEntry *entry);
+void tree_desc_close(TreeDesc *desc);
+int diff_index_with_tree(Repository *repo, const ObjectId *tree,
+                         tree_change_fn fn, void *ctx);
+int diff_trees(const ObjectId *old_tree, const ObjectId *new_tree,
+               tree_pair_fn fn, void *ctx);
+int tree_find_path(const ObjectId *tree, const char *path, TreeEntry *entry);
+
+void cache_tree_free(CacheTree *tree);
+void cache_tree_invalidate(CacheTree *root, const char *path);
+int cache_tree_update(Repository *repo, ObjectId *tree_oid);
+
+size_t cache_tree_ext_size(const CacheTree *root);
+unsigned char *cache_tree_ext_write(const CacheTree *root, unsigned char *out);
+CacheTree *cache_tree_ext_read(const unsigned char *data, size_t len);
+
+#endif
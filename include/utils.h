@@ -1,9 +1,18 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-#include <openssl/sha.h>
+#include "hash.h"
+#include "oid.h"
 
-void calculate_hash(const char* content, size_t len, char* output);
+#include <stddef.h>
+
+// Size of the buffers used when streaming file contents.
+#define HASH_STREAM_BUFSZ (128 * 1024)
+
+int hex_to_bytes(const char* hex, unsigned char* out, size_t len);
+void bytes_to_hex(const unsigned char* bytes, size_t len, char* out);
+
+int write_fully(int fd, const void* data, size_t len);
 int file_exists(const char* path);
 void ensure_directory_exists(const char* path);
 
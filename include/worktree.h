@@ -0,0 +1,14 @@
+#ifndef WORKTREE_H
+#define WORKTREE_H
+
+// Called once per regular file or symlink under the working tree, from one of
+// the walker threads. worker is in [0, num_threads) and lets callers keep
+// per-thread results without locking. path is relative to the top of the
+// working tree and only valid for the duration of the call.
+typedef void (*worktree_visit_fn)(int worker, const char* path, void* ctx);
+
+int walk_worktree(int num_threads, worktree_visit_fn visit, void* ctx);
+int walk_worktree_dir(const char* dir, int num_threads, worktree_visit_fn visit,
+                      void* ctx);
+
+#endif
@@ -0,0 +1,167 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_INTERN_MIN_CAPACITY 64
+
+struct ArenaChunk {
+  ArenaChunk *next;
+  size_t size;
+  size_t used;
+  _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+void arena_init(Arena *arena) {
+  memset(arena, 0, sizeof(Arena));
+  arena->next_chunk_size = ARENA_MIN_CHUNK;
+}
+
+void arena_destroy(Arena *arena) {
+  ArenaChunk *chunk = arena->chunks;
+  while (chunk) {
+    ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(arena->interned);
+  arena_init(arena);
+}
+
+// Size class index for size, or -1 if it is too big to have one.
+static int size_class(size_t size) {
+  if (size > ARENA_MAX_CLASS_SIZE)
+    return -1;
+  int cls = 0;
+  size_t class_size = ARENA_ALIGN;
+  while (class_size < size) {
+    class_size <<= 1;
+    cls++;
+  }
+  return cls;
+}
+
+static void *bump(Arena *arena, size_t size) {
+  ArenaChunk *chunk = arena->chunks;
+  if (!chunk || chunk->size - chunk->used < size) {
+    size_t chunk_size = arena->next_chunk_size;
+    if (chunk_size < size)
+      chunk_size = size;
+    chunk = malloc(sizeof(ArenaChunk) + chunk_size);
+    if (!chunk)
+      return NULL;
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->reserved += sizeof(ArenaChunk) + chunk_size;
+    if (arena->next_chunk_size < ARENA_MAX_CHUNK)
+      arena->next_chunk_size *= 2;
+  }
+  void *ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+// Zeroed, ARENA_ALIGN-aligned memory for size bytes.
+void *arena_alloc(Arena *arena, size_t size) {
+  if (size == 0)
+    size = 1;
+  int cls = size_class(size);
+  size_t rounded = cls >= 0 ? (size_t)ARENA_ALIGN << cls
+                            : (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  void *ptr = NULL;
+  if (cls >= 0 && arena->free_lists[cls]) {
+    ptr = arena->free_lists[cls];
+    memcpy(&arena->free_lists[cls], ptr, sizeof(void *));
+  } else {
+    ptr = bump(arena, rounded);
+    if (!ptr)
+      return NULL;
+  }
+  memset(ptr, 0, rounded);
+  return ptr;
+}
+
+// Return a block of the size it was allocated with for reuse.
+void arena_free(Arena *arena, void *ptr, size_t size) {
+  if (!ptr)
+    return;
+  int cls = size_class(size ? size : 1);
+  if (cls < 0)
+    return;
+  memcpy(ptr, &arena->free_lists[cls], sizeof(void *));
+  arena->free_lists[cls] = ptr;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t len) {
+  char *copy = arena_alloc(arena, len + 1);
+  if (copy)
+    memcpy(copy, str, len);
+  return copy;
+}
+
+char *arena_strdup(Arena *arena, const char *str) {
+  return arena_strndup(arena, str, strlen(str));
+}
+
+void arena_free_string(Arena *arena, char *str) {
+  if (str)
+    arena_free(arena, str, strlen(str) + 1);
+}
+
+static uint64_t string_hash(const char *str, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ull;  // FNV-1a
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)str[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+static int intern_grow(Arena *arena) {
+  size_t capacity = arena->intern_capacity ? arena->intern_capacity * 2
+                                           : ARENA_INTERN_MIN_CAPACITY;
+  const char **slots = calloc(capacity, sizeof(const char *));
+  if (!slots)
+    return -1;
+  for (size_t i = 0; i < arena->intern_capacity; i++) {
+    const char *str = arena->interned[i];
+    if (!str)
+      continue;
+    size_t j = string_hash(str, strlen(str)) & (capacity - 1);
+    while (slots[j])
+      j = (j + 1) & (capacity - 1);
+    slots[j] = str;
+  }
+  free(arena->interned);
+  arena->interned = slots;
+  arena->intern_capacity = capacity;
+  return 0;
+}
+
+// One shared copy of each distinct string, such as commit authors. The
+// result lives until the arena is destroyed and must not be freed.
+const char *arena_intern(Arena *arena, const char *str, size_t len) {
+  if ((arena->intern_count + 1) * 2 > arena->intern_capacity &&
+      intern_grow(arena) != 0)
+    return NULL;
+
+  size_t mask = arena->intern_capacity - 1;
+  size_t i = string_hash(str, len) & mask;
+  while (arena->interned[i]) {
+    const char *other = arena->interned[i];
+    if (strncmp(other, str, len) == 0 && other[len] == '\0')
+      return other;
+    i = (i + 1) & mask;
+  }
+
+  char *copy = arena_strndup(arena, str, len);
+  if (!copy)
+    return NULL;
+  arena->interned[i] = copy;
+  arena->intern_count++;
+  return copy;
+}
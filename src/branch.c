@@ -1,29 +1,65 @@
 #include "branch.h"
+#include "checkout.h"
+#include "commit.h"
+#include "commit_table.h"
+#include "refs.h"
 #include "repository.h"
 #include "utils.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void load_branch_head(Branch* branch) {
-    char path[512];
-    snprintf(path, sizeof(path), ".babygit/refs/heads/%s", branch->name);
-    FILE* f = fopen(path, "r");
-    if (!f) {
-        branch->head = NULL;
-        return;
+#define BRANCH_MAP_MIN_SIZE 64
+
+static uint64_t branch_name_hash(const char* name) {
+    uint64_t h = 0xcbf29ce484222325ull;  // FNV-1a
+    for (; *name; name++) {
+        h ^= (unsigned char)*name;
+        h *= 0x100000001b3ull;
     }
-    char hash[41];
-    if (fgets(hash, sizeof(hash), f)) {
-        // remove trailing newline
-        hash[strcspn(hash, "\n")] = 0;
-        // find commit object by hash
-        branch->head = find_commit_by_hash(hash);
-    } else {
-        branch->head = NULL;
+    return h;
+}
+
+// Keep at most one branch per bucket on average.
+static int branch_map_insert(Repository* repo, Branch* branch) {
+    if (repo->branch_count >= repo->branch_map_size) {
+        size_t size = repo->branch_map_size ? repo->branch_map_size * 2
+                                            : BRANCH_MAP_MIN_SIZE;
+        Branch** map = calloc(size, sizeof(Branch*));
+        if (!map) return -1;
+        for (Branch* cur = repo->branches; cur; cur = cur->next) {
+            size_t i = branch_name_hash(cur->name) & (size - 1);
+            cur->hash_next = map[i];
+            map[i] = cur;
+        }
+        free(repo->branch_map);
+        repo->branch_map = map;
+        repo->branch_map_size = size;
     }
-    fclose(f);
+    size_t i = branch_name_hash(branch->name) & (repo->branch_map_size - 1);
+    branch->hash_next = repo->branch_map[i];
+    repo->branch_map[i] = branch;
+    return 0;
+}
+
+// A new branch with no commit, added to the repository's list and map.
+static Branch* new_branch(Repository* repo, const char* name) {
+    Branch* branch = arena_alloc(&repo->arena, sizeof(Branch));
+    if (!branch) return NULL;
+
+    strncpy(branch->name, name, sizeof(branch->name) - 1);
+    branch->name[sizeof(branch->name) - 1] = '\0';
+
+    if (branch_map_insert(repo, branch) != 0) {
+        arena_free(&repo->arena, branch, sizeof(Branch));
+        return NULL;
+    }
+    branch->next = repo->branches;
+    repo->branches = branch;
+    repo->branch_count++;
+    return branch;
 }
 
 Branch* create_branch(Repository* repo, const char* name) {
@@ -34,77 +70,38 @@ Branch* create_branch(Repository* repo, const char* name) {
         return NULL;
     }
 
-    Branch* branch = malloc(sizeof(Branch));
+    Branch* branch = new_branch(repo, name);
     if (!branch) return NULL;
 
-    memset(branch, 0, sizeof(Branch));
-    strncpy(branch->name, name, sizeof(branch->name) - 1);
-    branch->name[sizeof(branch->name) - 1] = '\0';
-
-    branch->head = repo->current_branch ? repo->current_branch->head : NULL;
-    branch->parent = repo->current_branch;
-    branch->children = NULL;
-    branch->next = NULL;
-
-    // Add as child to parent branch if applicable
-    if (branch->parent) {
-        branch->next = branch->parent->children;
-        branch->parent->children = branch;
+    // Start from wherever the current branch is
+    Branch* parent = repo->current_branch;
+    if (parent) {
+        branch->oid = parent->oid;
+        branch->parent = parent;
+        branch->next_sibling = parent->children;
+        parent->children = branch;
     }
 
-    // Add to repository branch list at end
-    if (!repo->branches) {
-        repo->branches = branch;
-    } else {
-        Branch* cur = repo->branches;
-        while (cur->next) cur = cur->next;
-        cur->next = branch;
-    }
-
-    // Create/update branch ref file
-    char path[256];
-    snprintf(path, sizeof(path), ".babygit/refs/heads/%s", name);
-    FILE* f = fopen(path, "w");
-    if (f) {
-        if (branch->head) {
-            fprintf(f, "%s\n", branch->head->hash);
-        }
-        fclose(f);
-    } else {
+    if (write_ref(branch) != 0) {
         printf("Warning: Could not create branch reference file for %s\n", name);
     }
 
     printf("Created branch %s\n", name);
-    load_branch_head(branch);
     return branch;
 }
 
 Branch* find_branch(Repository* repo, const char* branch_name) {
-    if (!repo || !branch_name) return NULL;
+    if (!repo || !branch_name || !repo->branch_map) return NULL;
 
-    Branch* current = repo->branches;
-    while (current) {
-        if (strcmp(current->name, branch_name) == 0) {
-            return current;
+    size_t i = branch_name_hash(branch_name) & (repo->branch_map_size - 1);
+    for (Branch* cur = repo->branch_map[i]; cur; cur = cur->hash_next) {
+        if (strcmp(cur->name, branch_name) == 0) {
+            return cur;
         }
-        current = current->next;
     }
     return NULL;
 }
 
-void free_branch(Branch* branch) {
-    if (!branch) return;
-
-    Branch* child = branch->children;
-    while (child) {
-        Branch* next_child = child->next;
-        free_branch(child);
-        child = next_child;
-    }
-
-    free(branch);
-}
-
 void checkout_branch(Repository* repo, const char* branch_name) {
     Branch* branch = find_branch(repo, branch_name);
     if (!branch) {
@@ -112,75 +109,78 @@ void checkout_branch(Repository* repo, const char* branch_name) {
         return;
     }
 
-    load_branch_head(branch);
-
-    repo->current_branch = branch;
+    // Only the files that differ between the two commits are rewritten
+    Branch* current = repo->current_branch;
+    if (current && current != branch) {
+        Commit* from = branch_head(repo, current);
+        Commit* to = branch_head(repo, branch);
+        if ((!from && !oid_is_null(&current->oid)) || (!to && !oid_is_null(&branch->oid))) {
+            printf("Could not read the commits to switch between\n");
+            return;
+        }
+        if ((from || to) && checkout_tree(repo, from ? &from->tree : NULL,
+                                          to ? &to->tree : NULL) != 0) {
+            printf("Staying on branch %s\n", current->name);
+            return;
+        }
+    }
 
-    FILE* head = fopen(".babygit/HEAD", "w");
-    if (head) {
-        fprintf(head, "ref: refs/heads/%s\n", branch_name);
-        fclose(head);
-    } else {
-        printf("Warning: Could not update HEAD file\n");
+    // HEAD is written by save_repository
+    if (repo->current_branch != branch) {
+        repo->current_branch = branch;
+        repo->head_dirty = 1;
     }
 
     printf("Switched to branch %s\n", branch_name);
 }
 
+// Add a branch read from an existing ref, without writing anything.
 Branch* create_branch_silent(Repository* repo, const char* name) {
     if (!repo || !name) return NULL;
 
     if (find_branch(repo, name)) {
         return NULL;
     }
+    return new_branch(repo, name);
+}
 
-    Branch* branch = malloc(sizeof(Branch));
+// The commit a branch points at, parsed on first use and pinned while the
+// branch refers to it. NULL for a branch with no commits, or if the
+// commit cannot be read.
+Commit* branch_head(Repository* repo, Branch* branch) {
     if (!branch) return NULL;
+    if (!branch->head && !oid_is_null(&branch->oid)) {
+        branch->head = lookup_commit(repo, &branch->oid);
+        commit_pin(&repo->commits, branch->head);
+    }
+    return branch->head;
+}
 
-    memset(branch, 0, sizeof(Branch));
-    strncpy(branch->name, name, sizeof(branch->name) - 1);
-    branch->name[sizeof(branch->name) - 1] = '\0';
-
-    branch->head = NULL;
-    branch->parent = NULL;
-    branch->children = NULL;
-
-    // Insert at head of branch list
-    branch->next = repo->branches;
-    repo->branches = branch;
-
-    // No ref file creation for silent branch
-
-    return branch;
+// Write a branch's ref if it has changed since it was read.
+int update_branch_ref(Branch* branch) {
+    if (!branch || !branch->ref_dirty) return 0;
+    return write_ref(branch);
 }
 
-// Additional utility: update branch ref file when head changes
-void update_branch_ref(Branch* branch) {
-    if (!branch) return;
-    char path[256];
-    snprintf(path, sizeof(path), ".babygit/refs/heads/%s", branch->name);
-    FILE* f = fopen(path, "w");
-    if (f) {
-        if (branch->head) {
-            fprintf(f, "%s\n", branch->head->hash);
-        } else {
-            fprintf(f, "\n"); // Clear ref if no head
-        }
-        fclose(f);
+// Point a branch at a commit, keeping that commit pinned in the commit
+// cache for as long as the branch refers to it
+void assign_branch_head(Repository* repo, Branch* branch, Commit* commit) {
+    if (!branch || (branch->head == commit && commit)) return;
+    commit_pin(&repo->commits, commit);
+    commit_unpin(&repo->commits, branch->head);
+    branch->head = commit;
+
+    ObjectId oid = {{0}};
+    if (commit) oid = commit->oid;
+    if (!oid_eq(&branch->oid, &oid)) {
+        branch->oid = oid;
+        branch->ref_dirty = 1;
     }
 }
 
 // Update the head pointer of a branch and save ref
-void set_branch_head(Branch* branch, Commit* commit) {
+void set_branch_head(Repository* repo, Branch* branch, Commit* commit) {
     if (!branch) return;
-    branch->head = commit;
+    assign_branch_head(repo, branch, commit);
     update_branch_ref(branch);
 }
-
-void load_all_branch_heads(Repository* repo) {
-    Branch* cur = repo->branches;
-    while (cur) {
-        load_branch_head(cur);
-        cur = cur->next;
-    }
-}
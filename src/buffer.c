@@ -0,0 +1,81 @@
+#include "buffer.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_MIN_CAPACITY 256
+
+// Make room for extra more bytes plus the terminating NUL.
+int buffer_grow(Buffer *buf, size_t extra) {
+  if (buf->len + extra < buf->cap)
+    return 0;
+  size_t cap = buf->cap ? buf->cap : BUFFER_MIN_CAPACITY;
+  while (cap <= buf->len + extra)
+    cap *= 2;
+  char *grown = realloc(buf->data, cap);
+  if (!grown)
+    return -1;
+  buf->data = grown;
+  buf->cap = cap;
+  return 0;
+}
+
+int buffer_put(Buffer *buf, const void *data, size_t len) {
+  if (buffer_grow(buf, len) != 0)
+    return -1;
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  buf->data[buf->len] = '\0';
+  return 0;
+}
+
+int buffer_puts(Buffer *buf, const char *str) {
+  return buffer_put(buf, str, strlen(str));
+}
+
+int buffer_putf(Buffer *buf, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  size_t room = buf->cap > buf->len ? buf->cap - buf->len : 0;
+  int n = vsnprintf(room ? buf->data + buf->len : NULL, room, fmt, ap);
+  va_end(ap);
+  if (n < 0)
+    return -1;
+  if ((size_t)n >= room) {
+    if (buffer_grow(buf, (size_t)n) != 0)
+      return -1;
+    va_start(ap, fmt);
+    vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, ap);
+    va_end(ap);
+  }
+  buf->len += (size_t)n;
+  return 0;
+}
+
+// Append n as a little-endian base-128 varint, as used in pack deltas.
+int buffer_put_varint(Buffer *buf, size_t n) {
+  unsigned char bytes[10];
+  int i = 0;
+  do {
+    bytes[i] = n & 0x7f;
+    n >>= 7;
+    if (n)
+      bytes[i] |= 0x80;
+    i++;
+  } while (n);
+  return buffer_put(buf, bytes, i);
+}
+
+void buffer_reset(Buffer *buf) {
+  buf->len = 0;
+  if (buf->data)
+    buf->data[0] = '\0';
+}
+
+void buffer_free(Buffer *buf) {
+  free(buf->data);
+  buf->data = NULL;
+  buf->len = buf->cap = 0;
+}
@@ -0,0 +1,288 @@
+#include "checkout.h"
+#include "index.h"
+#include "object_store.h"
+#include "staging.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Files a checkout worker writes per job
+#define CHECKOUT_CHUNK 64
+
+// One file that differs between the trees being switched between.
+typedef struct CheckoutChange {
+    char path[256];
+    int has_old;
+    int has_new;
+    unsigned int old_mode;
+    unsigned int new_mode;
+    ObjectId old_oid;
+    ObjectId new_oid;
+    struct stat st;  // of the file once written
+    int error;       // errno from writing it, 0 on success
+} CheckoutChange;
+
+typedef struct ChangeList {
+    CheckoutChange* items;
+    size_t count;
+    size_t cap;
+    int failed;
+} ChangeList;
+
+typedef struct WriteJob {
+    CheckoutChange* changes;
+    size_t count;
+} WriteJob;
+
+static void collect_change(const char* path, const TreeEntry* old_entry,
+                           const TreeEntry* new_entry, void* ctx) {
+    ChangeList* list = ctx;
+    if (list->failed) return;
+    if (list->count == list->cap) {
+        size_t new_cap = list->cap ? list->cap * 2 : 64;
+        CheckoutChange* grown = realloc(list->items, new_cap * sizeof(CheckoutChange));
+        if (!grown) {
+            list->failed = 1;
+            return;
+        }
+        list->items = grown;
+        list->cap = new_cap;
+    }
+    CheckoutChange* change = &list->items[list->count++];
+    memset(change, 0, sizeof(*change));
+    strcpy(change->path, path);
+    if (old_entry) {
+        change->has_old = 1;
+        change->old_mode = old_entry->mode;
+        change->old_oid = old_entry->oid;
+    }
+    if (new_entry) {
+        change->has_new = 1;
+        change->new_mode = new_entry->mode;
+        change->new_oid = new_entry->oid;
+    }
+}
+
+// Returns 1 if switching this path would lose something not committed: a
+// staged or unstaged change to it, or an untracked file in the way.
+static int has_local_change(const Repository* repo, const CheckoutChange* change) {
+    const FileStatus* entry = find_index_entry((Repository*)repo, change->path);
+    if (!change->has_old) {
+        struct stat st;
+        if (entry && entry->status != 3) return 1;
+        return lstat(change->path, &st) == 0 && !S_ISDIR(st.st_mode);
+    }
+    if (!entry || entry->status == 3) {
+        // Fine if the target deletes it too and nothing took its place
+        struct stat st;
+        return change->has_new || lstat(change->path, &st) == 0;
+    }
+    if (!oid_eq(&entry->oid, &change->old_oid)) return 1;
+    int worktree = check_worktree_entry(repo, entry);
+    return worktree == 1 || (worktree == 3 && change->has_new);
+}
+
+// Remove a file and then any directories it leaves empty.
+static void remove_path(const char* path) {
+    if (unlink(path) != 0 && errno != ENOENT) {
+        fprintf(stderr, "Failed to remove %s: %s\n", path, strerror(errno));
+        return;
+    }
+    char dir[256];
+    strcpy(dir, path);
+    for (char* slash = strrchr(dir, '/'); slash; slash = strrchr(dir, '/')) {
+        *slash = '\0';
+        if (rmdir(dir) != 0) break;
+    }
+}
+
+// Create the directories leading to path. last remembers the deepest one
+// made so far, so sorted paths mostly skip straight to the file.
+static int make_parent_dirs(const char* path, char* last) {
+    const char* slash = strrchr(path, '/');
+    if (!slash) return 0;
+    size_t len = (size_t)(slash - path);
+    if (strlen(last) == len && strncmp(last, path, len) == 0) return 0;
+
+    char dir[256];
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+    for (char* p = strchr(dir, '/');; p = strchr(p + 1, '/')) {
+        if (p) *p = '\0';
+        struct stat st;
+        if (mkdir(dir, 0755) != 0) {
+            if (errno != EEXIST) return -1;
+            // Something other than a directory is in the way
+            if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+                errno = ENOTDIR;
+                return -1;
+            }
+        }
+        if (!p) break;
+        *p = '/';
+    }
+    strcpy(last, dir);
+    return 0;
+}
+
+// A symlink's target is read whole; a file's contents are inflated
+// straight into it, so blobs of any size are written in constant memory.
+static int write_link(CheckoutChange* change) {
+    ObjectType type;
+    char* data;
+    size_t len;
+    if (read_object(&change->new_oid, &type, &data, &len) != 0) return EIO;
+    int err = type != OBJ_BLOB ? EINVAL : 0;
+    if (!err && symlink(data, change->path) != 0) err = errno;
+    free(data);
+    return err;
+}
+
+static int write_change(CheckoutChange* change) {
+    // Replaced rather than truncated, so a symlink is never written through
+    if (unlink(change->path) != 0 && errno != ENOENT) return errno;
+
+    int err = 0;
+    if (S_ISLNK(change->new_mode)) {
+        err = write_link(change);
+    } else {
+        int fd = open(change->path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                      (change->new_mode & 0100) ? 0755 : 0644);
+        if (fd < 0) return errno;
+        errno = 0;
+        if (read_object_to_fd(&change->new_oid, OBJ_BLOB, fd) != 0)
+            err = errno == ENOSPC || errno == EDQUOT ? errno : EIO;
+        if (close(fd) != 0 && !err) err = errno;
+        if (err) unlink(change->path);
+    }
+    if (!err && lstat(change->path, &change->st) != 0) err = errno;
+    return err;
+}
+
+static void write_job(void* arg) {
+    WriteJob* job = arg;
+    for (size_t i = 0; i < job->count; i++) {
+        CheckoutChange* change = &job->changes[i];
+        if (change->has_new && !change->error) change->error = write_change(change);
+    }
+}
+
+// Write every new or changed file, spread over the thread pool.
+static void write_changes(ChangeList* list) {
+    // Directories are made first, in order, so workers never race on them
+    char last_dir[256] = "";
+    for (size_t i = 0; i < list->count; i++) {
+        CheckoutChange* change = &list->items[i];
+        if (change->has_new && make_parent_dirs(change->path, last_dir) != 0)
+            change->error = errno;
+    }
+
+    size_t job_count = (list->count + CHECKOUT_CHUNK - 1) / CHECKOUT_CHUNK;
+    WriteJob* jobs = malloc((job_count ? job_count : 1) * sizeof(WriteJob));
+    ThreadPool* pool = job_count > 1 ? thread_pool_create(thread_pool_default_size()) : NULL;
+    for (size_t k = 0; k < job_count; k++) {
+        size_t start = k * CHECKOUT_CHUNK;
+        WriteJob job = {list->items + start,
+                        list->count - start < CHECKOUT_CHUNK ? list->count - start
+                                                             : CHECKOUT_CHUNK};
+        if (!jobs) {
+            write_job(&job);
+            continue;
+        }
+        jobs[k] = job;
+        if (!pool || thread_pool_submit(pool, write_job, &jobs[k]) != 0) write_job(&jobs[k]);
+    }
+    if (pool) {
+        thread_pool_wait(pool);
+        thread_pool_destroy(pool);
+    }
+    free(jobs);
+}
+
+// Fold the changes into the index in one pass, both being sorted by path:
+// written files get fresh entries, removed ones lose theirs.
+static int update_index(Repository* repo, const ChangeList* list) {
+    FileStatus* merged = malloc((repo->staged_count + list->count + 1) * sizeof(FileStatus));
+    if (!merged) return -1;
+
+    int count = 0, i = 0;
+    size_t j = 0;
+    while (i < repo->staged_count || j < list->count) {
+        const FileStatus* entry = i < repo->staged_count ? &repo->staged_files[i] : NULL;
+        const CheckoutChange* change = j < list->count ? &list->items[j] : NULL;
+        int cmp = !entry ? 1 : !change ? -1 : strcmp(entry->filename, change->path);
+        if (cmp < 0) {
+            merged[count++] = repo->staged_files[i++];
+            continue;
+        }
+        if (cmp == 0) i++;
+        j++;
+        cache_tree_invalidate(repo->cache_tree, change->path);
+        if (!change->has_new) continue;
+
+        const char* name = arena_strdup(&repo->arena, change->path);
+        if (!name) {
+            free(merged);
+            return -1;
+        }
+        FileStatus* out = &merged[count++];
+        memset(out, 0, sizeof(FileStatus));
+        out->filename = name;
+        out->oid = change->new_oid;
+        if (change->error) {
+            fprintf(stderr, "Failed to write %s: %s\n", change->path, strerror(change->error));
+            // Without stat data, status shows the file as changed
+            out->mode = change->new_mode;
+        } else {
+            index_fill_stat_data(out, &change->st);
+        }
+    }
+
+    free(repo->staged_files);
+    repo->staged_files = merged;
+    repo->staged_count = count;
+    repo->index_dirty = 1;
+    return 0;
+}
+
+// Make the working tree and index go from tree from to tree to (either
+// NULL for an empty tree), touching only the paths that differ. Nothing
+// is changed, and -1 returned, if that would lose uncommitted changes.
+int checkout_tree(Repository* repo, const ObjectId* from, const ObjectId* to) {
+    ChangeList list = {NULL, 0, 0, 0};
+    if (diff_trees(from, to, collect_change, &list) != 0 || list.failed) {
+        printf("Could not read the trees to switch between\n");
+        free(list.items);
+        return -1;
+    }
+
+    int conflicts = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        if (!has_local_change(repo, &list.items[i])) continue;
+        if (!conflicts++)
+            printf("Your local changes to the following files would be overwritten:\n");
+        printf("  %s\n", list.items[i].path);
+    }
+    if (conflicts) {
+        printf("Commit or stash them first.\n");
+        free(list.items);
+        return -1;
+    }
+
+    // Removals go first, so a directory can take a file's place and back
+    for (size_t i = 0; i < list.count; i++) {
+        if (!list.items[i].has_new) remove_path(list.items[i].path);
+    }
+    write_changes(&list);
+    int ret = update_index(repo, &list);
+    free(list.items);
+    if (ret != 0) printf("Out of memory updating the index\n");
+    return ret;
+}
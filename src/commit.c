@@ -1,4 +1,10 @@
 #include "commit.h"
+#include "branch.h"
+#include "buffer.h"
+#include "commit_table.h"
+#include "object_store.h"
+#include "trace.h"
+#include "tree.h"
 #include "utils.h"
 
 #include <stdio.h>
@@ -6,179 +12,246 @@
 #include <string.h>
 #include <time.h>
 
+// Append the text form of a commit object to out.
+int serialize_commit(const Commit *commit, Buffer *out) {
+    uint64_t trace_start = trace_begin();
+    char tree[OID_HEX_SIZE + 1], parent[OID_HEX_SIZE + 1] = "";
+    if (commit->parent_count > 0) oid_to_hex(&commit->parents[0], parent);
+    int ret = buffer_putf(out, "tree %s\nparent %s\n", oid_to_hex(&commit->tree, tree),
+                          parent);
+    if (ret == 0 && commit->parent_count > 1)
+        ret = buffer_putf(out, "parent2 %s\n", oid_to_hex(&commit->parents[1], parent));
+    if (ret == 0)
+        ret = buffer_putf(out, "author %s\ntime %ld\nmessage %s\n", commit->author,
+                          (long)commit->timestamp, commit->message);
+    trace_end(TRACE_SERIALIZE, trace_start);
+    return ret;
+}
+
+// Serialize a commit, store it and fill in its ID.
+int write_commit_object(Commit *commit) {
+    Buffer buf = BUFFER_INIT;
+    int ret = -1;
+    if (serialize_commit(commit, &buf) == 0)
+        ret = write_object(OBJ_COMMIT, buf.data, buf.len, &commit->oid);
+    buffer_free(&buf);
+    return ret;
+}
+
+// A zeroed commit with the given author and message, allocated from the
+// repository arena. The author is interned since most commits share one.
+Commit *alloc_commit(Repository *repo, const char *author, size_t author_len,
+                     const char *message, size_t message_len) {
+    Commit *commit = arena_alloc(&repo->arena, sizeof(Commit));
+    if (!commit) return NULL;
+    commit->author = arena_intern(&repo->arena, author, author_len);
+    commit->message = arena_strndup(&repo->arena, message, message_len);
+    if (!commit->author || !commit->message) {
+        free_commit(&repo->arena, commit);
+        return NULL;
+    }
+    return commit;
+}
+
 Commit *create_commit(Repository *repo, const char *message, const char *author) {
     if (!repo || !message || !author) {
         printf("create_commit: Invalid parameters\n");
         return NULL;
     }
 
-    if (repo->staged_count == 0) {
+    int staged = 0;
+    for (int i = 0; i < repo->staged_count; i++) {
+        if (repo->staged_files[i].status != 0) staged++;
+    }
+    if (staged == 0) {
         printf("create_commit: No staged files to commit\n");
         return NULL;
     }
 
-    Commit *commit = malloc(sizeof(Commit));
+    Commit *commit = alloc_commit(repo, author, strlen(author), message,
+                                  strlen(message));
     if (!commit) {
-        printf("create_commit: malloc failed\n");
+        printf("create_commit: Out of memory\n");
         return NULL;
     }
 
-    // Metadata
-    strncpy(commit->author, author, sizeof(commit->author) - 1);
-    commit->author[sizeof(commit->author) - 1] = '\0';
-
-    strncpy(commit->message, message, sizeof(commit->message) - 1);
-    commit->message[sizeof(commit->message) - 1] = '\0';
-
     commit->timestamp = time(NULL);
-    commit->parent = NULL;
-    commit->next = NULL;
-    commit->parent_hash[0] = '\0';
-    commit->second_parent[0] = '\0';
-
-    if (repo->current_branch && repo->current_branch->head) {
-        commit->parent = repo->current_branch->head;
-        strncpy(commit->parent_hash, commit->parent->hash, sizeof(commit->parent_hash) - 1);
-        commit->parent_hash[sizeof(commit->parent_hash) - 1] = '\0';
+    if (repo->current_branch && !oid_is_null(&repo->current_branch->oid)) {
+        commit->parents[0] = repo->current_branch->oid;
+        commit->parent_count = 1;
     }
 
-    printf("DEBUG: Creating commit on branch '%s'\n", repo->current_branch ? repo->current_branch->name : "NULL");
-    printf("DEBUG: Parent commit hash: %s\n", commit->parent_hash[0] ? commit->parent_hash : "None");
-
-    char files_buf[2048] = "";
-    for (int i = 0; i < repo->staged_count; i++) {
-        strcat(files_buf, "file ");
-        strcat(files_buf, repo->staged_files[i].filename);
-        strcat(files_buf, " ");
-        strcat(files_buf, repo->staged_files[i].hash);
-        strcat(files_buf, "\n");
-    }
-
-    char commit_content[4096];
-    snprintf(commit_content, sizeof(commit_content),
-         "parent %s\nauthor %s\ntime %ld\nmessage %s\nfiles\n%s",
-         commit->parent_hash, commit->author, commit->timestamp,
-         commit->message, files_buf);
-
-    calculate_hash(commit_content, strlen(commit_content), commit->hash);
-
-    char commit_path[256];
-    snprintf(commit_path, sizeof(commit_path), ".babygit/objects/%s", commit->hash);
-    FILE *commit_file = fopen(commit_path, "w");
-    if (!commit_file) {
-        printf("create_commit: Failed to open commit file %s for writing\n", commit_path);
-        free(commit);
+    // Only directories changed since the last commit get new trees
+    if (cache_tree_update(repo, &commit->tree) != 0) {
+        printf("create_commit: Failed to write tree objects\n");
+        free_commit(&repo->arena, commit);
         return NULL;
     }
 
-    int written = fprintf(commit_file, "%s", commit_content);
-    fclose(commit_file);
+    if (write_commit_object(commit) != 0) {
+        printf("create_commit: Failed to write commit object\n");
+        free_commit(&repo->arena, commit);
+        return NULL;
+    }
 
-    if (written < 0) {
-        printf("create_commit: Failed to write commit content\n");
-        free(commit);
+    // Add to repo commit table (which now owns it)
+    Commit *stored = commit_table_put(&repo->commits, commit);
+    if (!stored) {
+        printf("create_commit: Out of memory\n");
+        free_commit(&repo->arena, commit);
         return NULL;
     }
+    commit = stored;
 
     // Update current branch HEAD
     if (repo->current_branch) {
-        printf("DEBUG: Updating HEAD of branch '%s' to new commit %s\n", repo->current_branch->name, commit->hash);
-        repo->current_branch->head = commit;
-    }
-
-    // Update branch list HEAD as well
-    Branch *cur_branch = repo->branches;
-    while (cur_branch) {
-        if (strcmp(cur_branch->name, repo->current_branch->name) == 0) {
-            cur_branch->head = commit;
-            break;
-        }
-        cur_branch = cur_branch->next;
+        assign_branch_head(repo, repo->current_branch, commit);
     }
 
-    // Add to repo commit list
-    commit->next = repo->commits;
-    repo->commits = commit;
-
-    // Clear staging
-    repo->staged_count = 0;
-    if (repo->staged_files) {
-        free(repo->staged_files);
-        repo->staged_files = NULL;
+    // The index now matches the commit: drop deletions, keep the rest
+    // (with their stat data) as unmodified
+    int kept = 0;
+    for (int i = 0; i < repo->staged_count; i++) {
+        if (repo->staged_files[i].status == 3) continue;
+        repo->staged_files[kept] = repo->staged_files[i];
+        repo->staged_files[kept].status = 0;
+        kept++;
     }
-    remove(".babygit/index");
+    repo->staged_count = kept;
+    repo->index_dirty = 1;
 
     return commit;
 }
 
-Commit *find_commit(Repository *repo, const char *hash) {
-  if (!repo || !hash)
+// Look up a commit that has already been loaded or created.
+Commit *find_commit(Repository *repo, const ObjectId *oid) {
+  if (!repo || !oid)
     return NULL;
-
-  Commit *current = repo->commits;
-  while (current) {
-    if (strcmp(current->hash, hash) == 0) {
-      return current;
-    }
-    current = current->next;
-  }
-  return NULL;
+  return commit_table_get(&repo->commits, oid);
 }
 
-Commit* load_commit(const char* hash) {
-    if (!hash) return NULL;
-
-    char path[256];
-    snprintf(path, sizeof(path), ".babygit/objects/%s", hash);
-    FILE* file = fopen(path, "r");
-    if (!file) return NULL;
+// Parse a commit object into a commit allocated from the repository arena.
+Commit* load_commit(Repository* repo, const ObjectId* oid) {
+    if (!repo || !oid) return NULL;
 
-    Commit* commit = malloc(sizeof(Commit));
-    if (!commit) {
-        fclose(file);
+    char* content;
+    ObjectType type;
+    if (read_object(oid, &type, &content, NULL) != 0) return NULL;
+    if (type != OBJ_COMMIT) {
+        free(content);
         return NULL;
     }
 
-    char line[1024];
-    commit->parent_hash[0] = '\0';
-    commit->author[0] = '\0';
-    commit->message[0] = '\0';
-    commit->timestamp = 0;
-    commit->parent = NULL;
-    commit->next = NULL;
+    const char* author = "";
+    const char* message = "";
+    size_t author_len = 0, message_len = 0;
+    ObjectId tree = {{0}}, parents[2];
+    int parent_count = 0;
+    long timestamp = 0;
 
-    strncpy(commit->hash, hash, sizeof(commit->hash));
-    commit->hash[sizeof(commit->hash) - 1] = '\0';
+    char* line = content;
+    while (line && *line) {
+        char* end = strchr(line, '\n');
+        if (end) *end = '\0';
+        size_t len = strlen(line);
 
-    while (fgets(line, sizeof(line), file)) {
-        if (strncmp(line, "parent ", 7) == 0) {
-            sscanf(line + 7, "%40s", commit->parent_hash);
+        if (strncmp(line, "tree ", 5) == 0) {
+            oid_from_hex(&tree, line + 5);
+        } else if (strncmp(line, "parent ", 7) == 0) {
+            // Root commits have an empty first parent
+            if (oid_from_hex(&parents[0], line + 7) == 0) parent_count = 1;
+        } else if (strncmp(line, "parent2 ", 8) == 0) {
+            if (parent_count == 1 && oid_from_hex(&parents[1], line + 8) == 0)
+                parent_count = 2;
         } else if (strncmp(line, "author ", 7) == 0) {
-            sscanf(line + 7, "%255[^\n]", commit->author);
+            author = line + 7;
+            author_len = len - 7;
         } else if (strncmp(line, "time ", 5) == 0) {
-            sscanf(line + 5, "%ld", &commit->timestamp);
+            timestamp = strtol(line + 5, NULL, 10);
         } else if (strncmp(line, "message ", 8) == 0) {
-            sscanf(line + 8, "%1023[^\n]", commit->message);
+            message = line + 8;
+            message_len = len - 8;
+        } else if (strcmp(line, "files") == 0) {
+            break; // file list of commits made before trees
         }
-        // ignoring files for now
+        line = end ? end + 1 : NULL;
     }
 
-    fclose(file);
+    Commit* commit = alloc_commit(repo, author, author_len, message, message_len);
+    if (commit) {
+        commit->oid = *oid;
+        commit->tree = tree;
+        memcpy(commit->parents, parents, parent_count * sizeof(ObjectId));
+        commit->parent_count = parent_count;
+        commit->timestamp = timestamp;
+    }
+    free(content);
     return commit;
 }
 
-void free_commit(Commit *commit) {
-    free(commit);
+void free_commit(Arena* arena, Commit* commit) {
+    if (!commit) return;
+    arena_free_string(arena, commit->message);
+    arena_free(arena, commit, sizeof(Commit));
 }
 
-Commit* find_commit_by_hash(Repository* repo, const char* hash){
-    if (!hash) return NULL;
-    Commit* current = repo->commits; // Adjust this to your actual commit list
-    while (current) {
-        if (strcmp(current->hash, hash) == 0) {
-            return current;
+// Look up a commit, loading it from the object store on first use.
+Commit* lookup_commit(Repository* repo, const ObjectId* oid) {
+    if (!repo || !oid) return NULL;
+
+    Commit* commit = find_commit(repo, oid);
+    if (commit) {
+        trace_count(TRACE_COMMIT_CACHE_HITS, 1);
+        return commit;
+    }
+
+    trace_count(TRACE_COMMIT_CACHE_MISSES, 1);
+    commit = load_commit(repo, oid);
+    if (!commit) return NULL;
+    Commit* stored = commit_table_put(&repo->commits, commit);
+    if (!stored) free_commit(&repo->arena, commit);
+    return stored;
+}
+
+// The same for a hex ID, as found in ref files.
+Commit* find_commit_by_hash(Repository* repo, const char* hash) {
+    ObjectId oid;
+    if (!hash || oid_from_hex(&oid, hash) != 0) return NULL;
+    return lookup_commit(repo, &oid);
+}
+
+// Resolve a commit's first (which == 0) or second parent, loading it
+// through the commit cache if needed. The result stays valid until more
+// commits are loaded unless the caller pins it.
+Commit* commit_parent(Repository* repo, const Commit* commit, int which) {
+    if (!repo || !commit || which >= commit->parent_count) return NULL;
+    return lookup_commit(repo, &commit->parents[which]);
+}
+
+// Print the first-parent history of the current branch, newest first.
+void print_log(Repository* repo) {
+    if (!repo || !repo->current_branch) return;
+
+    Commit* commit = branch_head(repo, repo->current_branch);
+    while (commit) {
+        char date[64];
+        struct tm* tm = localtime(&commit->timestamp);
+        strftime(date, sizeof(date), "%a %b %d %H:%M:%S %Y", tm);
+
+        char hex[OID_HEX_SIZE + 1], hex2[OID_HEX_SIZE + 1];
+        printf("commit %s\n", oid_to_hex(&commit->oid, hex));
+        if (commit->parent_count > 1) {
+            printf("Merge: %.7s %.7s\n", oid_to_hex(&commit->parents[0], hex),
+                   oid_to_hex(&commit->parents[1], hex2));
         }
-        current = current->next;  // or however commits are linked/stored
+        printf("Author: %s\nDate:   %s\n\n    %s\n\n", commit->author, date,
+               commit->message);
+
+        Commit* parent = commit_parent(repo, commit, 0);
+        if (commit->parent_count && !parent) {
+            printf("error: could not read commit %s\n",
+                   oid_to_hex(&commit->parents[0], hex));
+        }
+        commit = parent;
     }
-    return NULL;
 }
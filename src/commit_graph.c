@@ -0,0 +1,644 @@
+#include "commit_graph.h"
+#include "commit.h"
+#include "commit_table.h"
+#include "lockfile.h"
+#include "utils.h"
+
+#include <endian.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GRAPH_HEADER_SIZE 12
+#define GRAPH_DATA_SIZE 20  // parent 1, parent 2, generation, commit time
+
+// Walk flags
+#define WALK_SEEN 0x01
+#define WALK_PARENT1 0x02
+#define WALK_PARENT2 0x04
+#define WALK_STALE 0x08
+
+typedef struct CommitGraph {
+    unsigned char* map;
+    size_t size;
+    uint32_t count;
+    const unsigned char* fanout;
+    const unsigned char* oids;
+    const unsigned char* parent1;
+    const unsigned char* parent2;
+    const unsigned char* generation;
+    const unsigned char* time;
+} CommitGraph;
+
+static CommitGraph graph;
+static pthread_once_t graph_once = PTHREAD_ONCE_INIT;
+
+// A history walk. A commit in the graph is known by its position there
+// and read straight from the graph's columns; commits made since it was
+// written are numbered after those and kept in the extra_ arrays. The
+// only per-walk state is a flag byte per commit, so walks run over a few
+// dense arrays rather than a struct per commit.
+typedef struct Walk {
+    Repository* repo;
+    uint32_t graph_count;  // ids below this are graph positions
+    unsigned char* flags;
+    ObjectId* extra_oids;
+    ObjectId* extra_parents;  // two per commit
+    unsigned char* extra_parent_count;
+    int64_t* extra_time;
+    size_t extra_count;
+    size_t extra_cap;
+    uint32_t* slots;  // extra index + 1, 0 when empty
+    size_t slot_cap;
+    uint32_t* queue;  // binary heap of commit ids
+    size_t queue_len;
+    size_t queue_cap;
+} Walk;
+
+static void put_be32(unsigned char* p, uint32_t v) {
+    v = htobe32(v);
+    memcpy(p, &v, 4);
+}
+
+static void put_be64(unsigned char* p, uint64_t v) {
+    v = htobe64(v);
+    memcpy(p, &v, 8);
+}
+
+static uint32_t get_be32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return be32toh(v);
+}
+
+static uint64_t get_be64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return be64toh(v);
+}
+
+static void load_graph(void) {
+    int fd = open(COMMIT_GRAPH_FILE, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    void* map = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) map = NULL;
+    }
+    close(fd);
+    if (!map) return;
+
+    const unsigned char* p = map;
+    size_t min_size = GRAPH_HEADER_SIZE + 256 * 4 + hash_algo->rawsz;
+    uint32_t count = (size_t)st.st_size >= min_size ? get_be32(p + 8) : 0;
+    if ((size_t)st.st_size < min_size ||
+        get_be32(p) != COMMIT_GRAPH_SIGNATURE ||
+        get_be32(p + 4) != COMMIT_GRAPH_VERSION ||
+        (size_t)st.st_size != min_size + (size_t)count * (hash_algo->rawsz + GRAPH_DATA_SIZE) ||
+        get_be32(p + GRAPH_HEADER_SIZE + 255 * 4) != count) {
+        fprintf(stderr, "Ignoring unusable commit graph\n");
+        munmap(map, st.st_size);
+        return;
+    }
+
+    graph.map = map;
+    graph.size = st.st_size;
+    graph.count = count;
+    graph.fanout = p + GRAPH_HEADER_SIZE;
+    graph.oids = graph.fanout + 256 * 4;
+    graph.parent1 = graph.oids + (size_t)count * hash_algo->rawsz;
+    graph.parent2 = graph.parent1 + (size_t)count * 4;
+    graph.generation = graph.parent2 + (size_t)count * 4;
+    graph.time = graph.generation + (size_t)count * 4;
+}
+
+static void prepare_graph(void) {
+    pthread_once(&graph_once, load_graph);
+}
+
+// Position of a commit in the graph, or -1 if it is not there.
+static int64_t graph_find(const ObjectId* oid) {
+    prepare_graph();
+    if (!graph.map) return -1;
+
+    const unsigned char* h = oid->hash;
+    uint32_t lo = h[0] ? get_be32(graph.fanout + (h[0] - 1) * 4) : 0;
+    uint32_t hi = get_be32(graph.fanout + h[0] * 4);
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(graph.oids + (size_t)mid * hash_algo->rawsz, h, hash_algo->rawsz);
+        if (cmp == 0) return mid;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+static int walk_init(Walk* w, Repository* repo) {
+    memset(w, 0, sizeof(Walk));
+    prepare_graph();
+    w->repo = repo;
+    w->graph_count = graph.map ? graph.count : 0;
+    w->flags = calloc(w->graph_count ? w->graph_count : 1, 1);
+    return w->flags ? 0 : -1;
+}
+
+static void walk_free(Walk* w) {
+    free(w->flags);
+    free(w->extra_oids);
+    free(w->extra_parents);
+    free(w->extra_parent_count);
+    free(w->extra_time);
+    free(w->slots);
+    free(w->queue);
+}
+
+// Raw ID of a node, hash_algo->rawsz bytes long.
+static const unsigned char* walk_hash(const Walk* w, uint32_t id) {
+    if (id < w->graph_count) return graph.oids + (size_t)id * hash_algo->rawsz;
+    return w->extra_oids[id - w->graph_count].hash;
+}
+
+static uint32_t walk_generation(const Walk* w, uint32_t id) {
+    if (id < w->graph_count) return get_be32(graph.generation + (size_t)id * 4);
+    return GENERATION_INFINITY;
+}
+
+static int64_t walk_time(const Walk* w, uint32_t id) {
+    if (id < w->graph_count) return (int64_t)get_be64(graph.time + (size_t)id * 8);
+    return w->extra_time[id - w->graph_count];
+}
+
+static size_t walk_slot(const Walk* w, const ObjectId* oid) {
+    uint64_t h;
+    memcpy(&h, oid->hash, sizeof(h));
+    return (size_t)h & (w->slot_cap - 1);
+}
+
+static int walk_grow_slots(Walk* w) {
+    size_t cap = w->slot_cap ? w->slot_cap * 2 : 256;
+    uint32_t* slots = calloc(cap, sizeof(uint32_t));
+    if (!slots) return -1;
+    free(w->slots);
+    w->slots = slots;
+    w->slot_cap = cap;
+    for (size_t i = 0; i < w->extra_count; i++) {
+        size_t s = walk_slot(w, &w->extra_oids[i]);
+        while (w->slots[s]) s = (s + 1) & (cap - 1);
+        w->slots[s] = (uint32_t)i + 1;
+    }
+    return 0;
+}
+
+static int walk_grow_extra(Walk* w) {
+    size_t cap = w->extra_cap ? w->extra_cap * 2 : 64;
+    unsigned char* flags = realloc(w->flags, w->graph_count + cap);
+    if (!flags) return -1;
+    memset(flags + w->graph_count + w->extra_cap, 0, cap - w->extra_cap);
+    w->flags = flags;
+
+    ObjectId* oids = realloc(w->extra_oids, cap * sizeof(ObjectId));
+    if (!oids) return -1;
+    w->extra_oids = oids;
+    ObjectId* parents = realloc(w->extra_parents, 2 * cap * sizeof(ObjectId));
+    if (!parents) return -1;
+    w->extra_parents = parents;
+    unsigned char* parent_count = realloc(w->extra_parent_count, cap);
+    if (!parent_count) return -1;
+    w->extra_parent_count = parent_count;
+    int64_t* times = realloc(w->extra_time, cap * sizeof(int64_t));
+    if (!times) return -1;
+    w->extra_time = times;
+
+    w->extra_cap = cap;
+    return 0;
+}
+
+// Id of a commit, reading it on first use if it is not in the graph; -1
+// if the commit cannot be read.
+static int64_t walk_node(Walk* w, const ObjectId* oid) {
+    int64_t pos = graph_find(oid);
+    if (pos >= 0) return pos;
+
+    if (w->slot_cap) {
+        for (size_t s = walk_slot(w, oid); w->slots[s]; s = (s + 1) & (w->slot_cap - 1)) {
+            uint32_t i = w->slots[s] - 1;
+            if (oid_eq(&w->extra_oids[i], oid)) return (int64_t)w->graph_count + i;
+        }
+    }
+
+    if ((w->extra_count + 1) * 2 > w->slot_cap && walk_grow_slots(w) != 0) return -1;
+    if (w->extra_count == w->extra_cap && walk_grow_extra(w) != 0) return -1;
+
+    Commit* commit = lookup_commit(w->repo, oid);
+    if (!commit) return -1;
+    size_t i = w->extra_count;
+    w->extra_oids[i] = *oid;
+    memcpy(&w->extra_parents[2 * i], commit->parents, sizeof(commit->parents));
+    w->extra_parent_count[i] = (unsigned char)commit->parent_count;
+    w->extra_time[i] = commit->timestamp;
+
+    size_t s = walk_slot(w, oid);
+    while (w->slots[s]) s = (s + 1) & (w->slot_cap - 1);
+    w->slots[s] = (uint32_t)i + 1;
+    w->extra_count++;
+    return (int64_t)w->graph_count + i;
+}
+
+// Store the ids of a commit's parents in out and return how many there
+// are, or -1 if one cannot be read.
+static int walk_parents(Walk* w, uint32_t id, uint32_t out[2]) {
+    if (id < w->graph_count) {
+        int n = 0;
+        uint32_t parents[2] = { get_be32(graph.parent1 + (size_t)id * 4),
+                                get_be32(graph.parent2 + (size_t)id * 4) };
+        for (int i = 0; i < 2; i++) {
+            if (parents[i] == GRAPH_NO_PARENT) continue;
+            if (parents[i] >= w->graph_count) return -1;
+            out[n++] = parents[i];
+        }
+        return n;
+    }
+
+    size_t e = id - w->graph_count;
+    int n = w->extra_parent_count[e];
+    for (int i = 0; i < n; i++) {
+        ObjectId parent_oid = w->extra_parents[2 * e + i];  // may move
+        int64_t parent = walk_node(w, &parent_oid);
+        if (parent < 0) return -1;
+        out[i] = (uint32_t)parent;
+    }
+    return n;
+}
+
+// Queue order: highest generation first, then newest commit time.
+static int walk_before(const Walk* w, uint32_t a, uint32_t b) {
+    uint32_t ga = walk_generation(w, a), gb = walk_generation(w, b);
+    if (ga != gb) return ga > gb;
+    return walk_time(w, a) > walk_time(w, b);
+}
+
+static int walk_push(Walk* w, uint32_t node) {
+    if (w->queue_len == w->queue_cap) {
+        size_t cap = w->queue_cap ? w->queue_cap * 2 : 64;
+        uint32_t* queue = realloc(w->queue, cap * sizeof(uint32_t));
+        if (!queue) return -1;
+        w->queue = queue;
+        w->queue_cap = cap;
+    }
+    size_t i = w->queue_len++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!walk_before(w, node, w->queue[parent])) break;
+        w->queue[i] = w->queue[parent];
+        i = parent;
+    }
+    w->queue[i] = node;
+    return 0;
+}
+
+static uint32_t walk_pop(Walk* w) {
+    uint32_t top = w->queue[0];
+    uint32_t last = w->queue[--w->queue_len];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= w->queue_len) break;
+        if (child + 1 < w->queue_len && walk_before(w, w->queue[child + 1], w->queue[child]))
+            child++;
+        if (!walk_before(w, w->queue[child], last)) break;
+        w->queue[i] = w->queue[child];
+        i = child;
+    }
+    if (w->queue_len) w->queue[i] = last;
+    return top;
+}
+
+// 1 if ancestor is reachable from descendant (a commit is its own
+// ancestor), 0 if not, -1 if history could not be read. The walk visits
+// commits in generation order and stops once it passes the ancestor's
+// generation.
+int is_ancestor(Repository* repo, const Commit* ancestor, const Commit* descendant) {
+    if (!repo || !ancestor || !descendant) return -1;
+    if (oid_eq(&ancestor->oid, &descendant->oid)) return 1;
+
+    Walk w;
+    int result = -1;
+    if (walk_init(&w, repo) != 0) goto done;
+    int64_t target = walk_node(&w, &ancestor->oid);
+    int64_t start = walk_node(&w, &descendant->oid);
+    if (target < 0 || start < 0) goto done;
+
+    uint32_t min_generation = walk_generation(&w, (uint32_t)target);
+    w.flags[start] |= WALK_SEEN;
+    if (walk_push(&w, (uint32_t)start) != 0) goto done;
+
+    result = 0;
+    while (w.queue_len) {
+        uint32_t cur = walk_pop(&w);
+        if (cur == (uint32_t)target) {
+            result = 1;
+            break;
+        }
+        // Parents of a commit no newer than the target are older still
+        if (min_generation != GENERATION_INFINITY) {
+            uint32_t generation = walk_generation(&w, cur);
+            if (generation < min_generation) break;
+            if (generation == min_generation) continue;
+        }
+
+        uint32_t parents[2];
+        int n = walk_parents(&w, cur, parents);
+        if (n < 0) {
+            result = -1;
+            goto done;
+        }
+        for (int i = 0; i < n; i++) {
+            if (w.flags[parents[i]] & WALK_SEEN) continue;
+            w.flags[parents[i]] |= WALK_SEEN;
+            if (walk_push(&w, parents[i]) != 0) {
+                result = -1;
+                goto done;
+            }
+        }
+    }
+
+done:
+    walk_free(&w);
+    return result;
+}
+
+static int walk_has_active(const Walk* w) {
+    for (size_t i = 0; i < w->queue_len; i++) {
+        if (!(w->flags[w->queue[i]] & WALK_STALE)) return 1;
+    }
+    return 0;
+}
+
+static Commit* walk_commit(Walk* w, uint32_t id) {
+    ObjectId oid = {{0}};
+    memcpy(oid.hash, walk_hash(w, id), hash_algo->rawsz);
+    return lookup_commit(w->repo, &oid);
+}
+
+// Best common ancestor of a and b, or NULL if they share no history.
+// Both sides are painted down through their parents in generation order.
+// When the graph covers the first commit reached from both sides, nothing
+// above it is left to visit, so it is the answer. Otherwise the walk runs
+// on, marking everything below each common commit stale, and the common
+// commit that is not an ancestor of another one wins.
+Commit* merge_base(Repository* repo, const Commit* a, const Commit* b) {
+    if (!repo || !a || !b) return NULL;
+
+    Walk w;
+    Commit* base = NULL;
+    uint32_t* found = NULL;
+    size_t found_count = 0;
+    if (walk_init(&w, repo) != 0) goto done;
+    int64_t left = walk_node(&w, &a->oid);
+    int64_t right = walk_node(&w, &b->oid);
+    if (left < 0 || right < 0) goto done;
+    if (left == right) {
+        base = walk_commit(&w, (uint32_t)left);
+        goto done;
+    }
+
+    w.flags[left] |= WALK_PARENT1;
+    w.flags[right] |= WALK_PARENT2;
+    if (walk_push(&w, (uint32_t)left) != 0 || walk_push(&w, (uint32_t)right) != 0)
+        goto done;
+
+    while (walk_has_active(&w)) {
+        uint32_t cur = walk_pop(&w);
+        unsigned flags = w.flags[cur] & (WALK_PARENT1 | WALK_PARENT2 | WALK_STALE);
+        if (flags == (WALK_PARENT1 | WALK_PARENT2)) {
+            if (!found_count && walk_generation(&w, cur) != GENERATION_INFINITY) {
+                base = walk_commit(&w, cur);
+                goto done;
+            }
+            uint32_t* grown = realloc(found, (found_count + 1) * sizeof(uint32_t));
+            if (!grown) goto done;
+            found = grown;
+            found[found_count++] = cur;
+            flags |= WALK_STALE;
+            w.flags[cur] |= WALK_STALE;
+        }
+
+        uint32_t parents[2];
+        int n = walk_parents(&w, cur, parents);
+        if (n < 0) goto done;
+        for (int i = 0; i < n; i++) {
+            if ((w.flags[parents[i]] & flags) == flags) continue;
+            w.flags[parents[i]] |= flags;
+            if (walk_push(&w, parents[i]) != 0) goto done;
+        }
+    }
+
+    for (size_t i = 0; i < found_count && !base; i++) {
+        Commit* candidate = walk_commit(&w, found[i]);
+        if (!candidate) break;
+        commit_pin(&repo->commits, candidate);
+        int redundant = 0;
+        for (size_t j = 0; j < found_count && !redundant; j++) {
+            if (j == i) continue;
+            Commit* other = walk_commit(&w, found[j]);
+            redundant = other && is_ancestor(repo, candidate, other) == 1;
+        }
+        commit_unpin(&repo->commits, candidate);
+        if (!redundant) base = candidate;
+    }
+
+done:
+    free(found);
+    walk_free(&w);
+    return base;
+}
+
+static const Walk* sort_walk;
+
+static int compare_walk_oid(const void* a, const void* b) {
+    return memcmp(walk_hash(sort_walk, *(const uint32_t*)a),
+                  walk_hash(sort_walk, *(const uint32_t*)b), hash_algo->rawsz);
+}
+
+static int stack_push(uint32_t** stack, size_t* depth, size_t* cap, uint32_t id) {
+    if (*depth == *cap) {
+        size_t grown_cap = *cap ? *cap * 2 : 64;
+        uint32_t* grown = realloc(*stack, grown_cap * sizeof(uint32_t));
+        if (!grown) return -1;
+        *stack = grown;
+        *cap = grown_cap;
+    }
+    (*stack)[(*depth)++] = id;
+    return 0;
+}
+
+// Generation numbers for every commit in the walk. Those already in the
+// graph keep theirs; newer ones are numbered parents first.
+static int compute_generations(Walk* w, uint32_t* generation) {
+    uint32_t* stack = NULL;
+    size_t depth = 0, stack_cap = 0;
+    int result = -1;
+    for (uint32_t i = 0; i < w->graph_count; i++)
+        generation[i] = walk_generation(w, i);
+    memset(generation + w->graph_count, 0, w->extra_count * sizeof(uint32_t));
+
+    for (size_t i = 0; i < w->extra_count; i++) {
+        uint32_t id = w->graph_count + (uint32_t)i;
+        if (generation[id]) continue;
+        if (stack_push(&stack, &depth, &stack_cap, id) != 0) goto done;
+        while (depth) {
+            uint32_t cur = stack[depth - 1];
+            if (generation[cur]) {  // reached again through another child
+                depth--;
+                continue;
+            }
+            uint32_t parents[2], max_parent = 0;
+            int n = walk_parents(w, cur, parents);
+            if (n < 0) goto done;
+            int pending = 0;
+            for (int p = 0; p < n; p++) {
+                if (!generation[parents[p]]) {
+                    if (stack_push(&stack, &depth, &stack_cap, parents[p]) != 0) goto done;
+                    pending = 1;
+                } else if (generation[parents[p]] > max_parent) {
+                    max_parent = generation[parents[p]];
+                }
+            }
+            if (pending) continue;
+            generation[cur] = max_parent + 1;
+            depth--;
+        }
+    }
+    result = 0;
+
+done:
+    free(stack);
+    return result;
+}
+
+// Write the commits flagged WALK_SEEN, each column of the graph in turn.
+static int write_graph_file(const char* path, Walk* w) {
+    size_t total = w->graph_count + w->extra_count;
+    uint32_t count = 0;
+    uint32_t* order = malloc(total * sizeof(uint32_t));
+    uint32_t* position = malloc(total * sizeof(uint32_t));
+    uint32_t* generation = malloc(total * sizeof(uint32_t));
+    unsigned char* buf = NULL;
+    int ok = 0;
+    if (!order || !position || !generation) goto done;
+    if (compute_generations(w, generation) != 0) goto done;
+
+    for (uint32_t i = 0; i < total; i++) {
+        if (w->flags[i] & WALK_SEEN) order[count++] = i;
+    }
+    sort_walk = w;
+    qsort(order, count, sizeof(uint32_t), compare_walk_oid);
+    for (uint32_t i = 0; i < count; i++) position[order[i]] = i;
+
+    size_t size = GRAPH_HEADER_SIZE + 256 * 4 +
+                  (size_t)count * (hash_algo->rawsz + GRAPH_DATA_SIZE) + hash_algo->rawsz;
+    buf = calloc(1, size);
+    if (!buf) goto done;
+    put_be32(buf, COMMIT_GRAPH_SIGNATURE);
+    put_be32(buf + 4, COMMIT_GRAPH_VERSION);
+    put_be32(buf + 8, count);
+    unsigned char* fanout = buf + GRAPH_HEADER_SIZE;
+    unsigned char* oids = fanout + 256 * 4;
+    unsigned char* parent1 = oids + (size_t)count * hash_algo->rawsz;
+    unsigned char* parent2 = parent1 + (size_t)count * 4;
+    unsigned char* generations = parent2 + (size_t)count * 4;
+    unsigned char* times = generations + (size_t)count * 4;
+
+    uint32_t k = 0;
+    for (int b = 0; b < 256; b++) {
+        while (k < count && walk_hash(w, order[k])[0] == b) k++;
+        put_be32(fanout + b * 4, k);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t id = order[i];
+        uint32_t parents[2];
+        int n = walk_parents(w, id, parents);
+        if (n < 0) goto done;
+        memcpy(oids + (size_t)i * hash_algo->rawsz, walk_hash(w, id), hash_algo->rawsz);
+        put_be32(parent1 + (size_t)i * 4, n > 0 ? position[parents[0]] : GRAPH_NO_PARENT);
+        put_be32(parent2 + (size_t)i * 4, n > 1 ? position[parents[1]] : GRAPH_NO_PARENT);
+        put_be32(generations + (size_t)i * 4, generation[id]);
+        put_be64(times + (size_t)i * 8, (uint64_t)walk_time(w, id));
+    }
+
+    ObjectId sum;
+    calculate_hash(buf, size - hash_algo->rawsz, &sum);
+    memcpy(buf + size - hash_algo->rawsz, sum.hash, hash_algo->rawsz);
+
+    FILE* f = fopen(path, "wb");
+    ok = f && fwrite(buf, 1, size, f) == size;
+    if (ok && (fflush(f) != 0 || fsync_written(fileno(f)) != 0)) ok = 0;
+    if (f && fclose(f) != 0) ok = 0;
+
+done:
+    free(order);
+    free(position);
+    free(generation);
+    free(buf);
+    return ok ? 0 : -1;
+}
+
+// Rewrite the commit graph to cover every commit reachable from a branch.
+// Commits already in the old graph are copied without being parsed.
+// Returns the number of commits written, or -1 on failure.
+int commit_graph_write(Repository* repo) {
+    if (!repo) return -1;
+
+    Walk w;
+    int result = -1;
+    uint32_t* stack = NULL;
+    size_t depth = 0, stack_cap = 0, seen = 0;
+    if (walk_init(&w, repo) != 0) goto done;
+
+    for (Branch* branch = repo->branches; branch; branch = branch->next) {
+        if (oid_is_null(&branch->oid)) continue;
+        int64_t node = walk_node(&w, &branch->oid);
+        if (node < 0) goto done;
+        if (w.flags[node] & WALK_SEEN) continue;
+        w.flags[node] |= WALK_SEEN;
+        seen++;
+        if (stack_push(&stack, &depth, &stack_cap, (uint32_t)node) != 0) goto done;
+
+        while (depth) {
+            uint32_t cur = stack[--depth];
+            uint32_t parents[2];
+            int n = walk_parents(&w, cur, parents);
+            if (n < 0) goto done;
+            for (int i = 0; i < n; i++) {
+                if (w.flags[parents[i]] & WALK_SEEN) continue;
+                w.flags[parents[i]] |= WALK_SEEN;
+                seen++;
+                if (stack_push(&stack, &depth, &stack_cap, parents[i]) != 0) goto done;
+            }
+        }
+    }
+
+    ensure_directory_exists(OBJECTS_DIR "/info");
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", COMMIT_GRAPH_FILE);
+    if (write_graph_file(tmp_path, &w) != 0 || fsync_barrier() != 0 ||
+        rename(tmp_path, COMMIT_GRAPH_FILE) != 0) {
+        unlink(tmp_path);
+        goto done;
+    }
+    fsync_renamed(COMMIT_GRAPH_FILE);
+    result = (int)seen;
+
+done:
+    free(stack);
+    walk_free(&w);
+    return result;
+}
@@ -0,0 +1,180 @@
+#include "commit_table.h"
+#include "commit.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMMIT_TABLE_MIN_CAPACITY 64
+
+// Cache size: BABYGIT_COMMIT_CACHE if set, else the built-in default.
+size_t commit_cache_default_size(void) {
+  const char *env = getenv("BABYGIT_COMMIT_CACHE");
+  long n = env ? strtol(env, NULL, 10) : COMMIT_CACHE_DEFAULT_SIZE;
+  return n < COMMIT_CACHE_MIN_SIZE ? COMMIT_CACHE_MIN_SIZE : (size_t)n;
+}
+
+// OIDs are already uniformly distributed, so their leading bytes make a
+// good hash on their own.
+static size_t oid_slot(const ObjectId *oid, size_t capacity) {
+  uint64_t h;
+  memcpy(&h, oid->hash, sizeof(h));
+  return (size_t)h & (capacity - 1);
+}
+
+void commit_table_init(CommitTable *table, size_t max_cached, Arena *arena) {
+  memset(table, 0, sizeof(CommitTable));
+  table->arena = arena;
+  table->max_cached =
+      max_cached < COMMIT_CACHE_MIN_SIZE ? COMMIT_CACHE_MIN_SIZE : max_cached;
+}
+
+// The commits themselves go away with the arena.
+void commit_table_free(CommitTable *table) {
+  free(table->slots);
+  commit_table_init(table, table->max_cached, table->arena);
+}
+
+static void lru_unlink(CommitTable *table, Commit *commit) {
+  if (commit->lru_prev)
+    commit->lru_prev->lru_next = commit->lru_next;
+  else
+    table->lru_head = commit->lru_next;
+  if (commit->lru_next)
+    commit->lru_next->lru_prev = commit->lru_prev;
+  else
+    table->lru_tail = commit->lru_prev;
+  commit->lru_prev = commit->lru_next = NULL;
+}
+
+static void lru_push_front(CommitTable *table, Commit *commit) {
+  commit->lru_prev = NULL;
+  commit->lru_next = table->lru_head;
+  if (table->lru_head)
+    table->lru_head->lru_prev = commit;
+  else
+    table->lru_tail = commit;
+  table->lru_head = commit;
+}
+
+static size_t find_slot(const CommitTable *table, const ObjectId *oid) {
+  size_t i = oid_slot(oid, table->capacity);
+  while (table->slots[i] && !oid_eq(&table->slots[i]->oid, oid))
+    i = (i + 1) & (table->capacity - 1);
+  return i;
+}
+
+// Remove the commit in slot i, shifting later members of its probe run
+// back so every remaining commit stays reachable from its home slot.
+static void remove_slot(CommitTable *table, size_t i) {
+  size_t mask = table->capacity - 1;
+  table->slots[i] = NULL;
+  table->count--;
+
+  for (size_t j = (i + 1) & mask; table->slots[j]; j = (j + 1) & mask) {
+    size_t home = oid_slot(&table->slots[j]->oid, table->capacity);
+    // Move it if its home is not cyclically within (i, j]
+    if ((j > i && (home <= i || home > j)) ||
+        (j < i && home <= i && home > j)) {
+      table->slots[i] = table->slots[j];
+      table->slots[j] = NULL;
+      i = j;
+    }
+  }
+}
+
+static void evict_to_limit(CommitTable *table) {
+  while (table->unpinned > table->max_cached && table->lru_tail) {
+    Commit *victim = table->lru_tail;
+    lru_unlink(table, victim);
+    table->unpinned--;
+    remove_slot(table, find_slot(table, &victim->oid));
+    free_commit(table->arena, victim);
+  }
+}
+
+Commit *commit_table_get(CommitTable *table, const ObjectId *oid) {
+  Commit *commit = table->count ? table->slots[find_slot(table, oid)] : NULL;
+  if (!commit) {
+    table->misses++;
+    return NULL;
+  }
+
+  table->hits++;
+  if (commit->pin_count == 0 && table->lru_head != commit) {
+    lru_unlink(table, commit);
+    lru_push_front(table, commit);
+  }
+  return commit;
+}
+
+static int commit_table_grow(CommitTable *table) {
+  size_t capacity = table->capacity ? table->capacity * 2
+                                    : COMMIT_TABLE_MIN_CAPACITY;
+  Commit **slots = calloc(capacity, sizeof(Commit *));
+  if (!slots)
+    return -1;
+
+  for (size_t i = 0; i < table->capacity; i++) {
+    Commit *commit = table->slots[i];
+    if (!commit)
+      continue;
+    size_t j = oid_slot(&commit->oid, capacity);
+    while (slots[j])
+      j = (j + 1) & (capacity - 1);
+    slots[j] = commit;
+  }
+
+  free(table->slots);
+  table->slots = slots;
+  table->capacity = capacity;
+  return 0;
+}
+
+// Add a commit as most recently used, keeping the load factor at or below
+// 1/2 and evicting old unpinned commits past the cache limit. If an equal
+// commit is already present the new one is freed and the existing one
+// returned; returns NULL (leaving commit untouched) if out of memory.
+Commit *commit_table_put(CommitTable *table, Commit *commit) {
+  if (table->count) {
+    Commit *existing = table->slots[find_slot(table, &commit->oid)];
+    if (existing) {
+      if (existing != commit)
+        free_commit(table->arena, commit);
+      return existing;
+    }
+  }
+
+  if ((table->count + 1) * 2 > table->capacity &&
+      commit_table_grow(table) != 0)
+    return NULL;
+
+  table->slots[find_slot(table, &commit->oid)] = commit;
+  table->count++;
+  commit->pin_count = 0;
+  lru_push_front(table, commit);
+  table->unpinned++;
+  evict_to_limit(table);
+  return commit;
+}
+
+// Keep a commit in memory while something holds on to it (branch heads,
+// stashes, commits in the middle of being built).
+void commit_pin(CommitTable *table, Commit *commit) {
+  if (!commit)
+    return;
+  if (commit->pin_count++ == 0) {
+    lru_unlink(table, commit);
+    table->unpinned--;
+  }
+}
+
+void commit_unpin(CommitTable *table, Commit *commit) {
+  if (!commit || commit->pin_count == 0)
+    return;
+  if (--commit->pin_count == 0) {
+    lru_push_front(table, commit);
+    table->unpinned++;
+    evict_to_limit(table);
+  }
+}
@@ -0,0 +1,255 @@
+#include "diff.h"
+#include "branch.h"
+#include "commit.h"
+#include "index.h"
+#include "object_store.h"
+#include "trace.h"
+#include "tree.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// stdout is fully buffered in chunks this big while diffs are written,
+// even to a terminal
+#define DIFF_OUTPUT_BUFFER (1 << 16)
+
+// One side of a file's diff: a blob, or a file in the working tree when
+// path is set. Contents are only read once the file is printed.
+typedef struct DiffBlob {
+    int exists;
+    unsigned int mode;
+    ObjectId oid;
+    const char* path;
+    char* data;
+    size_t len;
+    int mapped;
+} DiffBlob;
+
+typedef struct DiffRun {
+    Repository* repo;
+    const ObjectId* tree;
+    const DiffOptions* opts;
+    int failed;
+} DiffRun;
+
+static char output_buffer[DIFF_OUTPUT_BUFFER];
+
+static void setup_output(void) {
+    setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+}
+
+static int load_blob(DiffBlob* blob) {
+    if (!blob->exists) return 0;
+    if (!blob->path) {
+        ObjectType type;
+        if (read_object(&blob->oid, &type, &blob->data, &blob->len) != 0) return -1;
+        return type == OBJ_BLOB ? 0 : -1;
+    }
+    if (S_ISLNK(blob->mode)) {
+        char target[4096];
+        ssize_t n = readlink(blob->path, target, sizeof(target));
+        if (n < 0 || !(blob->data = malloc(n + 1))) return -1;
+        memcpy(blob->data, target, n);
+        blob->len = (size_t)n;
+        return 0;
+    }
+
+    // Mapped rather than read, so a large file is never copied
+    int fd = open(blob->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            blob->data = map;
+            blob->len = st.st_size;
+            blob->mapped = 1;
+        }
+    }
+    close(fd);
+    return st.st_size > 0 && !blob->mapped ? -1 : 0;
+}
+
+static void release_blob(DiffBlob* blob) {
+    if (blob->mapped)
+        munmap(blob->data, blob->len);
+    else
+        free(blob->data);
+}
+
+// Print the headers and hunks for one path.
+static int print_file_diff(const char* path, DiffBlob* old, DiffBlob* new,
+                           const DiffOptions* opts) {
+    int ret = 0;
+    if (load_blob(old) != 0 || load_blob(new) != 0) {
+        fprintf(stderr, "Could not read %s\n", path);
+        ret = -1;
+        goto done;
+    }
+
+    int same_mode = old->exists && new->exists &&
+                    strcmp(tree_entry_mode(old->mode), tree_entry_mode(new->mode)) == 0;
+    int same_data = old->len == new->len &&
+                    (!old->len || memcmp(old->data, new->data, old->len) == 0);
+    // A file whose stat data changed but not its contents
+    if (same_mode && same_data) goto done;
+
+    printf("diff --git a/%s b/%s\n", path, path);
+    if (!old->exists) {
+        printf("new file mode %s\n", tree_entry_mode(new->mode));
+    } else if (!new->exists) {
+        printf("deleted file mode %s\n", tree_entry_mode(old->mode));
+    } else if (!same_mode) {
+        printf("old mode %s\nnew mode %s\n", tree_entry_mode(old->mode),
+               tree_entry_mode(new->mode));
+    }
+    if (same_data) goto done;  // only the mode changed, or an empty file came or went
+
+    const char* old_prefix = old->exists ? "a/" : "";
+    const char* old_name = old->exists ? path : "/dev/null";
+    const char* new_prefix = new->exists ? "b/" : "";
+    const char* new_name = new->exists ? path : "/dev/null";
+    if (diff_is_binary(old->data, old->len) || diff_is_binary(new->data, new->len)) {
+        printf("Binary files %s%s and %s%s differ\n", old_prefix, old_name, new_prefix,
+               new_name);
+        goto done;
+    }
+    printf("--- %s%s\n+++ %s%s\n", old_prefix, old_name, new_prefix, new_name);
+    if (diff_unified(old->data, old->len, new->data, new->len, opts, stdout) < 0) {
+        fprintf(stderr, "Out of memory diffing %s\n", path);
+        ret = -1;
+    }
+
+done:
+    release_blob(old);
+    release_blob(new);
+    return ret;
+}
+
+// Changes in the working tree not yet staged. Files whose stat data no
+// longer matches are compared byte for byte rather than hashed first.
+int diff_worktree(Repository* repo, const DiffOptions* opts) {
+    setup_output();
+    int ret = 0;
+    for (int i = 0; i < repo->staged_count; i++) {
+        const FileStatus* entry = &repo->staged_files[i];
+        // A staged deletion has nothing in the working tree to compare
+        if (entry->status == 3) continue;
+
+        struct stat st;
+        int exists = lstat(entry->filename, &st) == 0 && !S_ISDIR(st.st_mode);
+        trace_count(TRACE_FILES_STATED, 1);
+        if (exists && index_entry_up_to_date(repo, entry, &st)) {
+            trace_count(TRACE_INDEX_STAT_HITS, 1);
+            continue;
+        }
+
+        DiffBlob old = {1, entry->mode, entry->oid, NULL, NULL, 0, 0};
+        DiffBlob new = {0};
+        if (exists) {
+            new.exists = 1;
+            new.mode = st.st_mode;
+            new.path = entry->filename;
+        }
+        if (print_file_diff(entry->filename, &old, &new, opts) != 0) ret = -1;
+    }
+    fflush(stdout);
+    return ret;
+}
+
+static void print_cached_change(const char* path, int status, void* ctx) {
+    DiffRun* run = ctx;
+    DiffBlob old = {0}, new = {0};
+    if (status != 2) {
+        TreeEntry t;
+        if (tree_find_path(run->tree, path, &t) != 1) {
+            fprintf(stderr, "Could not read %s from HEAD\n", path);
+            run->failed = 1;
+            return;
+        }
+        old.exists = 1;
+        old.mode = t.mode;
+        old.oid = t.oid;
+    }
+    if (status != 3) {
+        const FileStatus* entry = find_index_entry(run->repo, path);
+        if (!entry) {
+            run->failed = 1;
+            return;
+        }
+        new.exists = 1;
+        new.mode = entry->mode;
+        new.oid = entry->oid;
+    }
+    if (print_file_diff(path, &old, &new, run->opts) != 0) run->failed = 1;
+}
+
+// Changes staged since HEAD.
+int diff_cached(Repository* repo, const DiffOptions* opts) {
+    setup_output();
+    Commit* head = repo->current_branch ? branch_head(repo, repo->current_branch) : NULL;
+    ObjectId tree;
+    if (head) tree = head->tree;
+    DiffRun run = {repo, head ? &tree : NULL, opts, 0};
+    if (diff_index_with_tree(repo, run.tree, print_cached_change, &run) != 0) {
+        printf("Could not read the tree of HEAD\n");
+        run.failed = 1;
+    }
+    fflush(stdout);
+    return run.failed ? -1 : 0;
+}
+
+static void print_tree_change(const char* path, const TreeEntry* old_entry,
+                              const TreeEntry* new_entry, void* ctx) {
+    DiffRun* run = ctx;
+    DiffBlob old = {0}, new = {0};
+    if (old_entry) {
+        old.exists = 1;
+        old.mode = old_entry->mode;
+        old.oid = old_entry->oid;
+    }
+    if (new_entry) {
+        new.exists = 1;
+        new.mode = new_entry->mode;
+        new.oid = new_entry->oid;
+    }
+    if (print_file_diff(path, &old, &new, run->opts) != 0) run->failed = 1;
+}
+
+// A branch name, HEAD, or a full commit ID.
+static int resolve_tree(Repository* repo, const char* rev, ObjectId* tree) {
+    Branch* branch = strcmp(rev, "HEAD") == 0 ? repo->current_branch : find_branch(repo, rev);
+    Commit* commit = branch ? branch_head(repo, branch) : find_commit_by_hash(repo, rev);
+    if (!commit) {
+        printf("Unknown revision: %s\n", rev);
+        return -1;
+    }
+    *tree = commit->tree;
+    return 0;
+}
+
+// Changes between two commits.
+int diff_commits(Repository* repo, const char* old_rev, const char* new_rev,
+                 const DiffOptions* opts) {
+    ObjectId old_tree, new_tree;
+    if (resolve_tree(repo, old_rev, &old_tree) != 0 || resolve_tree(repo, new_rev, &new_tree) != 0)
+        return -1;
+
+    setup_output();
+    DiffRun run = {repo, NULL, opts, 0};
+    if (diff_trees(&old_tree, &new_tree, print_tree_change, &run) != 0) {
+        printf("Could not read the trees to compare\n");
+        run.failed = 1;
+    }
+    fflush(stdout);
+    return run.failed ? -1 : 0;
+}
@@ -0,0 +1,308 @@
+#include "fsmonitor.h"
+#include "index.h"
+
+#include <endian.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Give up on a daemon that does not answer in time and scan instead
+#define FSMONITOR_TIMEOUT_SEC 5
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Connect to this working tree's daemon. Returns the socket, or -1 if none
+// is listening.
+int fsmonitor_connect(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, FSMONITOR_SOCKET);
+    struct timeval timeout = {FSMONITOR_TIMEOUT_SEC, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Send one request line and read the whole reply. Returns its length, or
+// -1 if the daemon could not be reached.
+ssize_t fsmonitor_request(const char* request, char** reply) {
+    *reply = NULL;
+    int fd = fsmonitor_connect();
+    if (fd < 0) return -1;
+
+    size_t len = strlen(request);
+    if (send(fd, request, len, MSG_NOSIGNAL) != (ssize_t)len ||
+        send(fd, "\n", 1, MSG_NOSIGNAL) != 1) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = 0, cap = 4096;
+    char* buf = malloc(cap);
+    while (buf) {
+        if (size == cap) {
+            char* grown = realloc(buf, cap * 2);
+            if (!grown) break;
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + size, cap - size);
+        if (n == 0) {
+            close(fd);
+            *reply = buf;
+            return (ssize_t)size;
+        }
+        if (n < 0) break;
+        size += (size_t)n;
+    }
+    free(buf);
+    close(fd);
+    return -1;
+}
+
+// Ask the daemon what changed since token (NULL if there is none yet).
+// Returns 0 on success, -1 if there is no daemon or its reply is malformed.
+int fsmonitor_query(const char* token, FsmonitorChanges* out) {
+    memset(out, 0, sizeof(*out));
+    char* reply;
+    ssize_t len = fsmonitor_request(token ? token : "", &reply);
+    if (len < 0) return -1;
+
+    // token, "full" or "partial", then the paths, each NUL-terminated
+    size_t count = 0;
+    for (ssize_t i = 0; i < len; i++)
+        if (reply[i] == '\0') count++;
+    if (count < 2 || reply[len - 1] != '\0') {
+        free(reply);
+        return -1;
+    }
+    count -= 2;
+
+    out->data = reply;
+    out->token = reply;
+    char* kind = reply + strlen(reply) + 1;
+    out->full = strcmp(kind, "full") == 0;
+    out->paths = malloc((count ? count : 1) * sizeof(char*));
+    if (!out->paths) {
+        fsmonitor_changes_free(out);
+        return -1;
+    }
+    char* p = kind + strlen(kind) + 1;
+    for (size_t i = 0; i < count; i++) {
+        out->paths[i] = p;
+        p += strlen(p) + 1;
+    }
+    out->count = count;
+    qsort(out->paths, count, sizeof(char*), compare_paths);
+    return 0;
+}
+
+void fsmonitor_changes_free(FsmonitorChanges* changes) {
+    free(changes->paths);
+    free(changes->data);
+    memset(changes, 0, sizeof(*changes));
+}
+
+static int has_path(const FsmonitorChanges* changes, const char* path) {
+    return bsearch(&path, changes->paths, changes->count, sizeof(char*),
+                   compare_paths) != NULL;
+}
+
+// Returns 1 if path, or a directory above it, is among the changes.
+int fsmonitor_changed(const FsmonitorChanges* changes, const char* path) {
+    if (changes->full) return 1;
+    if (has_path(changes, path)) return 1;
+
+    char dir[PATH_MAX];
+    for (const char* slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+        size_t len = (size_t)(slash - path) + 1;
+        if (len >= sizeof(dir)) break;
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+        if (has_path(changes, dir)) return 1;
+    }
+    return 0;
+}
+
+static void invalidate_entry(Repository* repo, FileStatus* entry) {
+    if (entry->fsmonitor_valid) {
+        entry->fsmonitor_valid = 0;
+        repo->index_dirty = 1;
+    }
+}
+
+// Forget everything recorded from the daemon.
+void fsmonitor_clear(Repository* repo) {
+    if (!repo->fsmonitor_token && !repo->untracked_count) return;
+    free(repo->fsmonitor_token);
+    repo->fsmonitor_token = NULL;
+    fsmonitor_set_untracked(repo, NULL, 0);
+    for (int i = 0; i < repo->staged_count; i++)
+        repo->staged_files[i].fsmonitor_valid = 0;
+    repo->index_dirty = 1;
+}
+
+// Bring the index's fsmonitor state up to date: entries whose files
+// changed lose their valid bit and the index takes the new token. Returns
+// 0 with the changes filled in, or -1 if there is no daemon, in which case
+// the state is dropped and callers must look at the whole tree. When the
+// changes are full the caller must also rebuild the untracked list.
+int fsmonitor_refresh(Repository* repo, FsmonitorChanges* changes) {
+    if (fsmonitor_query(repo->fsmonitor_token, changes) != 0) {
+        fsmonitor_clear(repo);
+        return -1;
+    }
+    if (!repo->fsmonitor_token) changes->full = 1;
+
+    if (changes->full) {
+        for (int i = 0; i < repo->staged_count; i++)
+            invalidate_entry(repo, &repo->staged_files[i]);
+    } else {
+        for (size_t k = 0; k < changes->count; k++) {
+            const char* path = changes->paths[k];
+            size_t len = strlen(path);
+            int pos = index_entry_pos(repo, path);
+            if (len == 0 || path[len - 1] != '/') {
+                if (pos >= 0) invalidate_entry(repo, &repo->staged_files[pos]);
+                continue;
+            }
+            // A directory: every entry below it sorts right after its name
+            for (int i = -pos - 1; i < repo->staged_count &&
+                                   strncmp(repo->staged_files[i].filename, path, len) == 0;
+                 i++)
+                invalidate_entry(repo, &repo->staged_files[i]);
+        }
+    }
+
+    // Unchanged, the old token is as good and the index need not be rewritten
+    if (!changes->full && changes->count == 0) return 0;
+
+    char* token = strdup(changes->token);
+    if (!token) {
+        fsmonitor_changes_free(changes);
+        fsmonitor_clear(repo);
+        return -1;
+    }
+    free(repo->fsmonitor_token);
+    repo->fsmonitor_token = token;
+    repo->index_dirty = 1;
+    return 0;
+}
+
+// Record the untracked files, a sorted list the repository takes over.
+void fsmonitor_set_untracked(Repository* repo, char** paths, size_t count) {
+    int same = count == repo->untracked_count;
+    for (size_t i = 0; same && i < count; i++)
+        same = strcmp(paths[i], repo->untracked[i]) == 0;
+    if (!same) repo->index_dirty = 1;
+
+    for (size_t i = 0; i < repo->untracked_count; i++)
+        free(repo->untracked[i]);
+    free(repo->untracked);
+    repo->untracked = paths;
+    repo->untracked_count = count;
+}
+
+static void put_be32(unsigned char* p, uint32_t v) {
+    v = htobe32(v);
+    memcpy(p, &v, 4);
+}
+
+static uint32_t get_be32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return be32toh(v);
+}
+
+size_t fsmonitor_ext_size(const Repository* repo) {
+    if (!repo->fsmonitor_token) return 0;
+    size_t size = strlen(repo->fsmonitor_token) + 1 + 4 +
+                  ((size_t)repo->staged_count + 7) / 8 + 4;
+    for (size_t i = 0; i < repo->untracked_count; i++)
+        size += strlen(repo->untracked[i]) + 1;
+    return size;
+}
+
+// Write the extension into out, which has fsmonitor_ext_size() bytes.
+void fsmonitor_ext_write(const Repository* repo, unsigned char* out) {
+    size_t len = strlen(repo->fsmonitor_token) + 1;
+    memcpy(out, repo->fsmonitor_token, len);
+    out += len;
+
+    put_be32(out, (uint32_t)repo->staged_count);
+    out += 4;
+    size_t bitmap_size = ((size_t)repo->staged_count + 7) / 8;
+    memset(out, 0, bitmap_size);
+    for (int i = 0; i < repo->staged_count; i++) {
+        if (repo->staged_files[i].fsmonitor_valid)
+            out[i / 8] |= (unsigned char)(1u << (i % 8));
+    }
+    out += bitmap_size;
+
+    put_be32(out, (uint32_t)repo->untracked_count);
+    out += 4;
+    for (size_t i = 0; i < repo->untracked_count; i++) {
+        len = strlen(repo->untracked[i]) + 1;
+        memcpy(out, repo->untracked[i], len);
+        out += len;
+    }
+}
+
+// Load the extension after the entries it describes. A malformed one is
+// ignored, which only costs a full scan.
+void fsmonitor_ext_read(Repository* repo, const unsigned char* data, size_t len) {
+    const unsigned char* end = data + len;
+    const unsigned char* nul = memchr(data, '\0', len);
+    if (!nul || end - (nul + 1) < 4) return;
+    const unsigned char* p = nul + 1;
+    uint32_t count = get_be32(p);
+    p += 4;
+    size_t bitmap_size = ((size_t)count + 7) / 8;
+    if (count != (uint32_t)repo->staged_count || (size_t)(end - p) < bitmap_size + 4)
+        return;
+    const unsigned char* bitmap = p;
+    p += bitmap_size;
+    uint32_t untracked_count = get_be32(p);
+    p += 4;
+
+    char** untracked = calloc(untracked_count ? untracked_count : 1, sizeof(char*));
+    char* token = strdup((const char*)data);
+    uint32_t n = 0;
+    while (untracked && token && n < untracked_count) {
+        nul = memchr(p, '\0', (size_t)(end - p));
+        if (!nul || !(untracked[n] = strdup((const char*)p))) break;
+        n++;
+        p = nul + 1;
+    }
+    if (n != untracked_count) {
+        for (uint32_t i = 0; i < n; i++)
+            free(untracked[i]);
+        free(untracked);
+        free(token);
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        repo->staged_files[i].fsmonitor_valid = (bitmap[i / 8] >> (i % 8)) & 1;
+    free(repo->fsmonitor_token);
+    repo->fsmonitor_token = token;
+    for (size_t i = 0; i < repo->untracked_count; i++)
+        free(repo->untracked[i]);
+    free(repo->untracked);
+    repo->untracked = untracked;
+    repo->untracked_count = untracked_count;
+}
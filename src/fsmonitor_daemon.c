@@ -0,0 +1,581 @@
+#define _GNU_SOURCE  // accept4, pipe2
+#include "fsmonitor.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Changed paths the journal remembers. Past this the oldest are forgotten
+// and tokens from before them are answered with "full".
+#define JOURNAL_MAX (1u << 20)
+
+#define WATCH_MASK                                                               \
+    (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |            \
+     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+// One changed path, in both the journal's hash table and its list ordered
+// by when the path last changed.
+typedef struct JournalEntry {
+    struct JournalEntry* hash_next;
+    struct JournalEntry* older;
+    struct JournalEntry* newer;
+    uint64_t seq;
+    char path[];
+} JournalEntry;
+
+typedef struct Journal {
+    JournalEntry** buckets;
+    size_t bucket_count;  // always a power of two
+    size_t count;
+    JournalEntry* oldest;
+    JournalEntry* newest;
+    uint64_t seq;          // of the latest change; a token's position
+    uint64_t first_valid;  // tokens before this may have missed changes
+} Journal;
+
+typedef struct Monitor {
+    int inotify_fd;
+    int listen_fd;
+    char** watch_dirs;  // by watch descriptor: "" or "dir/", NULL if unused
+    int watch_cap;
+    int watch_count;
+    int watch_failures;  // directories left unwatched; answers are "full" meanwhile
+    Journal journal;
+    char instance[40];  // tells this daemon's tokens from an earlier one's
+    int running;
+} Monitor;
+
+static volatile sig_atomic_t stop_requested;
+
+static void handle_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static uint64_t hash_path(const char* path) {
+    uint64_t h = 14695981039346656037u;  // FNV-1a
+    for (; *path; path++)
+        h = (h ^ (unsigned char)*path) * 1099511628211u;
+    return h;
+}
+
+static JournalEntry** journal_slot(Journal* journal, const char* path) {
+    JournalEntry** slot = &journal->buckets[hash_path(path) & (journal->bucket_count - 1)];
+    while (*slot && strcmp((*slot)->path, path) != 0)
+        slot = &(*slot)->hash_next;
+    return slot;
+}
+
+static void journal_unlink(Journal* journal, JournalEntry* entry) {
+    if (entry->older) entry->older->newer = entry->newer;
+    else journal->oldest = entry->newer;
+    if (entry->newer) entry->newer->older = entry->older;
+    else journal->newest = entry->older;
+}
+
+static int journal_grow(Journal* journal) {
+    size_t new_count = journal->bucket_count ? journal->bucket_count * 2 : 4096;
+    JournalEntry** buckets = calloc(new_count, sizeof(JournalEntry*));
+    if (!buckets) return -1;
+    for (JournalEntry* e = journal->oldest; e; e = e->newer) {
+        size_t b = hash_path(e->path) & (new_count - 1);
+        e->hash_next = buckets[b];
+        buckets[b] = e;
+    }
+    free(journal->buckets);
+    journal->buckets = buckets;
+    journal->bucket_count = new_count;
+    return 0;
+}
+
+// Tokens from before now can no longer be answered.
+static void journal_invalidate(Journal* journal) {
+    journal->first_valid = ++journal->seq;
+}
+
+// Note that path changed. A path already in the journal moves to the end.
+static void journal_add(Journal* journal, const char* path) {
+    if (journal->count >= journal->bucket_count && journal_grow(journal) != 0) {
+        journal_invalidate(journal);
+        return;
+    }
+
+    JournalEntry** slot = journal_slot(journal, path);
+    JournalEntry* entry = *slot;
+    if (entry) {
+        journal_unlink(journal, entry);
+    } else {
+        size_t len = strlen(path);
+        entry = malloc(sizeof(JournalEntry) + len + 1);
+        if (!entry) {
+            journal_invalidate(journal);
+            return;
+        }
+        memcpy(entry->path, path, len + 1);
+        entry->hash_next = NULL;
+        *slot = entry;
+        journal->count++;
+    }
+
+    entry->seq = ++journal->seq;
+    entry->older = journal->newest;
+    entry->newer = NULL;
+    if (journal->newest) journal->newest->newer = entry;
+    else journal->oldest = entry;
+    journal->newest = entry;
+
+    if (journal->count > JOURNAL_MAX) {
+        JournalEntry* old = journal->oldest;
+        journal->first_valid = old->seq;
+        journal_unlink(journal, old);
+        *journal_slot(journal, old->path) = old->hash_next;
+        journal->count--;
+        free(old);
+    }
+}
+
+static void journal_free(Journal* journal) {
+    JournalEntry* e = journal->oldest;
+    while (e) {
+        JournalEntry* next = e->newer;
+        free(e);
+        e = next;
+    }
+    free(journal->buckets);
+}
+
+static int skip_name(const char* name) {
+    return strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+           strcmp(name, ".babygit") == 0;
+}
+
+// Changes below a directory that could not be watched are never
+// journaled, so no token can be answered until a rescan watches it.
+static void watch_failed(Monitor* m, const char* dir) {
+    if (errno == ENOSPC)
+        fprintf(stderr, "Out of inotify watches at %s; raise "
+                        "fs.inotify.max_user_watches\n", dir);
+    else
+        fprintf(stderr, "Cannot watch %s: %s\n", dir[0] ? dir : ".", strerror(errno));
+    m->watch_failures++;
+    journal_invalidate(&m->journal);
+}
+
+// Watch dir ("" or "dir/") and every directory below it. A directory
+// already watched keeps its descriptor and takes the new path.
+static void add_watches(Monitor* m, const char* dir) {
+    int wd = inotify_add_watch(m->inotify_fd, dir[0] ? dir : ".", WATCH_MASK);
+    if (wd < 0) {
+        watch_failed(m, dir);
+        return;
+    }
+    if (wd >= m->watch_cap) {
+        int new_cap = m->watch_cap ? m->watch_cap * 2 : 1024;
+        while (new_cap <= wd) new_cap *= 2;
+        char** grown = realloc(m->watch_dirs, new_cap * sizeof(char*));
+        if (!grown) {
+            inotify_rm_watch(m->inotify_fd, wd);
+            watch_failed(m, dir);
+            return;
+        }
+        memset(grown + m->watch_cap, 0, (new_cap - m->watch_cap) * sizeof(char*));
+        m->watch_dirs = grown;
+        m->watch_cap = new_cap;
+    }
+    char* name = strdup(dir);
+    if (!name) {
+        if (!m->watch_dirs[wd]) inotify_rm_watch(m->inotify_fd, wd);
+        watch_failed(m, dir);
+        return;
+    }
+    if (!m->watch_dirs[wd]) m->watch_count++;
+    free(m->watch_dirs[wd]);
+    m->watch_dirs[wd] = name;
+
+    // Listed after the watch is in place, so nothing created meanwhile is lost
+    DIR* d = opendir(dir[0] ? dir : ".");
+    if (!d) {
+        watch_failed(m, dir);  // its subdirectories go unwatched
+        return;
+    }
+    size_t prefix = strlen(dir);
+    char path[PATH_MAX];
+    memcpy(path, dir, prefix);
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (skip_name(entry->d_name)) continue;
+        size_t len = strlen(entry->d_name);
+        if (prefix + len + 2 > sizeof(path)) continue;
+        memcpy(path + prefix, entry->d_name, len);
+        path[prefix + len] = '\0';
+
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (!is_dir) continue;
+        path[prefix + len] = '/';
+        path[prefix + len + 1] = '\0';
+        add_watches(m, path);
+    }
+    closedir(d);
+}
+
+// Stop watching dir and everything below it, after it moved away.
+static void remove_watches(Monitor* m, const char* dir) {
+    size_t len = strlen(dir);
+    for (int wd = 0; wd < m->watch_cap; wd++) {
+        if (m->watch_dirs[wd] && strncmp(m->watch_dirs[wd], dir, len) == 0) {
+            inotify_rm_watch(m->inotify_fd, wd);
+            free(m->watch_dirs[wd]);
+            m->watch_dirs[wd] = NULL;
+            m->watch_count--;
+        }
+    }
+}
+
+static void handle_event(Monitor* m, const struct inotify_event* ev) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        // Events were lost, directories created meanwhile among them
+        fprintf(stderr, "inotify queue overflowed; rescanning\n");
+        journal_invalidate(&m->journal);
+        m->watch_failures = 0;
+        add_watches(m, "");
+        return;
+    }
+    if (ev->wd < 0 || ev->wd >= m->watch_cap || !m->watch_dirs[ev->wd]) return;
+    const char* dir = m->watch_dirs[ev->wd];
+
+    if (ev->mask & IN_IGNORED) {
+        free(m->watch_dirs[ev->wd]);
+        m->watch_dirs[ev->wd] = NULL;
+        m->watch_count--;
+        return;
+    }
+    if (ev->len == 0) {
+        if ((ev->mask & IN_DELETE_SELF) && dir[0] == '\0') m->running = 0;
+        return;
+    }
+    if (strcmp(ev->name, ".babygit") == 0) {
+        // The repository is gone, and with it any reason to keep watching
+        if (dir[0] == '\0' && (ev->mask & (IN_DELETE | IN_MOVED_FROM))) m->running = 0;
+        return;
+    }
+
+    char path[PATH_MAX];
+    int n = snprintf(path, sizeof(path), "%s%s", dir, ev->name);
+    if (n < 0 || (size_t)n + 2 > sizeof(path)) return;
+
+    if (!(ev->mask & IN_ISDIR)) {
+        journal_add(&m->journal, path);
+        return;
+    }
+    // A directory that appeared or went away changes everything below it;
+    // its own attributes do not matter
+    if (!(ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) return;
+    path[n] = '/';
+    path[n + 1] = '\0';
+    if (ev->mask & IN_MOVED_FROM) remove_watches(m, path);
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO)) add_watches(m, path);
+    journal_add(&m->journal, path);
+}
+
+// Read whatever inotify has queued without blocking.
+static void drain_events(Monitor* m) {
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(m->inotify_fd, buf, sizeof(buf));
+        if (len <= 0) return;
+        for (char* p = buf; p < buf + len;) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            handle_event(m, ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+typedef struct Reply {
+    char* data;
+    size_t len;
+    size_t cap;
+} Reply;
+
+static int reply_add(Reply* reply, const char* s) {
+    size_t len = strlen(s) + 1;
+    if (reply->len + len > reply->cap) {
+        size_t new_cap = reply->cap ? reply->cap * 2 : 4096;
+        while (new_cap < reply->len + len) new_cap *= 2;
+        char* grown = realloc(reply->data, new_cap);
+        if (!grown) return -1;
+        reply->data = grown;
+        reply->cap = new_cap;
+    }
+    memcpy(reply->data + reply->len, s, len);
+    reply->len += len;
+    return 0;
+}
+
+// The position a token names, or -1 if it cannot be answered from the journal.
+static int64_t token_seq(const Monitor* m, const char* token) {
+    const char* colon = strrchr(token, ':');
+    if (!colon || (size_t)(colon - token) != strlen(m->instance) ||
+        strncmp(token, m->instance, colon - token) != 0)
+        return -1;
+    char* end;
+    errno = 0;
+    unsigned long long seq = strtoull(colon + 1, &end, 10);
+    if (errno || end == colon + 1 || *end ||
+        seq < m->journal.first_valid || seq > m->journal.seq)
+        return -1;
+    return (int64_t)seq;
+}
+
+static void answer_query(Monitor* m, const char* token, Reply* reply) {
+    char new_token[64];
+    snprintf(new_token, sizeof(new_token), "%s:%" PRIu64, m->instance, m->journal.seq);
+    reply_add(reply, new_token);
+
+    int64_t since = m->watch_failures ? -1 : token_seq(m, token);
+    if (since < 0) {
+        reply_add(reply, "full");
+        return;
+    }
+    reply_add(reply, "partial");
+    for (JournalEntry* e = m->journal.newest; e && e->seq > (uint64_t)since; e = e->older) {
+        if (reply_add(reply, e->path) != 0) {
+            // Cannot send the list; make the client scan
+            reply->len = 0;
+            reply_add(reply, new_token);
+            reply_add(reply, "full");
+            return;
+        }
+    }
+}
+
+static void serve_client(Monitor* m, int fd) {
+    char request[4096];
+    size_t len = 0;
+    while (len < sizeof(request) - 1 && !memchr(request, '\n', len)) {
+        ssize_t n = read(fd, request + len, sizeof(request) - 1 - len);
+        if (n <= 0) return;
+        len += (size_t)n;
+    }
+    char* newline = memchr(request, '\n', len);
+    if (!newline) return;
+    *newline = '\0';
+
+    // Everything that happened before the request must be in the answer
+    drain_events(m);
+
+    Reply reply = {0};
+    if (strcmp(request, "quit") == 0) {
+        reply_add(&reply, "ok");
+        m->running = 0;
+    } else if (strcmp(request, "status") == 0) {
+        char line[128];
+        snprintf(line, sizeof(line), "%d directories watched, %d unwatched, %zu paths journaled",
+                 m->watch_count, m->watch_failures, m->journal.count);
+        reply_add(&reply, line);
+    } else {
+        answer_query(m, request, &reply);
+    }
+
+    for (size_t sent = 0; sent < reply.len;) {
+        ssize_t n = send(fd, reply.data + sent, reply.len - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += (size_t)n;
+    }
+    free(reply.data);
+}
+
+static int listen_socket(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, FSMONITOR_SOCKET);
+    unlink(FSMONITOR_SOCKET);  // left behind by a daemon that was killed
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Watch the tree and answer queries until told to stop. ready_fd is
+// written to once queries can be answered.
+static int run_daemon(int ready_fd) {
+    Monitor m;
+    memset(&m, 0, sizeof(m));
+    m.running = 1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    snprintf(m.instance, sizeof(m.instance), "%lx%09lx", (long)getpid() ^ (long)now.tv_sec,
+             (long)now.tv_nsec);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    m.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m.inotify_fd < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+    // Answers from an incomplete watch set would miss changes
+    add_watches(&m, "");
+    if (m.watch_failures) {
+        fprintf(stderr, "fsmonitor: %d directories could not be watched; not starting\n",
+                m.watch_failures);
+        close(m.inotify_fd);
+        for (int wd = 0; wd < m.watch_cap; wd++)
+            free(m.watch_dirs[wd]);
+        free(m.watch_dirs);
+        return -1;
+    }
+    m.listen_fd = listen_socket();
+    if (m.listen_fd < 0) {
+        perror("fsmonitor");
+        close(m.inotify_fd);
+        return -1;
+    }
+    fprintf(stderr, "fsmonitor %d watching %d directories\n", (int)getpid(),
+            m.watch_count);
+    if (write(ready_fd, "", 1) != 1) perror("fsmonitor");
+    close(ready_fd);
+
+    while (m.running && !stop_requested) {
+        struct pollfd fds[2] = {{m.inotify_fd, POLLIN, 0}, {m.listen_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        if (fds[0].revents & POLLIN) drain_events(&m);
+        if (fds[1].revents & POLLIN) {
+            int client = accept4(m.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (client >= 0) {
+                struct timeval timeout = {1, 0};
+                setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                serve_client(&m, client);
+                close(client);
+            }
+        }
+    }
+
+    unlink(FSMONITOR_SOCKET);
+    close(m.listen_fd);
+    close(m.inotify_fd);
+    for (int wd = 0; wd < m.watch_cap; wd++)
+        free(m.watch_dirs[wd]);
+    free(m.watch_dirs);
+    journal_free(&m.journal);
+    fprintf(stderr, "fsmonitor %d stopped\n", (int)getpid());
+    return 0;
+}
+
+static int daemon_running(void) {
+    int fd = fsmonitor_connect();
+    if (fd < 0) return 0;
+    close(fd);
+    return 1;
+}
+
+// Start a daemon for the working tree in the current directory, detached
+// from the terminal, and wait until it answers queries.
+int fsmonitor_daemon_start(void) {
+    if (daemon_running()) {
+        printf("fsmonitor is already running\n");
+        return 0;
+    }
+
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(ready[0]);
+        close(ready[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(ready[0]);
+        setsid();
+        if (fork() != 0) _exit(0);
+        int null_fd = open("/dev/null", O_RDONLY);
+        int log_fd = open(FSMONITOR_LOG, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (null_fd >= 0) dup2(null_fd, STDIN_FILENO);
+        if (log_fd >= 0) {
+            dup2(log_fd, STDOUT_FILENO);
+            dup2(log_fd, STDERR_FILENO);
+        }
+        _exit(run_daemon(ready[1]) == 0 ? 0 : 1);
+    }
+
+    close(ready[1]);
+    waitpid(pid, NULL, 0);
+    char byte;
+    ssize_t n;
+    do {
+        n = read(ready[0], &byte, 1);
+    } while (n < 0 && errno == EINTR);
+    close(ready[0]);
+    if (n != 1) {
+        printf("fsmonitor failed to start; see %s\n", FSMONITOR_LOG);
+        return -1;
+    }
+    printf("fsmonitor started\n");
+    return 0;
+}
+
+int fsmonitor_daemon_stop(void) {
+    char* reply;
+    if (fsmonitor_request("quit", &reply) < 0) {
+        printf("fsmonitor is not running\n");
+        return -1;
+    }
+    free(reply);
+    // Wait for the socket to go, so a following start does not find it
+    for (int i = 0; i < 100 && daemon_running(); i++)
+        usleep(10000);
+    printf("fsmonitor stopped\n");
+    return 0;
+}
+
+int fsmonitor_daemon_status(void) {
+    char* reply;
+    ssize_t len = fsmonitor_request("status", &reply);
+    if (len <= 0 || reply[len - 1] != '\0') {
+        free(reply);
+        printf("fsmonitor is not running\n");
+        return -1;
+    }
+    printf("fsmonitor is running: %s\n", reply);
+    free(reply);
+    return 0;
+}
@@ -0,0 +1,588 @@
+#include "hash.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HAVE_SHANI 1
+#endif
+
+static const uint32_t sha1_iv[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t get_be32(const unsigned char* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void put_be32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha1_portable_blocks(uint32_t state[5], const unsigned char* data, size_t blocks) {
+    for (; blocks; blocks--, data += HASH_BLOCK_SIZE) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) w[i] = get_be32(data + 4 * i);
+        for (int i = 16; i < 80; i++) w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            uint32_t t = ROL(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = ROL(b, 30);
+            b = a;
+            a = t;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+static void sha256_portable_blocks(uint32_t state[8], const unsigned char* data, size_t blocks) {
+    for (; blocks; blocks--, data += HASH_BLOCK_SIZE) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) w[i] = get_be32(data + 4 * i);
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) +
+                          sha256_k[i] + w[i];
+            uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef HAVE_SHANI
+#define SHANI_TARGET __attribute__((target("sha,sse4.1")))
+
+// One group of four SHA-1 rounds. Groups alternate between the two E
+// registers: e holds this group's E and f receives the next one. The
+// message words for group i are in m[i % 4]; the first four are loaded
+// from the block and the rest are built three groups ahead of their use.
+#define SHA1_SHANI_GROUP(i, abcd, e, f, m, block)                                        \
+    do {                                                                                 \
+        if ((i) < 4)                                                                     \
+            m[(i) % 4] = _mm_shuffle_epi8(                                               \
+                _mm_loadu_si128((const __m128i*)((block) + 16 * ((i) % 4))), mask);      \
+        if ((i) == 0)                                                                    \
+            e = _mm_add_epi32(e, m[0]);                                                  \
+        else                                                                             \
+            e = _mm_sha1nexte_epu32(e, m[(i) % 4]);                                      \
+        f = abcd;                                                                        \
+        if ((i) >= 3 && (i) <= 18)                                                       \
+            m[((i) + 1) % 4] = _mm_sha1msg2_epu32(m[((i) + 1) % 4], m[(i) % 4]);         \
+        abcd = _mm_sha1rnds4_epu32(abcd, e, (i) / 5);                                    \
+        if ((i) >= 1 && (i) <= 16)                                                       \
+            m[((i) + 3) % 4] = _mm_sha1msg1_epu32(m[((i) + 3) % 4], m[(i) % 4]);         \
+        if ((i) >= 2 && (i) <= 17)                                                       \
+            m[((i) + 2) % 4] = _mm_xor_si128(m[((i) + 2) % 4], m[(i) % 4]);              \
+    } while (0)
+
+#define SHA1_SHANI_ALL_GROUPS(G)                                                         \
+    G(0, e0, e1); G(1, e1, e0); G(2, e0, e1); G(3, e1, e0); G(4, e0, e1);                \
+    G(5, e1, e0); G(6, e0, e1); G(7, e1, e0); G(8, e0, e1); G(9, e1, e0);                \
+    G(10, e0, e1); G(11, e1, e0); G(12, e0, e1); G(13, e1, e0); G(14, e0, e1);           \
+    G(15, e1, e0); G(16, e0, e1); G(17, e1, e0); G(18, e0, e1); G(19, e1, e0)
+
+#define SHA1_SHANI_MASK _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL)
+
+SHANI_TARGET static void sha1_shani_load(const uint32_t state[5], __m128i* abcd, __m128i* e0) {
+    *abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1b);
+    *e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+}
+
+SHANI_TARGET static void sha1_shani_store(uint32_t state[5], __m128i abcd, __m128i e0) {
+    _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+SHANI_TARGET static void sha1_shani_blocks(uint32_t state[5], const unsigned char* data,
+                                           size_t blocks) {
+    const __m128i mask = SHA1_SHANI_MASK;
+    __m128i abcd, e0, e1, m[4];
+    sha1_shani_load(state, &abcd, &e0);
+
+    for (; blocks; blocks--, data += HASH_BLOCK_SIZE) {
+        __m128i abcd_save = abcd, e0_save = e0;
+#define LANE(i, e, f) SHA1_SHANI_GROUP(i, abcd, e, f, m, data)
+        SHA1_SHANI_ALL_GROUPS(LANE);
+#undef LANE
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+    sha1_shani_store(state, abcd, e0);
+}
+
+// Two independent messages, one group of each at a time.
+SHANI_TARGET static void sha1_shani_blocks2(uint32_t state_a[5], const unsigned char* data_a,
+                                            uint32_t state_b[5], const unsigned char* data_b,
+                                            size_t blocks) {
+    const __m128i mask = SHA1_SHANI_MASK;
+    __m128i abcd_a, e0_a, e1_a, m_a[4];
+    __m128i abcd_b, e0_b, e1_b, m_b[4];
+    sha1_shani_load(state_a, &abcd_a, &e0_a);
+    sha1_shani_load(state_b, &abcd_b, &e0_b);
+
+    for (; blocks; blocks--, data_a += HASH_BLOCK_SIZE, data_b += HASH_BLOCK_SIZE) {
+        __m128i abcd_save_a = abcd_a, e0_save_a = e0_a;
+        __m128i abcd_save_b = abcd_b, e0_save_b = e0_b;
+#define LANES(i, e, f)                                          \
+    SHA1_SHANI_GROUP(i, abcd_a, e##_a, f##_a, m_a, data_a);     \
+    SHA1_SHANI_GROUP(i, abcd_b, e##_b, f##_b, m_b, data_b)
+        SHA1_SHANI_ALL_GROUPS(LANES);
+#undef LANES
+        e0_a = _mm_sha1nexte_epu32(e0_a, e0_save_a);
+        abcd_a = _mm_add_epi32(abcd_a, abcd_save_a);
+        e0_b = _mm_sha1nexte_epu32(e0_b, e0_save_b);
+        abcd_b = _mm_add_epi32(abcd_b, abcd_save_b);
+    }
+    sha1_shani_store(state_a, abcd_a, e0_a);
+    sha1_shani_store(state_b, abcd_b, e0_b);
+}
+
+// One group of four SHA-256 rounds, two per sha256rnds2. As for SHA-1 the
+// message words for group i are in m[i % 4] and the later ones are built
+// ahead of their use.
+#define SHA256_SHANI_GROUP(i)                                                            \
+    do {                                                                                 \
+        if ((i) < 4)                                                                     \
+            m[(i) % 4] = _mm_shuffle_epi8(                                               \
+                _mm_loadu_si128((const __m128i*)(data + 16 * ((i) % 4))), mask);         \
+        msg = _mm_add_epi32(m[(i) % 4],                                                  \
+                            _mm_loadu_si128((const __m128i*)(sha256_k + 4 * (i))));      \
+        cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);                                   \
+        if ((i) >= 3 && (i) <= 14) {                                                     \
+            __m128i tmp = _mm_alignr_epi8(m[(i) % 4], m[((i) + 3) % 4], 4);              \
+            m[((i) + 1) % 4] = _mm_add_epi32(m[((i) + 1) % 4], tmp);                     \
+            m[((i) + 1) % 4] = _mm_sha256msg2_epu32(m[((i) + 1) % 4], m[(i) % 4]);       \
+        }                                                                                \
+        msg = _mm_shuffle_epi32(msg, 0x0e);                                              \
+        abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);                                   \
+        if ((i) >= 1 && (i) <= 12)                                                       \
+            m[((i) + 3) % 4] = _mm_sha256msg1_epu32(m[((i) + 3) % 4], m[(i) % 4]);       \
+    } while (0)
+
+SHANI_TARGET static void sha256_shani_blocks(uint32_t state[8], const unsigned char* data,
+                                             size_t blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i msg, m[4];
+
+    // The rounds want the state as ABEF and CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0xb1);
+    __m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(state + 4)), 0x1b);
+    __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+
+    for (; blocks; blocks--, data += HASH_BLOCK_SIZE) {
+        __m128i abef_save = abef, cdgh_save = cdgh;
+        SHA256_SHANI_GROUP(0);
+        SHA256_SHANI_GROUP(1);
+        SHA256_SHANI_GROUP(2);
+        SHA256_SHANI_GROUP(3);
+        SHA256_SHANI_GROUP(4);
+        SHA256_SHANI_GROUP(5);
+        SHA256_SHANI_GROUP(6);
+        SHA256_SHANI_GROUP(7);
+        SHA256_SHANI_GROUP(8);
+        SHA256_SHANI_GROUP(9);
+        SHA256_SHANI_GROUP(10);
+        SHA256_SHANI_GROUP(11);
+        SHA256_SHANI_GROUP(12);
+        SHA256_SHANI_GROUP(13);
+        SHA256_SHANI_GROUP(14);
+        SHA256_SHANI_GROUP(15);
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(abef, 0x1b);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+    _mm_storeu_si128((__m128i*)state, _mm_blend_epi16(tmp, cdgh, 0xf0));
+    _mm_storeu_si128((__m128i*)(state + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+static int cpu_has_shani(void) {
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1)) return 0;
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) return 0;
+    return (b & (1u << 29)) != 0;  // SHA
+}
+#else
+static int cpu_has_shani(void) {
+    return 0;
+}
+#endif
+
+// Build the final one or two blocks of a message of total bytes whose last
+// rest_len bytes (less than a block) are rest. Returns the block count.
+static size_t pad_tail(const unsigned char* rest, size_t rest_len, uint64_t total,
+                       unsigned char out[2 * HASH_BLOCK_SIZE]) {
+    size_t blocks = rest_len + 9 <= HASH_BLOCK_SIZE ? 1 : 2;
+    memcpy(out, rest, rest_len);
+    out[rest_len] = 0x80;
+    memset(out + rest_len + 1, 0, blocks * HASH_BLOCK_SIZE - rest_len - 1);
+    uint64_t bits = total * 8;
+    put_be32(out + blocks * HASH_BLOCK_SIZE - 8, (uint32_t)(bits >> 32));
+    put_be32(out + blocks * HASH_BLOCK_SIZE - 4, (uint32_t)bits);
+    return blocks;
+}
+
+typedef void (*BlockFn)(uint32_t* state, const unsigned char* data, size_t blocks);
+
+// The buffering shared by the block-based backends. Every instance below
+// passes a constant blocks function, which is inlined into it.
+static inline void block_update(HashContext* ctx, const void* data, size_t len,
+                                BlockFn blocks_fn) {
+    const unsigned char* p = data;
+    size_t used = ctx->length % HASH_BLOCK_SIZE;
+    ctx->length += len;
+    if (used) {
+        size_t take = HASH_BLOCK_SIZE - used < len ? HASH_BLOCK_SIZE - used : len;
+        memcpy(ctx->block + used, p, take);
+        if (used + take < HASH_BLOCK_SIZE) return;
+        blocks_fn(ctx->state, ctx->block, 1);
+        p += take;
+        len -= take;
+    }
+    size_t blocks = len / HASH_BLOCK_SIZE;
+    if (blocks) blocks_fn(ctx->state, p, blocks);
+    memcpy(ctx->block, p + blocks * HASH_BLOCK_SIZE, len % HASH_BLOCK_SIZE);
+}
+
+static inline void block_final(HashContext* ctx, unsigned char* out, int words,
+                               BlockFn blocks_fn) {
+    unsigned char tail[2 * HASH_BLOCK_SIZE];
+    size_t blocks = pad_tail(ctx->block, ctx->length % HASH_BLOCK_SIZE, ctx->length, tail);
+    blocks_fn(ctx->state, tail, blocks);
+    for (int i = 0; i < words; i++) put_be32(out + 4 * i, ctx->state[i]);
+}
+
+#define DEFINE_BLOCK_HASH(name, iv, blocks_fn)                                    \
+    static int name##_init(HashContext* ctx) {                                    \
+        memcpy(ctx->state, iv, sizeof(iv));                                       \
+        ctx->length = 0;                                                          \
+        return 0;                                                                 \
+    }                                                                             \
+    static void name##_update(HashContext* ctx, const void* data, size_t len) {   \
+        block_update(ctx, data, len, blocks_fn);                                  \
+    }                                                                             \
+    static void name##_final(HashContext* ctx, unsigned char* out) {              \
+        block_final(ctx, out, sizeof(iv) / sizeof(uint32_t), blocks_fn);          \
+    }                                                                             \
+    static const HashOps name##_ops = {name##_init, name##_update, name##_final};
+
+DEFINE_BLOCK_HASH(sha1_portable, sha1_iv, sha1_portable_blocks)
+DEFINE_BLOCK_HASH(sha256_portable, sha256_iv, sha256_portable_blocks)
+#ifdef HAVE_SHANI
+DEFINE_BLOCK_HASH(sha1_shani, sha1_iv, sha1_shani_blocks)
+DEFINE_BLOCK_HASH(sha256_shani, sha256_iv, sha256_shani_blocks)
+#endif
+
+// Fetched once; EVP_sha1() would look the provider up on every init
+static const EVP_MD* openssl_md[2];
+
+static int openssl_init(HashContext* ctx, const EVP_MD* md) {
+    ctx->md = EVP_MD_CTX_new();
+    if (!ctx->md) return -1;
+    if (EVP_DigestInit_ex(ctx->md, md, NULL) != 1) {
+        hash_discard(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+static int openssl_sha1_init(HashContext* ctx) {
+    return openssl_init(ctx, openssl_md[OBJECT_FORMAT_SHA1]);
+}
+
+static int openssl_sha256_init(HashContext* ctx) {
+    return openssl_init(ctx, openssl_md[OBJECT_FORMAT_SHA256]);
+}
+
+static void openssl_update(HashContext* ctx, const void* data, size_t len) {
+    EVP_DigestUpdate(ctx->md, data, len);
+}
+
+static void openssl_final(HashContext* ctx, unsigned char* out) {
+    EVP_DigestFinal_ex(ctx->md, out, NULL);
+    hash_discard(ctx);
+}
+
+static const HashOps openssl_sha1_ops = {openssl_sha1_init, openssl_update, openssl_final};
+static const HashOps openssl_sha256_ops = {openssl_sha256_init, openssl_update, openssl_final};
+
+static HashAlgo hash_algos[] = {
+    [OBJECT_FORMAT_SHA1] = {"sha1", OBJECT_FORMAT_SHA1, 20, 40, NULL, HASH_PORTABLE},
+    [OBJECT_FORMAT_SHA256] = {"sha256", OBJECT_FORMAT_SHA256, 32, 64, NULL, HASH_PORTABLE},
+};
+
+const HashAlgo* hash_algo = &hash_algos[OBJECT_FORMAT_SHA1];
+
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+
+static const EVP_MD* fetch_openssl_md(const char* name) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    return EVP_MD_fetch(NULL, name, NULL);
+#else
+    return EVP_get_digestbyname(name);
+#endif
+}
+
+static void choose_backends(void) {
+    const char* name = getenv("BABYGIT_HASH");
+    HashBackend backend = cpu_has_shani() ? HASH_SHANI : HASH_OPENSSL;
+    if (name && strcmp(name, "openssl") == 0) backend = HASH_OPENSSL;
+    if (name && strcmp(name, "portable") == 0) backend = HASH_PORTABLE;
+
+    if (backend == HASH_OPENSSL) {
+        openssl_md[OBJECT_FORMAT_SHA1] = fetch_openssl_md("SHA1");
+        openssl_md[OBJECT_FORMAT_SHA256] = fetch_openssl_md("SHA256");
+        if (!openssl_md[OBJECT_FORMAT_SHA1] || !openssl_md[OBJECT_FORMAT_SHA256])
+            backend = HASH_PORTABLE;
+    }
+
+    hash_algos[OBJECT_FORMAT_SHA1].backend = backend;
+    hash_algos[OBJECT_FORMAT_SHA256].backend = backend;
+    switch (backend) {
+#ifdef HAVE_SHANI
+    case HASH_SHANI:
+        hash_algos[OBJECT_FORMAT_SHA1].ops = &sha1_shani_ops;
+        hash_algos[OBJECT_FORMAT_SHA256].ops = &sha256_shani_ops;
+        break;
+#endif
+    case HASH_OPENSSL:
+        hash_algos[OBJECT_FORMAT_SHA1].ops = &openssl_sha1_ops;
+        hash_algos[OBJECT_FORMAT_SHA256].ops = &openssl_sha256_ops;
+        break;
+    default:
+        hash_algos[OBJECT_FORMAT_SHA1].ops = &sha1_portable_ops;
+        hash_algos[OBJECT_FORMAT_SHA256].ops = &sha256_portable_ops;
+        break;
+    }
+}
+
+int object_format_from_name(const char* name, ObjectFormat* out) {
+    for (size_t i = 0; i < sizeof(hash_algos) / sizeof(hash_algos[0]); i++) {
+        if (strcmp(name, hash_algos[i].name) == 0) {
+            *out = hash_algos[i].format;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Make format the one every object ID is computed and sized with. Called
+// before the repository is read; IDs already in memory are not converted.
+void hash_set_format(ObjectFormat format) {
+    pthread_once(&backend_once, choose_backends);
+    hash_algo = &hash_algos[format];
+}
+
+const char* hash_backend_name(void) {
+    pthread_once(&backend_once, choose_backends);
+    switch (hash_algo->backend) {
+    case HASH_SHANI:
+        return "shani";
+    case HASH_OPENSSL:
+        return "openssl";
+    default:
+        return "portable";
+    }
+}
+
+int hash_init(HashContext* ctx) {
+    pthread_once(&backend_once, choose_backends);
+    ctx->ops = hash_algo->ops;
+    ctx->md = NULL;
+    return ctx->ops->init(ctx);
+}
+
+void hash_update(HashContext* ctx, const void* data, size_t len) {
+    uint64_t trace_start = trace_begin();
+    ctx->ops->update(ctx, data, len);
+    trace_count(TRACE_BYTES_HASHED, len);
+    trace_end(TRACE_HASH, trace_start);
+}
+
+// An ID is zero past the format's width, so IDs compare at full size.
+void hash_final(HashContext* ctx, ObjectId* out) {
+    memset(out, 0, sizeof(*out));
+    ctx->ops->final(ctx, out->hash);
+}
+
+// Release a context that will not be finished.
+void hash_discard(HashContext* ctx) {
+    EVP_MD_CTX_free(ctx->md);
+    ctx->md = NULL;
+}
+
+void calculate_hash(const void* content, size_t len, ObjectId* out) {
+    HashContext ctx;
+    if (hash_init(&ctx) != 0) {
+        memset(out, 0, sizeof(ObjectId));
+        return;
+    }
+    hash_update(&ctx, content, len);
+    hash_final(&ctx, out);
+}
+
+#ifdef HAVE_SHANI
+// One message of a hash_buffers() call: its whole blocks are read in
+// place, then the padded tail.
+typedef struct Lane {
+    const unsigned char* next;
+    size_t run;         // blocks left before next moves on or the message ends
+    int in_tail;
+    size_t index;
+    uint32_t state[5];
+    unsigned char tail[2 * HASH_BLOCK_SIZE];
+    size_t tail_blocks;
+} Lane;
+
+static void lane_start(Lane* lane, const void* data, size_t len, size_t index) {
+    size_t whole = len / HASH_BLOCK_SIZE;
+    memcpy(lane->state, sha1_iv, sizeof(lane->state));
+    lane->index = index;
+    lane->tail_blocks = pad_tail((const unsigned char*)data + whole * HASH_BLOCK_SIZE,
+                                 len % HASH_BLOCK_SIZE, len, lane->tail);
+    lane->next = data;
+    lane->run = whole;
+    lane->in_tail = 0;
+    if (!whole) {
+        lane->next = lane->tail;
+        lane->run = lane->tail_blocks;
+        lane->in_tail = 1;
+    }
+}
+
+// Move past n processed blocks. Returns 1 once the message is done.
+static int lane_advance(Lane* lane, size_t n) {
+    lane->next += n * HASH_BLOCK_SIZE;
+    lane->run -= n;
+    if (lane->run) return 0;
+    if (lane->in_tail) return 1;
+    lane->next = lane->tail;
+    lane->run = lane->tail_blocks;
+    lane->in_tail = 1;
+    return 0;
+}
+
+static void lane_finish(const Lane* lane, ObjectId* out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < 5; i++) put_be32(out->hash + 4 * i, lane->state[i]);
+}
+
+static void sha1_shani_buffers(const void* const* data, const size_t* len, ObjectId* out,
+                               size_t count) {
+    Lane lanes[2];
+    int busy[2] = {0, 0};
+    size_t started = 0;
+
+    for (;;) {
+        for (int k = 0; k < 2; k++) {
+            if (!busy[k] && started < count) {
+                lane_start(&lanes[k], data[started], len[started], started);
+                started++;
+                busy[k] = 1;
+            }
+        }
+        if (!busy[0] && !busy[1]) break;
+
+        size_t n;
+        if (busy[0] && busy[1]) {
+            n = lanes[0].run < lanes[1].run ? lanes[0].run : lanes[1].run;
+            sha1_shani_blocks2(lanes[0].state, lanes[0].next, lanes[1].state, lanes[1].next, n);
+        } else {
+            Lane* lane = &lanes[busy[0] ? 0 : 1];
+            n = lane->run;
+            sha1_shani_blocks(lane->state, lane->next, n);
+        }
+        for (int k = 0; k < 2; k++) {
+            if (busy[k] && lane_advance(&lanes[k], n)) {
+                lane_finish(&lanes[k], &out[lanes[k].index]);
+                busy[k] = 0;
+            }
+        }
+    }
+}
+#endif
+
+void hash_buffers(const void* const* data, const size_t* len, ObjectId* out, size_t count) {
+    pthread_once(&backend_once, choose_backends);
+#ifdef HAVE_SHANI
+    if (hash_algo->ops == &sha1_shani_ops) {
+        uint64_t trace_start = trace_begin();
+        sha1_shani_buffers(data, len, out, count);
+        for (size_t i = 0; i < count; i++) trace_count(TRACE_BYTES_HASHED, len[i]);
+        trace_end(TRACE_HASH, trace_start);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) calculate_hash(data[i], len[i], &out[i]);
+}
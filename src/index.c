@@ -0,0 +1,336 @@
+#include "index.h"
+#include "fsmonitor.h"
+#include "lockfile.h"
+#include "trace.h"
+#include "tree.h"
+#include "utils.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static long long timespec_ns(const struct timespec *ts) {
+  return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+void index_fill_stat_data(FileStatus *entry, const struct stat *st) {
+  entry->mtime_ns = timespec_ns(&st->st_mtim);
+  entry->ctime_ns = timespec_ns(&st->st_ctim);
+  entry->size = st->st_size;
+  entry->ino = st->st_ino;
+  entry->mode = st->st_mode;
+}
+
+int index_stat_data_matches(const FileStatus *entry, const struct stat *st) {
+  return entry->mtime_ns == timespec_ns(&st->st_mtim) &&
+         entry->ctime_ns == timespec_ns(&st->st_ctim) &&
+         entry->size == st->st_size && entry->ino == st->st_ino &&
+         entry->mode == st->st_mode;
+}
+
+// A file modified in the same clock tick the index was written can change
+// again without its mtime moving, so its cached stat data proves nothing.
+int index_entry_is_racy(const Repository *repo, const FileStatus *entry) {
+  return repo->index_mtime_ns == 0 || entry->mtime_ns >= repo->index_mtime_ns;
+}
+
+// Returns 1 if the cached stat data shows the file cannot have changed
+// since it was hashed, so the stored hash can be reused.
+int index_entry_up_to_date(const Repository *repo, const FileStatus *entry,
+                           const struct stat *st) {
+  return index_stat_data_matches(entry, st) && !index_entry_is_racy(repo, entry);
+}
+
+// Binary search the sorted entries. Returns the position of filepath, or
+// -(insert position) - 1 if it is not in the index.
+int index_entry_pos(const Repository *repo, const char *filepath) {
+  int lo = 0, hi = repo->staged_count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(repo->staged_files[mid].filename, filepath);
+    if (cmp == 0)
+      return mid;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -lo - 1;
+}
+
+FileStatus *find_index_entry(Repository *repo, const char *filepath) {
+  int pos = index_entry_pos(repo, filepath);
+  return pos >= 0 ? &repo->staged_files[pos] : NULL;
+}
+
+// Insert a zeroed entry for filepath at pos, keeping the index sorted.
+FileStatus *index_insert_entry(Repository *repo, int pos, const char *filepath) {
+  char *name = arena_strndup(&repo->arena, filepath,
+                             strnlen(filepath, FILE_PATH_MAX - 1));
+  if (!name)
+    return NULL;
+  FileStatus *new_files = realloc(repo->staged_files, (repo->staged_count + 1) *
+                                                          sizeof(FileStatus));
+  if (!new_files)
+    return NULL;
+
+  repo->staged_files = new_files;
+  memmove(&new_files[pos + 1], &new_files[pos],
+          (repo->staged_count - pos) * sizeof(FileStatus));
+  repo->staged_count++;
+  repo->index_dirty = 1;
+
+  FileStatus *entry = &new_files[pos];
+  memset(entry, 0, sizeof(FileStatus));
+  entry->filename = name;
+  return entry;
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+  v = htobe32(v);
+  memcpy(p, &v, 4);
+}
+
+static void put_be64(unsigned char *p, uint64_t v) {
+  v = htobe64(v);
+  memcpy(p, &v, 8);
+}
+
+static uint32_t get_be32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return be32toh(v);
+}
+
+static uint64_t get_be64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return be64toh(v);
+}
+
+static void index_checksum(const unsigned char *data, size_t len,
+                           unsigned char *out) {
+  ObjectId sum;
+  calculate_hash(data, len, &sum);
+  memcpy(out, sum.hash, INDEX_CHECKSUM_SIZE);
+}
+
+// Serialize the whole index into one buffer and write it in a single call,
+// if anything in it has changed.
+int save_index(Repository *repo) {
+  if (!repo || !repo->index_dirty)
+    return 0;
+
+  size_t paths_size = 0;
+  for (int i = 0; i < repo->staged_count; i++)
+    paths_size += strlen(repo->staged_files[i].filename) + 1;
+
+  size_t entries_size = (size_t)repo->staged_count * INDEX_ENTRY_SIZE;
+  size_t tree_size = cache_tree_ext_size(repo->cache_tree);
+  size_t fsmonitor_size = fsmonitor_ext_size(repo);
+  size_t ext_size = (tree_size ? INDEX_EXT_HEADER_SIZE + tree_size : 0) +
+                    (fsmonitor_size ? INDEX_EXT_HEADER_SIZE + fsmonitor_size : 0);
+  size_t total = INDEX_HEADER_SIZE + entries_size + paths_size + ext_size +
+                 INDEX_CHECKSUM_SIZE;
+  unsigned char *buf = calloc(1, total);
+  if (!buf)
+    return -1;
+  uint64_t trace_start = trace_begin();
+
+  put_be32(buf, INDEX_SIGNATURE);
+  put_be32(buf + 4, INDEX_VERSION);
+  put_be32(buf + 8, (uint32_t)repo->staged_count);
+  put_be32(buf + 12, (uint32_t)paths_size);
+
+  unsigned char *ent = buf + INDEX_HEADER_SIZE;
+  unsigned char *paths = ent + entries_size;
+  uint32_t path_off = 0;
+  for (int i = 0; i < repo->staged_count; i++, ent += INDEX_ENTRY_SIZE) {
+    const FileStatus *entry = &repo->staged_files[i];
+    size_t len = strlen(entry->filename);
+
+    put_be64(ent, (uint64_t)entry->mtime_ns);
+    put_be64(ent + 8, (uint64_t)entry->ctime_ns);
+    put_be64(ent + 16, (uint64_t)entry->size);
+    put_be64(ent + 24, entry->ino);
+    put_be32(ent + 32, entry->mode);
+    put_be32(ent + 36, (uint32_t)entry->status);
+    put_be32(ent + 40, path_off);
+    put_be32(ent + 44, (uint32_t)len);
+    memcpy(ent + 48, entry->oid.hash, hash_algo->rawsz);
+
+    memcpy(paths + path_off, entry->filename, len + 1);
+    path_off += len + 1;
+  }
+
+  unsigned char *ext = paths + paths_size;
+  if (tree_size) {
+    put_be32(ext, INDEX_EXT_TREE);
+    put_be32(ext + 4, (uint32_t)tree_size);
+    cache_tree_ext_write(repo->cache_tree, ext + INDEX_EXT_HEADER_SIZE);
+    ext += INDEX_EXT_HEADER_SIZE + tree_size;
+  }
+  if (fsmonitor_size) {
+    put_be32(ext, INDEX_EXT_FSMONITOR);
+    put_be32(ext + 4, (uint32_t)fsmonitor_size);
+    fsmonitor_ext_write(repo, ext + INDEX_EXT_HEADER_SIZE);
+  }
+
+  index_checksum(buf, total - INDEX_CHECKSUM_SIZE,
+                 buf + total - INDEX_CHECKSUM_SIZE);
+  trace_end(TRACE_SERIALIZE, trace_start);
+
+  // The new index replaces the old one when the command's locks commit
+  LockFile *lock = hold_lock_file(INDEX_PATH);
+  int ret = -1;
+  if (lock) {
+    if (write_lock_file(lock, buf, total) == 0) {
+      repo->index_dirty = 0;
+      ret = 0;
+    } else {
+      perror("Failed to write index");
+      rollback_lock_file(lock);
+    }
+  }
+  free(buf);
+  return ret;
+}
+
+// Decode an mmapped index. Entries point into its path table rather than
+// copying the paths, so the mapping must outlive them. Returns 0 on success,
+// -1 if it is malformed.
+static int parse_index(Repository *repo, const unsigned char *map,
+                       size_t size) {
+  if (size < INDEX_HEADER_SIZE + INDEX_CHECKSUM_SIZE)
+    return -1;
+  if (get_be32(map) != INDEX_SIGNATURE || get_be32(map + 4) != INDEX_VERSION)
+    return -1;
+
+  uint32_t count = get_be32(map + 8);
+  uint32_t paths_size = get_be32(map + 12);
+  size_t entries_size = (size_t)count * INDEX_ENTRY_SIZE;
+  if (size < INDEX_HEADER_SIZE + entries_size + paths_size +
+                 INDEX_CHECKSUM_SIZE)
+    return -1;
+
+  unsigned char checksum[OID_RAW_SIZE];
+  index_checksum(map, size - INDEX_CHECKSUM_SIZE, checksum);
+  if (memcmp(checksum, map + size - INDEX_CHECKSUM_SIZE,
+             INDEX_CHECKSUM_SIZE) != 0)
+    return -1;
+
+  FileStatus *files = count ? calloc(count, sizeof(FileStatus)) : NULL;
+  if (count && !files)
+    return -1;
+
+  const unsigned char *ent = map + INDEX_HEADER_SIZE;
+  const char *paths = (const char *)ent + entries_size;
+  for (uint32_t i = 0; i < count; i++, ent += INDEX_ENTRY_SIZE) {
+    FileStatus *entry = &files[i];
+    uint32_t off = get_be32(ent + 40);
+    uint32_t len = get_be32(ent + 44);
+    if ((size_t)off + len >= paths_size || len >= FILE_PATH_MAX ||
+        paths[off + len] != '\0') {
+      free(files);
+      return -1;
+    }
+
+    entry->mtime_ns = (long long)get_be64(ent);
+    entry->ctime_ns = (long long)get_be64(ent + 8);
+    entry->size = (long long)get_be64(ent + 16);
+    entry->ino = get_be64(ent + 24);
+    entry->mode = get_be32(ent + 32);
+    entry->status = (int)get_be32(ent + 36);
+    entry->filename = paths + off;
+    memcpy(entry->oid.hash, ent + 48, hash_algo->rawsz);
+  }
+
+  repo->staged_files = files;
+  repo->staged_count = (int)count;
+
+  // Extensions follow the path table; unknown ones are skipped
+  const unsigned char *ext = (const unsigned char *)paths + paths_size;
+  const unsigned char *end = map + size - INDEX_CHECKSUM_SIZE;
+  while (end - ext >= INDEX_EXT_HEADER_SIZE) {
+    uint32_t signature = get_be32(ext);
+    uint32_t len = get_be32(ext + 4);
+    ext += INDEX_EXT_HEADER_SIZE;
+    if (len > (size_t)(end - ext))
+      break;
+    if (signature == INDEX_EXT_TREE) {
+      cache_tree_free(repo->cache_tree);
+      repo->cache_tree = cache_tree_ext_read(ext, len);
+    } else if (signature == INDEX_EXT_FSMONITOR) {
+      fsmonitor_ext_read(repo, ext, len);
+    }
+    ext += len;
+  }
+  return 0;
+}
+
+// A missing or empty index is an empty one. Returns -1, having changed
+// nothing, if the index exists but cannot be read.
+static int read_index(Repository *repo) {
+  repo->staged_files = NULL;
+  repo->staged_count = 0;
+  cache_tree_free(repo->cache_tree);
+  repo->cache_tree = NULL;
+
+  int fd = open(INDEX_PATH, O_RDONLY);
+  if (fd < 0) {
+    if (errno == ENOENT)
+      return 0;
+    perror("Failed to open index");
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror("Failed to stat index");
+    close(fd);
+    return -1;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  repo->index_mtime_ns = timespec_ns(&st.st_mtim);
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("Failed to map index");
+    return -1;
+  }
+
+  if (parse_index(repo, map, st.st_size) != 0) {
+    fprintf(stderr,
+            "Index file %s is corrupt or from an incompatible version; "
+            "it has been left as it is\n",
+            INDEX_PATH);
+    munmap(map, st.st_size);
+    return -1;
+  }
+  // Kept until the repository is freed; a new index is written to a lock
+  // file and renamed over this one, which leaves the mapping intact
+  repo->index_map = map;
+  repo->index_map_size = st.st_size;
+  return 0;
+}
+
+// Returns -1 if the index cannot be read. The command must then stop
+// before writing anything, or it would replace the index with an empty one.
+int load_index(Repository *repo) {
+  if (!repo) return 0;
+
+  uint64_t trace_start = trace_begin();
+  int ret = read_index(repo);
+  trace_end(TRACE_LOAD_INDEX, trace_start);
+  return ret;
+}
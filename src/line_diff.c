@@ -0,0 +1,596 @@
+#include "line_diff.h"
+#include "trace.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_SIMD_SCAN 1
+#endif
+
+// Histogram diff only anchors on lines that occur at most this often in
+// the old side of the region being split; past that it falls back to Myers.
+#define HISTOGRAM_MAX_CHAIN 64
+
+// Myers settles for a good rather than the best split after this many
+// edits (or the square root of the problem size, if larger).
+#define MYERS_MIN_COST 256
+
+// Lines are hashed this far ahead of the one being looked up, and their
+// slots prefetched, so cache misses on the table overlap (a power of two)
+#define CLASSIFY_AHEAD 16
+
+// How far into a file to look for a NUL when deciding it is binary
+#define BINARY_CHECK_BYTES 8000
+
+// One side of a diff, split into lines. Line i is data[starts[i],
+// starts[i + 1]) and includes its newline, if it has one.
+typedef struct DiffSide {
+    const char* data;
+    size_t len;
+    size_t count;
+    size_t* starts;
+    uint32_t* classes;       // equivalence class of each line
+    unsigned char* changed;  // 1 for lines not matched with the other side
+} DiffSide;
+
+// A distinct line, and how often it occurs on each side.
+typedef struct LineClass {
+    const char* line;
+    size_t len;
+    uint32_t occurrences[2];
+} LineClass;
+
+// Hash table giving every distinct line an equivalence class. A slot holds
+// the top half of its line's hash above class + 1 (0 when empty), so most
+// mismatches are rejected without touching the class.
+typedef struct LineClasses {
+    uint64_t* slots;
+    size_t mask;
+    LineClass* classes;
+    uint32_t count;
+} LineClasses;
+
+// The lines left to diff once those found on only one side are set
+// aside, and the Myers and histogram state for them.
+typedef struct DiffContext {
+    uint32_t* a;        // classes of the old side's kept lines
+    uint32_t* b;
+    size_t* a_index;    // their line numbers
+    size_t* b_index;
+    unsigned char* a_changed;
+    unsigned char* b_changed;
+    long* kvdf;         // furthest reaching paths by diagonal, forwards
+    long* kvdb;         // and backwards
+    long max_cost;
+    uint32_t* counts;   // histogram: occurrences per class in the region
+    long* heads;        // histogram: first occurrence per class
+    long* next;         // histogram: next occurrence of the same class
+} DiffContext;
+
+// Store the offset just past each '\n' in data[from, len) into starts,
+// unless it is NULL. Returns how many there are.
+typedef size_t (*newline_scan_fn)(const char* data, size_t from, size_t len, size_t* starts);
+
+static size_t scan_newlines_portable(const char* data, size_t from, size_t len,
+                                     size_t* starts) {
+    size_t n = 0;
+    const char* end = data + len;
+    for (const char* p = data + from; p < end && (p = memchr(p, '\n', end - p)) != NULL;) {
+        p++;
+        if (starts) starts[n] = p - data;
+        n++;
+    }
+    return n;
+}
+
+#ifdef HAVE_SIMD_SCAN
+// Compare 16 or 32 bytes at a time and turn the matches into a bitmask;
+// dense newlines are then read off the mask without branching per byte.
+static size_t scan_newlines_sse2(const char* data, size_t from, size_t len, size_t* starts) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t n = 0, i = from;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        if (!starts) {
+            n += __builtin_popcount(mask);
+            continue;
+        }
+        for (; mask; mask &= mask - 1)
+            starts[n++] = i + __builtin_ctz(mask) + 1;
+    }
+    return n + scan_newlines_portable(data, i, len, starts ? starts + n : NULL);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_newlines_avx2(const char* data, size_t from, size_t len, size_t* starts) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t n = 0, i = from;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        if (!starts) {
+            n += __builtin_popcount(mask);
+            continue;
+        }
+        for (; mask; mask &= mask - 1)
+            starts[n++] = i + __builtin_ctz(mask) + 1;
+    }
+    return n + scan_newlines_sse2(data, i, len, starts ? starts + n : NULL);
+}
+#endif
+
+static newline_scan_fn scan_newlines = scan_newlines_portable;
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+static void choose_scan(void) {
+#ifdef HAVE_SIMD_SCAN
+    __builtin_cpu_init();
+    scan_newlines = __builtin_cpu_supports("avx2") ? scan_newlines_avx2 : scan_newlines_sse2;
+#endif
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Hash a line sixteen bytes at a time in two independent lanes. The last
+// partial block is read as overlapping words rather than byte by byte.
+static uint64_t hash_line(const char* p, size_t len) {
+    const uint64_t k1 = 0x9e3779b97f4a7c15ull, k2 = 0xc2b2ae3d27d4eb4full;
+    uint64_t h1 = k1 ^ len, h2 = k2;
+    uint64_t w1 = 0, w2 = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        memcpy(&w1, p + i, 8);
+        memcpy(&w2, p + i + 8, 8);
+        h1 = rotl64((h1 ^ w1) * k2, 31);
+        h2 = rotl64((h2 ^ w2) * k1, 27);
+    }
+
+    size_t rest = len - i;
+    w1 = w2 = 0;
+    if (rest >= 8) {
+        memcpy(&w1, p + i, 8);
+        memcpy(&w2, p + len - 8, 8);
+    } else if (rest >= 4) {
+        uint32_t lo, hi;
+        memcpy(&lo, p + i, 4);
+        memcpy(&hi, p + len - 4, 4);
+        w1 = lo | (uint64_t)hi << 32;
+    } else if (rest) {
+        w1 = (unsigned char)p[i] | (unsigned char)p[i + rest / 2] << 8 |
+             (uint64_t)(unsigned char)p[len - 1] << 16;
+    }
+    h1 = (h1 ^ w1) * k2;
+    h2 = (h2 ^ w2) * k1;
+    uint64_t h = (h1 ^ rotl64(h2, 29)) * 0xff51afd7ed558ccdull;
+    return h ^ (h >> 32);
+}
+
+int diff_is_binary(const char* data, size_t len) {
+    if (len == 0) return 0;  // an empty or missing side may have no data at all
+    return memchr(data, '\0', len < BINARY_CHECK_BYTES ? len : BINARY_CHECK_BYTES) != NULL;
+}
+
+static int split_lines(DiffSide* side, const char* data, size_t len) {
+    pthread_once(&scan_once, choose_scan);
+    side->data = data;
+    side->len = len;
+    size_t newlines = scan_newlines(data, 0, len, NULL);
+    size_t max_lines = newlines + 1;
+    side->starts = malloc((max_lines + 1) * sizeof(size_t));
+    side->classes = malloc(max_lines * sizeof(uint32_t));
+    side->changed = calloc(max_lines, 1);
+    if (!side->starts || !side->classes || !side->changed) return -1;
+
+    side->starts[0] = 0;
+    size_t count = scan_newlines(data, 0, len, side->starts + 1);
+    if (side->starts[count] < len) side->starts[++count] = len;  // no final newline
+    side->count = count;
+    return 0;
+}
+
+static void free_side(DiffSide* side) {
+    free(side->starts);
+    free(side->classes);
+    free(side->changed);
+}
+
+static uint64_t hash_and_prefetch(const LineClasses* lc, const DiffSide* side, size_t i) {
+    uint64_t h = hash_line(side->data + side->starts[i], side->starts[i + 1] - side->starts[i]);
+    __builtin_prefetch(&lc->slots[h & lc->mask]);
+    return h;
+}
+
+static void classify(LineClasses* lc, DiffSide* side, int which) {
+    const uint64_t tag_mask = ~(uint64_t)UINT32_MAX;
+    uint64_t ahead[CLASSIFY_AHEAD];
+    for (size_t i = 0; i < CLASSIFY_AHEAD && i < side->count; i++)
+        ahead[i] = hash_and_prefetch(lc, side, i);
+
+    for (size_t i = 0; i < side->count; i++) {
+        uint64_t h = ahead[i & (CLASSIFY_AHEAD - 1)];
+        if (i + CLASSIFY_AHEAD < side->count)
+            ahead[i & (CLASSIFY_AHEAD - 1)] = hash_and_prefetch(lc, side, i + CLASSIFY_AHEAD);
+
+        const char* line = side->data + side->starts[i];
+        size_t len = side->starts[i + 1] - side->starts[i];
+        size_t slot = h & lc->mask;
+        uint32_t c;
+        for (;; slot = (slot + 1) & lc->mask) {
+            uint64_t entry = lc->slots[slot];
+            if (!entry) {
+                c = lc->count++;
+                lc->classes[c] = (LineClass){line, len, {0, 0}};
+                lc->slots[slot] = (h & tag_mask) | (c + 1);
+                break;
+            }
+            c = (uint32_t)entry - 1;
+            if ((entry & tag_mask) == (h & tag_mask) && lc->classes[c].len == len &&
+                memcmp(lc->classes[c].line, line, len) == 0)
+                break;
+        }
+        side->classes[i] = c;
+        lc->classes[c].occurrences[which]++;
+    }
+}
+
+// Find where to split a[off1, lim1) against b[off2, lim2): a point on a
+// shortest edit path about halfway along it, found by running Myers'
+// algorithm from both ends until the paths meet. Past max_cost edits the
+// furthest-reaching path is used instead, which bounds the running time
+// at the cost of a possibly longer diff.
+static void myers_split(DiffContext* c, long off1, long lim1, long off2, long lim2,
+                        long* mid1, long* mid2) {
+    long* kvdf = c->kvdf;
+    long* kvdb = c->kvdb;
+    long dmin = off1 - lim2, dmax = lim1 - off2;
+    long fmid = off1 - off2, bmid = lim1 - lim2;
+    int odd = (fmid - bmid) & 1;
+    long fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+
+    kvdf[fmid] = off1;
+    kvdb[bmid] = lim1;
+    for (long ec = 1;; ec++) {
+        if (fmin > dmin) kvdf[--fmin - 1] = -1;
+        else ++fmin;
+        if (fmax < dmax) kvdf[++fmax + 1] = -1;
+        else --fmax;
+        for (long d = fmax; d >= fmin; d -= 2) {
+            long i1 = kvdf[d - 1] >= kvdf[d + 1] ? kvdf[d - 1] + 1 : kvdf[d + 1];
+            long i2 = i1 - d;
+            for (; i1 < lim1 && i2 < lim2 && c->a[i1] == c->b[i2]; i1++, i2++)
+                ;
+            kvdf[d] = i1;
+            if (odd && bmin <= d && d <= bmax && kvdb[d] <= i1) {
+                *mid1 = i1;
+                *mid2 = i2;
+                return;
+            }
+        }
+
+        if (bmin > dmin) kvdb[--bmin - 1] = LONG_MAX;
+        else ++bmin;
+        if (bmax < dmax) kvdb[++bmax + 1] = LONG_MAX;
+        else --bmax;
+        for (long d = bmax; d >= bmin; d -= 2) {
+            long i1 = kvdb[d - 1] < kvdb[d + 1] ? kvdb[d - 1] : kvdb[d + 1] - 1;
+            long i2 = i1 - d;
+            for (; i1 > off1 && i2 > off2 && c->a[i1 - 1] == c->b[i2 - 1]; i1--, i2--)
+                ;
+            kvdb[d] = i1;
+            if (!odd && fmin <= d && d <= fmax && i1 <= kvdf[d]) {
+                *mid1 = i1;
+                *mid2 = i2;
+                return;
+            }
+        }
+
+        if (ec < c->max_cost) continue;
+        long fbest = -1, fbest1 = -1;
+        for (long d = fmax; d >= fmin; d -= 2) {
+            long i1 = kvdf[d] < lim1 ? kvdf[d] : lim1;
+            long i2 = i1 - d;
+            if (lim2 < i2) i1 = lim2 + d, i2 = lim2;
+            if (fbest < i1 + i2) fbest = i1 + i2, fbest1 = i1;
+        }
+        long bbest = LONG_MAX, bbest1 = LONG_MAX;
+        for (long d = bmax; d >= bmin; d -= 2) {
+            long i1 = kvdb[d] > off1 ? kvdb[d] : off1;
+            long i2 = i1 - d;
+            if (i2 < off2) i1 = off2 + d, i2 = off2;
+            if (i1 + i2 < bbest) bbest = i1 + i2, bbest1 = i1;
+        }
+        if ((lim1 + lim2) - bbest < fbest - (off1 + off2)) {
+            *mid1 = fbest1;
+            *mid2 = fbest - fbest1;
+        } else {
+            *mid1 = bbest1;
+            *mid2 = bbest - bbest1;
+        }
+        return;
+    }
+}
+
+static void mark_changed(DiffContext* c, long off1, long lim1, long off2, long lim2) {
+    for (long i = off1; i < lim1; i++)
+        c->a_changed[c->a_index[i]] = 1;
+    for (long i = off2; i < lim2; i++)
+        c->b_changed[c->b_index[i]] = 1;
+}
+
+static void myers_diff(DiffContext* c, long off1, long lim1, long off2, long lim2) {
+    for (;;) {
+        for (; off1 < lim1 && off2 < lim2 && c->a[off1] == c->b[off2]; off1++, off2++)
+            ;
+        for (; off1 < lim1 && off2 < lim2 && c->a[lim1 - 1] == c->b[lim2 - 1]; lim1--, lim2--)
+            ;
+        if (off1 == lim1 || off2 == lim2) break;
+
+        long mid1, mid2;
+        myers_split(c, off1, lim1, off2, lim2, &mid1, &mid2);
+        if ((mid1 == off1 && mid2 == off2) || (mid1 == lim1 && mid2 == lim2))
+            break;  // no progress; cannot happen, but never loop
+        myers_diff(c, off1, mid1, off2, mid2);
+        off1 = mid1;
+        off2 = mid2;
+    }
+    mark_changed(c, off1, lim1, off2, lim2);
+}
+
+// Split the region on the longest run of common lines whose rarest line
+// is as rare as possible in the old side, then diff either side of it.
+static void histogram_diff(DiffContext* c, long off1, long lim1, long off2, long lim2) {
+    for (;;) {
+        for (; off1 < lim1 && off2 < lim2 && c->a[off1] == c->b[off2]; off1++, off2++)
+            ;
+        for (; off1 < lim1 && off2 < lim2 && c->a[lim1 - 1] == c->b[lim2 - 1]; lim1--, lim2--)
+            ;
+        if (off1 == lim1 || off2 == lim2) {
+            mark_changed(c, off1, lim1, off2, lim2);
+            return;
+        }
+
+        // Chain each old line to the next of its class, rarest class first
+        for (long i = lim1 - 1; i >= off1; i--) {
+            uint32_t cls = c->a[i];
+            c->next[i] = c->counts[cls] ? c->heads[cls] : -1;
+            c->heads[cls] = i;
+            c->counts[cls]++;
+        }
+
+        long best1 = 0, best_end1 = 0, best2 = 0;
+        uint32_t best_rare = HISTOGRAM_MAX_CHAIN + 1;
+        for (long j = off2; j < lim2;) {
+            long next_j = j + 1;
+            uint32_t cls = c->b[j];
+            if (c->counts[cls] && c->counts[cls] <= best_rare) {
+                for (long i = c->heads[cls]; i >= 0; i = c->next[i]) {
+                    long s1 = i, s2 = j, e1 = i + 1, e2 = j + 1;
+                    uint32_t rare = c->counts[cls];
+                    for (; s1 > off1 && s2 > off2 && c->a[s1 - 1] == c->b[s2 - 1]; s1--, s2--)
+                        if (c->counts[c->a[s1 - 1]] < rare) rare = c->counts[c->a[s1 - 1]];
+                    for (; e1 < lim1 && e2 < lim2 && c->a[e1] == c->b[e2]; e1++, e2++)
+                        if (c->counts[c->a[e1]] < rare) rare = c->counts[c->a[e1]];
+                    if (e2 > next_j) next_j = e2;
+                    if (rare < best_rare || (rare == best_rare && e1 - s1 > best_end1 - best1)) {
+                        best_rare = rare;
+                        best1 = s1;
+                        best_end1 = e1;
+                        best2 = s2;
+                    }
+                }
+            }
+            j = next_j;
+        }
+        for (long i = off1; i < lim1; i++)
+            c->counts[c->a[i]] = 0;
+
+        if (best_rare > HISTOGRAM_MAX_CHAIN) {
+            myers_diff(c, off1, lim1, off2, lim2);
+            return;
+        }
+        long best_end2 = best2 + (best_end1 - best1);
+        histogram_diff(c, off1, best1, off2, best2);
+        off1 = best_end1;
+        off2 = best_end2;
+    }
+}
+
+static long int_sqrt(long n) {
+    long r = 1;
+    while (r * r < n) r++;
+    return r;
+}
+
+// Mark the changed lines of both sides.
+static int diff_sides(DiffSide* a, DiffSide* b, DiffAlgorithm algorithm) {
+    size_t total = a->count + b->count;
+    size_t slots = 16;
+    while (slots < total * 2) slots *= 2;
+
+    LineClasses lc = {0};
+    lc.slots = calloc(slots, sizeof(uint64_t));
+    lc.mask = slots - 1;
+    lc.classes = malloc((total + 1) * sizeof(LineClass));
+
+    DiffContext c = {0};
+    c.a = malloc((a->count + 1) * sizeof(uint32_t));
+    c.b = malloc((b->count + 1) * sizeof(uint32_t));
+    c.a_index = malloc((a->count + 1) * sizeof(size_t));
+    c.b_index = malloc((b->count + 1) * sizeof(size_t));
+    long ndiags = (long)total + 3;
+    long* kvd = malloc(2 * (ndiags + 1) * sizeof(long));
+
+    int ret = -1;
+    if (!lc.slots || !lc.classes || !c.a || !c.b || !c.a_index || !c.b_index || !kvd)
+        goto done;
+
+    classify(&lc, a, 0);
+    classify(&lc, b, 1);
+
+    // A line found on one side only cannot be matched, so it is changed
+    // outright and the algorithms never see it
+    long n1 = 0, n2 = 0;
+    for (size_t i = 0; i < a->count; i++) {
+        if (!lc.classes[a->classes[i]].occurrences[1]) {
+            a->changed[i] = 1;
+            continue;
+        }
+        c.a[n1] = a->classes[i];
+        c.a_index[n1++] = i;
+    }
+    for (size_t i = 0; i < b->count; i++) {
+        if (!lc.classes[b->classes[i]].occurrences[0]) {
+            b->changed[i] = 1;
+            continue;
+        }
+        c.b[n2] = b->classes[i];
+        c.b_index[n2++] = i;
+    }
+
+    c.a_changed = a->changed;
+    c.b_changed = b->changed;
+    c.kvdf = kvd + n2 + 1;
+    c.kvdb = c.kvdf + n1 + n2 + 3;
+    c.max_cost = int_sqrt(n1 + n2 + 3);
+    if (c.max_cost < MYERS_MIN_COST) c.max_cost = MYERS_MIN_COST;
+
+    if (algorithm == DIFF_HISTOGRAM) {
+        c.counts = calloc(lc.count + 1, sizeof(uint32_t));
+        c.heads = malloc((lc.count + 1) * sizeof(long));
+        c.next = malloc((n1 + 1) * sizeof(long));
+        if (!c.counts || !c.heads || !c.next) goto done;
+        histogram_diff(&c, 0, n1, 0, n2);
+    } else {
+        myers_diff(&c, 0, n1, 0, n2);
+    }
+    ret = 0;
+
+done:
+    free(lc.slots);
+    free(lc.classes);
+    free(c.a);
+    free(c.b);
+    free(c.a_index);
+    free(c.b_index);
+    free(c.counts);
+    free(c.heads);
+    free(c.next);
+    free(kvd);
+    return ret;
+}
+
+// A run of changed lines: old[a0, a1) replaced by new[b0, b1).
+typedef struct Change {
+    size_t a0, a1, b0, b1;
+} Change;
+
+static int next_change(const DiffSide* a, const DiffSide* b, size_t* i, size_t* j,
+                       Change* change) {
+    // Unchanged lines pair up one to one
+    while (*i < a->count && *j < b->count && !a->changed[*i] && !b->changed[*j]) {
+        (*i)++;
+        (*j)++;
+    }
+    change->a0 = *i;
+    change->b0 = *j;
+    while (*i < a->count && a->changed[*i]) (*i)++;
+    while (*j < b->count && b->changed[*j]) (*j)++;
+    change->a1 = *i;
+    change->b1 = *j;
+    return change->a1 > change->a0 || change->b1 > change->b0;
+}
+
+static void emit_line(FILE* out, char prefix, const DiffSide* side, size_t i) {
+    size_t start = side->starts[i], end = side->starts[i + 1];
+    putc(prefix, out);
+    fwrite(side->data + start, 1, end - start, out);
+    if (side->data[end - 1] != '\n') fputs("\n\\ No newline at end of file\n", out);
+}
+
+// "start,count" as in a hunk header; start is the line before an empty range.
+static void emit_range(FILE* out, size_t start, size_t count) {
+    if (count == 1)
+        fprintf(out, "%zu", start + 1);
+    else
+        fprintf(out, "%zu,%zu", count ? start + 1 : start, count);
+}
+
+static int emit_hunks(const DiffSide* a, const DiffSide* b, size_t context, FILE* out) {
+    Change* changes = NULL;
+    size_t count = 0, cap = 0;
+    size_t i = 0, j = 0;
+    Change change;
+    while (next_change(a, b, &i, &j, &change)) {
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            Change* grown = realloc(changes, cap * sizeof(Change));
+            if (!grown) {
+                free(changes);
+                return -1;
+            }
+            changes = grown;
+        }
+        changes[count++] = change;
+    }
+
+    int hunks = 0;
+    for (size_t k = 0; k < count;) {
+        // Changes close enough to share context go in one hunk
+        size_t last = k;
+        while (last + 1 < count && changes[last + 1].a0 - changes[last].a1 <= 2 * context)
+            last++;
+
+        size_t before = changes[k].a0 < context ? changes[k].a0 : context;
+        size_t after = a->count - changes[last].a1 < context ? a->count - changes[last].a1
+                                                             : context;
+        size_t a_start = changes[k].a0 - before, b_start = changes[k].b0 - before;
+        size_t a_end = changes[last].a1 + after, b_end = changes[last].b1 + after;
+
+        fputs("@@ -", out);
+        emit_range(out, a_start, a_end - a_start);
+        fputs(" +", out);
+        emit_range(out, b_start, b_end - b_start);
+        fputs(" @@\n", out);
+
+        size_t p = a_start;
+        for (size_t m = k; m <= last; m++) {
+            for (; p < changes[m].a0; p++)
+                emit_line(out, ' ', a, p);
+            for (size_t q = changes[m].a0; q < changes[m].a1; q++)
+                emit_line(out, '-', a, q);
+            for (size_t q = changes[m].b0; q < changes[m].b1; q++)
+                emit_line(out, '+', b, q);
+            p = changes[m].a1;
+        }
+        for (; p < a_end; p++)
+            emit_line(out, ' ', a, p);
+        hunks++;
+        k = last + 1;
+    }
+    free(changes);
+    return hunks;
+}
+
+// Write the hunks of a unified diff from old to new. Returns how many
+// there were (0 if the buffers have the same lines), or -1 if out of memory.
+int diff_unified(const char* old_data, size_t old_len, const char* new_data, size_t new_len,
+                 const DiffOptions* opts, FILE* out) {
+    uint64_t trace_start = trace_begin();
+    DiffSide a = {0}, b = {0};
+    int ret = -1;
+    if (split_lines(&a, old_data, old_len) == 0 && split_lines(&b, new_data, new_len) == 0 &&
+        diff_sides(&a, &b, opts->algorithm) == 0)
+        ret = emit_hunks(&a, &b, opts->context < 0 ? 0 : (size_t)opts->context, out);
+    free_side(&a);
+    free_side(&b);
+    trace_end(TRACE_DIFF, trace_start);
+    return ret;
+}
@@ -0,0 +1,265 @@
+#define _GNU_SOURCE  // syncfs
+#include "lockfile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct LockFile {
+    char path[512];
+    char lock_path[520];
+    int fd;
+    int written;  // unwritten locks are released, not committed
+    struct LockFile* next;
+};
+
+// Locks held by this process, committed together by commit_lock_files()
+static LockFile* held_locks;
+static int cleanup_registered;
+
+// Set when something was written or renamed since the last barrier
+static atomic_int sync_pending;
+
+// Run after each batch barrier, see fsync_after_barrier()
+static int (*barrier_hook)(void);
+
+static void unlink_held_locks(void) {
+    for (LockFile* lock = held_locks; lock; lock = lock->next) {
+        if (lock->fd >= 0) close(lock->fd);
+        unlink(lock->lock_path);
+    }
+}
+
+static void unlist_lock(LockFile* lock) {
+    for (LockFile** p = &held_locks; *p; p = &(*p)->next) {
+        if (*p == lock) {
+            *p = lock->next;
+            return;
+        }
+    }
+}
+
+static LockFile* take_lock(const char* path, int quiet) {
+    for (LockFile* lock = held_locks; lock; lock = lock->next) {
+        if (strcmp(lock->path, path) == 0) {
+            if (ftruncate(lock->fd, 0) != 0 || lseek(lock->fd, 0, SEEK_SET) != 0)
+                return NULL;
+            lock->written = 0;
+            return lock;
+        }
+    }
+
+    LockFile* lock = calloc(1, sizeof(LockFile));
+    if (!lock) return NULL;
+    snprintf(lock->path, sizeof(lock->path), "%s", path);
+    snprintf(lock->lock_path, sizeof(lock->lock_path), "%s" LOCK_SUFFIX, path);
+
+    lock->fd = open(lock->lock_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (lock->fd < 0) {
+        if (quiet) {
+            // Nothing to report
+        } else if (errno == EEXIST) {
+            fprintf(stderr,
+                    "Unable to create '%s': File exists.\n"
+                    "Another babygit process seems to be running. If not, "
+                    "a previous one crashed; remove the file to continue.\n",
+                    lock->lock_path);
+        } else {
+            fprintf(stderr, "Unable to create '%s': %s\n", lock->lock_path,
+                    strerror(errno));
+        }
+        free(lock);
+        return NULL;
+    }
+
+    // Never leave a lock behind on exit
+    if (!cleanup_registered) {
+        atexit(unlink_held_locks);
+        cleanup_registered = 1;
+    }
+    lock->next = held_locks;
+    held_locks = lock;
+    return lock;
+}
+
+// Take the lock for path. NULL if another process holds it or the lock
+// cannot be created. If this process already holds it, the pending
+// contents are discarded so the caller can write them afresh.
+LockFile* hold_lock_file(const char* path) {
+    return take_lock(path, 0);
+}
+
+// Like hold_lock_file(), but says nothing if the lock is unavailable.
+LockFile* try_lock_file(const char* path) {
+    return take_lock(path, 1);
+}
+
+int write_lock_file(LockFile* lock, const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t n = write(lock->fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    lock->written = 1;
+    return 0;
+}
+
+void rollback_lock_file(LockFile* lock) {
+    if (!lock) return;
+    unlist_lock(lock);
+    if (lock->fd >= 0) close(lock->fd);
+    unlink(lock->lock_path);
+    free(lock);
+}
+
+// Flush a written lock's contents ahead of the rename. Returns -1, with
+// the lock rolled back, on failure.
+static int finish_lock_file(LockFile* lock) {
+    int failed = fsync_written(lock->fd) != 0;
+    if (close(lock->fd) != 0) failed = 1;
+    lock->fd = -1;
+    if (failed) {
+        fprintf(stderr, "Failed to write %s: %s\n", lock->lock_path, strerror(errno));
+        rollback_lock_file(lock);
+        return -1;
+    }
+    return 0;
+}
+
+static int rename_lock_file(LockFile* lock) {
+    if (rename(lock->lock_path, lock->path) != 0) {
+        fprintf(stderr, "Failed to update %s: %s\n", lock->path, strerror(errno));
+        rollback_lock_file(lock);
+        return -1;
+    }
+    fsync_renamed(lock->path);
+    unlist_lock(lock);
+    free(lock);
+    return 0;
+}
+
+// Move the new contents into place and release the lock.
+int commit_lock_file(LockFile* lock) {
+    if (!lock) return -1;
+    if (finish_lock_file(lock) != 0) return -1;
+    if (fsync_barrier() != 0) {
+        fprintf(stderr, "Failed to update %s: %s\n", lock->path, strerror(errno));
+        rollback_lock_file(lock);
+        return -1;
+    }
+    return rename_lock_file(lock);
+}
+
+// Commit every lock still held. In batch mode that takes two barriers
+// however many locks there are: one for their contents and every object
+// written before them, and one after all of the renames. Locks taken but
+// never written are released, leaving their files as they were.
+int commit_lock_files(void) {
+    int result = 0;
+    LockFile* lock = held_locks;
+    while (lock) {
+        LockFile* next = lock->next;
+        if (!lock->written) {
+            rollback_lock_file(lock);
+        } else if (finish_lock_file(lock) != 0) {
+            result = -1;
+        }
+        lock = next;
+    }
+
+    if (fsync_barrier() != 0) {
+        fprintf(stderr, "Failed to flush repository updates: %s\n", strerror(errno));
+        while (held_locks) rollback_lock_file(held_locks);
+        return -1;
+    }
+    while (held_locks) {
+        if (rename_lock_file(held_locks) != 0) result = -1;
+    }
+    if (fsync_barrier() != 0) result = -1;
+    return result;
+}
+
+static FsyncMode configured_mode = FSYNC_BATCH;
+static pthread_once_t mode_once = PTHREAD_ONCE_INIT;
+
+static void read_fsync_mode(void) {
+    const char* env = getenv("BABYGIT_FSYNC");
+    if (!env || strcmp(env, "batch") == 0) return;
+    if (strcmp(env, "file") == 0) {
+        configured_mode = FSYNC_FILE;
+    } else if (strcmp(env, "off") == 0 || strcmp(env, "0") == 0) {
+        configured_mode = FSYNC_OFF;
+    } else {
+        fprintf(stderr, "Unknown BABYGIT_FSYNC mode '%s', using batch\n", env);
+    }
+}
+
+FsyncMode fsync_mode(void) {
+    pthread_once(&mode_once, read_fsync_mode);
+    return configured_mode;
+}
+
+// Called for a finished file that is about to be renamed into place.
+int fsync_written(int fd) {
+    switch (fsync_mode()) {
+    case FSYNC_FILE:
+        return fsync(fd);
+    case FSYNC_BATCH:
+        atomic_store(&sync_pending, 1);
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+// Called once a file has been renamed into place.
+void fsync_renamed(const char* path) {
+    switch (fsync_mode()) {
+    case FSYNC_FILE: {
+        char dir[512];
+        const char* slash = strrchr(path, '/');
+        snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) : 1,
+                 slash ? path : ".");
+        int fd = open(dir, O_RDONLY | O_DIRECTORY);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+        break;
+    }
+    case FSYNC_BATCH:
+        atomic_store(&sync_pending, 1);
+        break;
+    default:
+        break;
+    }
+}
+
+// Have fn move files into place after each batch barrier, once everything
+// written before it is on disk. fn may rename with fsync_renamed(), which
+// leaves the renames for the next barrier.
+void fsync_after_barrier(int (*fn)(void)) {
+    barrier_hook = fn;
+}
+
+// In batch mode, flush everything written since the last barrier with a
+// single syncfs of the filesystem holding the repository. Barriers are
+// not taken while other threads are still writing.
+int fsync_barrier(void) {
+    if (fsync_mode() != FSYNC_BATCH || !atomic_exchange(&sync_pending, 0))
+        return 0;
+    int fd = open(".babygit", O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return -1;
+    int ret = syncfs(fd);
+    close(fd);
+    if (ret == 0 && barrier_hook) ret = barrier_hook();
+    return ret;
+}
@@ -1,35 +1,77 @@
 #include "branch.h"
 #include "commit.h"
+#include "commit_graph.h"
+#include "diff.h"
+#include "fsmonitor.h"
+#include "index.h"
+#include "lockfile.h"
 #include "merge.h"
+#include "pack.h"
+#include "refs.h"
 #include "repository.h"
 #include "staging.h"
 #include "stash.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+// Commands that never write the index or refs
+static int command_is_read_only(const char *command) {
+  return strcmp(command, "log") == 0 || strcmp(command, "diff") == 0 ||
+         strcmp(command, "fsmonitor") == 0;
+}
 
 int main(int argc, char **argv) {
   if (argc < 2) {
     printf("Usage: %s <command> [args...]\n", argv[0]);
     return 1;
   }
+  trace_setup(argv[1]);
+  const char *command = argv[1];
+
+  // A command that changes the repository holds the index lock from before
+  // it reads anything until its changes are committed, so two of them never
+  // start from the same state and lose each other's updates. Refs and HEAD
+  // are only written by such commands, so the lock covers them too. status
+  // takes it only if it is free, and otherwise leaves the index alone.
+  int locked = 0;
+  if (strcmp(command, "init") != 0 && access(".babygit", F_OK) == 0) {
+    if (strcmp(command, "status") == 0) {
+      locked = try_lock_file(INDEX_PATH) != NULL;
+    } else if (!command_is_read_only(command)) {
+      if (!hold_lock_file(INDEX_PATH))
+        return 1;
+      locked = 1;
+    }
+  }
 
+  // A command must not go on from an index it could not read: saving
+  // would replace it with whatever the command staged. log never needs it.
   Repository *repo = load_repository();
-  load_index(repo);
+  if (strcmp(command, "log") != 0 && load_index(repo) != 0) {
+    free_repository(repo);
+    return 1;
+  }
 
-  if (!repo && strcmp(argv[1], "init") != 0) {
+  int ret = 0;
+  if (!repo && strcmp(command, "init") != 0) {
     printf("Not a babygit repository. Run 'init' first.\n");
     return 1;
   }
 
-  const char *command = argv[1];
-
   if (strcmp(command, "init") == 0) {
+    ObjectFormat format = OBJECT_FORMAT_SHA1;
     if (repo) {
       printf("Repository already initialized\n");
+    } else if (argc > 2 &&
+               (strncmp(argv[2], "--object-format=", 16) != 0 ||
+                object_format_from_name(argv[2] + 16, &format) != 0)) {
+      printf("Usage: %s init [--object-format=sha1|sha256]\n", argv[0]);
     } else {
-      repo = init_repository();
+      repo = init_repository(format);
     }
   } else if (strcmp(command, "add") == 0) {
     if (argc < 3) {
@@ -47,9 +89,8 @@ int main(int argc, char **argv) {
     } else {
       Commit *commit = create_commit(repo, argv[2], argv[3]);
       if (commit) {
-        printf("Committed: %s\n", commit->hash);
-        clear_staging_area(repo);
-        repo->current_branch->head = commit;
+        char hex[OID_HEX_SIZE + 1];
+        printf("Committed: %s\n", oid_to_hex(&commit->oid, hex));
       } else {
         printf("Commit failed. Nothing to commit or an error occurred.\n");
       }
@@ -59,13 +100,11 @@ int main(int argc, char **argv) {
       printf("Usage: %s branch <name>\n", argv[0]);
     } else {
       create_branch(repo, argv[2]);
-      load_all_branch_heads(repo);
     }
   } else if (strcmp(command, "checkout") == 0) {
     if (argc < 3) {
       printf("Usage: %s checkout <branch>\n", argv[0]);
     } else {
-      load_all_branch_heads(repo);
       checkout_branch(repo, argv[2]);
     }
   } else if (strcmp(command, "status") == 0) {
@@ -84,12 +123,79 @@ int main(int argc, char **argv) {
     } else {
       stash_changes(repo, argv[2]);
     }
+  } else if (strcmp(command, "diff") == 0) {
+    DiffOptions opts = DIFF_OPTIONS_INIT;
+    int cached = 0, revs = 0, usage = 0;
+    const char *rev[2];
+    for (int i = 2; i < argc; i++) {
+      if (strcmp(argv[i], "--myers") == 0) {
+        opts.algorithm = DIFF_MYERS;
+      } else if (strcmp(argv[i], "--histogram") == 0) {
+        opts.algorithm = DIFF_HISTOGRAM;
+      } else if (strcmp(argv[i], "--cached") == 0) {
+        cached = 1;
+      } else if (argv[i][0] != '-' && revs < 2) {
+        rev[revs++] = argv[i];
+      } else {
+        usage = 1;
+      }
+    }
+    if (usage || revs == 1 || (cached && revs)) {
+      printf("Usage: %s diff [--myers|--histogram] [--cached | <commit> <commit>]\n",
+             argv[0]);
+    } else if (revs) {
+      diff_commits(repo, rev[0], rev[1], &opts);
+    } else if (cached) {
+      diff_cached(repo, &opts);
+    } else {
+      diff_worktree(repo, &opts);
+    }
+  } else if (strcmp(command, "log") == 0) {
+    print_log(repo);
+  } else if (strcmp(command, "fsmonitor") == 0) {
+    const char *action = argc > 2 ? argv[2] : "";
+    if (strcmp(action, "start") == 0) {
+      if (fsmonitor_daemon_start() != 0)
+        ret = 1;
+    } else if (strcmp(action, "stop") == 0) {
+      fsmonitor_daemon_stop();
+    } else if (strcmp(action, "status") == 0) {
+      fsmonitor_daemon_status();
+    } else {
+      printf("Usage: %s fsmonitor start|stop|status\n", argv[0]);
+    }
+  } else if (strcmp(command, "gc") == 0) {
+    // The graph is written first: repacking moves the commits it reads
+    int graph_commits = commit_graph_write(repo);
+    if (graph_commits < 0) {
+      printf("gc failed to write the commit graph\n");
+    } else {
+      printf("Wrote commit graph with %d commits\n", graph_commits);
+    }
+    if (repack_objects() != 0) {
+      printf("gc failed; objects were left unpacked\n");
+    }
+    int packed_refs = pack_refs(repo);
+    if (packed_refs < 0) {
+      printf("gc failed to pack refs\n");
+    } else {
+      printf("Packed %d refs\n", packed_refs);
+    }
   } else {
     printf("Unknown command: %s\n", command);
   }
 
-  save_repository(repo);
+  // Only what the command changed is written back, and only under the lock
+  if (locked || strcmp(command, "init") == 0) {
+    uint64_t trace_start = trace_begin();
+    int failed = save_repository(repo) != 0;
+    failed |= save_index(repo) != 0;
+    if (commit_lock_files() != 0 || failed) {
+      printf("Failed to save repository state\n");
+      ret = 1;
+    }
+    trace_end(TRACE_SAVE, trace_start);
+  }
   free_repository(repo);
-  save_index(repo);
-  return 0;
+  return ret;
 }
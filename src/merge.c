@@ -5,8 +5,22 @@
 
 #include "merge.h"
 #include "branch.h"
+#include "checkout.h"
 #include "commit.h"
-#include "utils.h"  // for calculate_hash()
+#include "commit_graph.h"
+#include "commit_table.h"
+
+// Bring the index and working tree from one commit's snapshot to
+// another's, refusing if that would overwrite uncommitted changes.
+static int update_worktree(Repository *repo, const Commit *from, const Commit *to) {
+    const ObjectId *from_tree = oid_is_null(&from->tree) ? NULL : &from->tree;
+    const ObjectId *to_tree = oid_is_null(&to->tree) ? NULL : &to->tree;
+    if ((from_tree || to_tree) && checkout_tree(repo, from_tree, to_tree) != 0) {
+        printf("Merge aborted\n");
+        return -1;
+    }
+    return 0;
+}
 
 void merge_branch(Repository *repo, const char *branch_name) {
     if (!repo || !branch_name) {
@@ -17,9 +31,6 @@ void merge_branch(Repository *repo, const char *branch_name) {
     Branch *target = find_branch(repo, branch_name);
     Branch *current = repo->current_branch;
 
-    printf("DEBUG: Current branch pointer: %p\n", (void*)current);
-    printf("DEBUG: Target branch pointer: %p\n", (void*)target);
-
     if (!current) {
         printf("ERROR: Current branch is NULL\n");
         return;
@@ -29,21 +40,17 @@ void merge_branch(Repository *repo, const char *branch_name) {
         return;
     }
 
-    printf("DEBUG: current branch = %s\n", current->name ? current->name : "NULL");
-    printf("DEBUG: target branch = %s\n", target->name ? target->name : "NULL");
-
-    if (!current->head) {
+    Commit *current_head = branch_head(repo, current);
+    Commit *target_head = branch_head(repo, target);
+    char hex[OID_HEX_SIZE + 1];
+    if (!current_head) {
         printf("ERROR: Current branch HEAD is NULL\n");
-    } else {
-        printf("DEBUG: current head = %s\n", current->head->hash);
     }
-    if (!target->head) {
+    if (!target_head) {
         printf("ERROR: Target branch HEAD is NULL\n");
-    } else {
-        printf("DEBUG: target head = %s\n", target->head->hash);
     }
 
-    if (!current->head || !target->head) {
+    if (!current_head || !target_head) {
         printf("Cannot merge: invalid branch state (HEAD missing)\n");
         return;
     }
@@ -53,88 +60,76 @@ void merge_branch(Repository *repo, const char *branch_name) {
         return;
     }
 
-    // Check for fast-forward merge
-    // If current HEAD is ancestor of target HEAD, fast-forward
-    if (strcmp(current->head->hash, target->head->parent_hash) == 0) {
-        printf("Fast-forward merge\n");
-        current->head = target->head;
+    int target_merged = is_ancestor(repo, target_head, current_head);
+    int fast_forward = target_merged == 1 ? 0 : is_ancestor(repo, current_head, target_head);
+    if (target_merged < 0 || fast_forward < 0) {
+        printf("Cannot merge: failed to read commit history\n");
+        return;
+    }
+    if (target_merged) {
+        printf("Already up to date.\n");
         return;
     }
 
-    printf("Merging branch '%s' into '%s'\n", target->name, current->name);
-
-    // Read files from target commit
-    char merged_content[2048] = "";
-    char filepath[256];
-    snprintf(filepath, sizeof(filepath), ".babygit/objects/%s", target->head->hash);
-
-    FILE *target_file = fopen(filepath, "r");
-    if (!target_file) {
-        printf("Failed to read target commit file: %s\n", filepath);
+    // If current HEAD is ancestor of target HEAD, fast-forward. The index
+    // and working tree follow before the branch moves.
+    if (fast_forward) {
+        if (update_worktree(repo, current_head, target_head) != 0)
+            return;
+        printf("Fast-forward merge\n");
+        assign_branch_head(repo, current, target_head);
         return;
     }
 
-    char line[1024];
-    // Skip lines until "files" section found
-    while (fgets(line, sizeof(line), target_file)) {
-        if (strncmp(line, "files", 5) == 0) {
-            break;
-        }
+    printf("Merging branch '%s' into '%s'\n", target->name, current->name);
+    Commit *base = merge_base(repo, current_head, target_head);
+    if (base) {
+        printf("Merge base: %s\n", oid_to_hex(&base->oid, hex));
     }
 
-    // Read file entries and append to merged_content
-    while (fgets(line, sizeof(line), target_file)) {
-        char hash[41], filename[256];
-        if (sscanf(line, "%40s %255s", hash, filename) == 2) {
-            strcat(merged_content, hash);
-            strcat(merged_content, " ");
-            strcat(merged_content, filename);
-            strcat(merged_content, "\n");
-        }
+    // The merge commit records the target's snapshot
+    if (oid_is_null(&target_head->tree)) {
+        printf("Cannot merge: commit %s has no tree\n",
+               oid_to_hex(&target_head->oid, hex));
+        return;
     }
-    fclose(target_file);
+
+    if (update_worktree(repo, current_head, target_head) != 0)
+        return;
 
     // Create merge commit
-    Commit *merge_commit = malloc(sizeof(Commit));
+    char message[300];
+    const char *author = "merge-tool";
+    snprintf(message, sizeof(message), "Merged branch %s", target->name);
+    Commit *merge_commit = alloc_commit(repo, author, strlen(author), message,
+                                        strlen(message));
     if (!merge_commit) {
         printf("Out of memory\n");
         return;
     }
 
-    snprintf(merge_commit->author, sizeof(merge_commit->author), "merge-tool");
-    snprintf(merge_commit->message, sizeof(merge_commit->message), "Merged branch %s", target->name);
     merge_commit->timestamp = time(NULL);
 
-    strncpy(merge_commit->parent_hash, current->head->hash, sizeof(merge_commit->parent_hash));
-    strncpy(merge_commit->second_parent, target->head->hash, sizeof(merge_commit->second_parent));
-    merge_commit->parent = current->head;
-    merge_commit->next = repo->commits;
-
-    char full[4096];
-    snprintf(full, sizeof(full),
-             "parent %s\nparent2 %s\nauthor %s\ntime %ld\nmessage %s\nfiles\n%s",
-             merge_commit->parent_hash,
-             merge_commit->second_parent,
-             merge_commit->author,
-             (long)merge_commit->timestamp,
-             merge_commit->message,
-             merged_content);
-
-    calculate_hash(full, strlen(full), merge_commit->hash);
-
-    snprintf(filepath, sizeof(filepath), ".babygit/objects/%s", merge_commit->hash);
-    FILE *file = fopen(filepath, "w");
-    if (!file) {
+    merge_commit->parents[0] = current_head->oid;
+    merge_commit->parents[1] = target_head->oid;
+    merge_commit->parent_count = 2;
+
+    merge_commit->tree = target_head->tree;
+
+    if (write_commit_object(merge_commit) != 0) {
         printf("Could not save merge commit to disk\n");
-        free(merge_commit);
+        free_commit(&repo->arena, merge_commit);
         return;
     }
 
-    fprintf(file, "%s", full);
-    fclose(file);
-
-    repo->commits = merge_commit;
-    current->head = merge_commit;
+    Commit *stored = commit_table_put(&repo->commits, merge_commit);
+    if (!stored) {
+        printf("Out of memory\n");
+        free_commit(&repo->arena, merge_commit);
+        return;
+    }
+    merge_commit = stored;
+    assign_branch_head(repo, current, merge_commit);
 
-    printf("Merge successful: %s\n", merge_commit->hash);
+    printf("Merge successful: %s\n", oid_to_hex(&merge_commit->oid, hex));
 }
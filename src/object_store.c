@@ -0,0 +1,768 @@
+#include "object_store.h"
+#include "lockfile.h"
+#include "pack.h"
+#include "trace.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define OBJECT_HEADER_MAX 32
+
+const char *object_type_name(ObjectType type) {
+  switch (type) {
+  case OBJ_BLOB:
+    return "blob";
+  case OBJ_COMMIT:
+    return "commit";
+  case OBJ_TREE:
+    return "tree";
+  default:
+    return NULL;
+  }
+}
+
+static ObjectType object_type_from_name(const char *name, size_t len) {
+  if (len == 4 && memcmp(name, "blob", 4) == 0)
+    return OBJ_BLOB;
+  if (len == 6 && memcmp(name, "commit", 6) == 0)
+    return OBJ_COMMIT;
+  if (len == 4 && memcmp(name, "tree", 4) == 0)
+    return OBJ_TREE;
+  return OBJ_NONE;
+}
+
+void object_path(const ObjectId *oid, char *out, size_t out_size) {
+  char hex[OID_HEX_SIZE + 1];
+  oid_to_hex(oid, hex);
+  snprintf(out, out_size, OBJECTS_DIR "/%.2s/%s", hex, hex + 2);
+}
+
+// In batch fsync mode a new object is first renamed into a staging
+// directory private to this process, and moved to its content address by
+// the next barrier, once its contents are on disk. A crash can then leave
+// a torn object only in a staging directory, where nothing looks for it.
+static char staging_dir[64];
+static atomic_int staging_ready;
+static ObjectId *staged;
+static size_t staged_count, staged_cap;
+static pthread_mutex_t staging_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void staged_path(const ObjectId *oid, char *out, size_t out_size) {
+  char hex[OID_HEX_SIZE + 1];
+  oid_to_hex(oid, hex);
+  snprintf(out, out_size, "%s/%s", staging_dir, hex);
+}
+
+// Path of a loose object, which may still be staged. -1 if there is none.
+static int find_loose_object(const ObjectId *oid, char *out, size_t out_size) {
+  object_path(oid, out, out_size);
+  if (access(out, F_OK) == 0)
+    return 0;
+  if (!atomic_load(&staging_ready))
+    return -1;
+  staged_path(oid, out, out_size);
+  return access(out, F_OK) == 0 ? 0 : -1;
+}
+
+// Move the staged objects to their content addresses; run by each barrier.
+// Objects that cannot be moved stay staged.
+static int publish_staged_objects(void) {
+  int ret = 0;
+  size_t kept = 0;
+  pthread_mutex_lock(&staging_lock);
+  for (size_t i = 0; i < staged_count; i++) {
+    char from[256], dir[256], to[256];
+    staged_path(&staged[i], from, sizeof(from));
+    snprintf(dir, sizeof(dir), OBJECTS_DIR "/%02x", staged[i].hash[0]);
+    object_path(&staged[i], to, sizeof(to));
+    if ((mkdir(dir, 0755) != 0 && errno != EEXIST) || rename(from, to) != 0) {
+      staged[kept++] = staged[i];
+      ret = -1;
+      continue;
+    }
+    fsync_renamed(to);
+  }
+  staged_count = kept;
+  pthread_mutex_unlock(&staging_lock);
+  return ret;
+}
+
+// Objects still staged at exit were never covered by a barrier, so nothing
+// written refers to them.
+static void remove_staging_dir(void) {
+  char path[256];
+  for (size_t i = 0; i < staged_count; i++) {
+    staged_path(&staged[i], path, sizeof(path));
+    unlink(path);
+  }
+  rmdir(staging_dir);
+}
+
+static int open_staging_dir(void) {
+  if (atomic_load(&staging_ready))
+    return 0;
+  snprintf(staging_dir, sizeof(staging_dir), OBJECTS_DIR "/incoming_XXXXXX");
+  if (!mkdtemp(staging_dir))
+    return -1;
+  fsync_after_barrier(publish_staged_objects);
+  atexit(remove_staging_dir);
+  atomic_store(&staging_ready, 1);
+  return 0;
+}
+
+static int grow_staged(void) {
+  if (staged_count < staged_cap)
+    return 0;
+  size_t cap = staged_cap ? staged_cap * 2 : 256;
+  ObjectId *grown = realloc(staged, cap * sizeof(ObjectId));
+  if (!grown)
+    return -1;
+  staged = grown;
+  staged_cap = cap;
+  return 0;
+}
+
+// Rename a finished object into the staging directory, unless a copy of
+// it is already stored or staged.
+static int stage_object(const char *tmp_path, const ObjectId *oid) {
+  char path[256];
+  int ret = 0;
+  pthread_mutex_lock(&staging_lock);
+  if (open_staging_dir() != 0 || grow_staged() != 0) {
+    ret = -1;
+  } else if (find_loose_object(oid, path, sizeof(path)) == 0) {
+    unlink(tmp_path);
+  } else {
+    staged_path(oid, path, sizeof(path));
+    if (rename(tmp_path, path) != 0) {
+      ret = -1;
+    } else {
+      staged[staged_count++] = *oid;
+      trace_count(TRACE_OBJECTS_WRITTEN, 1);
+    }
+  }
+  pthread_mutex_unlock(&staging_lock);
+  if (ret != 0)
+    unlink(tmp_path);
+  return ret;
+}
+
+int object_exists(const ObjectId *oid) {
+  if (pack_has_object(oid))
+    return 1;
+
+  char path[256];
+  return find_loose_object(oid, path, sizeof(path)) == 0;
+}
+
+static int format_header(ObjectType type, size_t len, char *out) {
+  return snprintf(out, OBJECT_HEADER_MAX, "%s %zu", object_type_name(type),
+                  len) + 1; // the NUL is part of the header
+}
+
+// Streams an object into a temporary file and moves it into place.
+typedef struct ObjectWriter {
+  int fd;
+  char tmp_path[256];
+  z_stream zs;
+  int hashing; // 0 when the caller already knows the object's ID
+  HashContext hash;
+  unsigned char out[HASH_STREAM_BUFSZ];
+} ObjectWriter;
+
+static int writer_flush(ObjectWriter *w, int flush) {
+  int ret;
+  do {
+    w->zs.next_out = w->out;
+    w->zs.avail_out = sizeof(w->out);
+    ret = deflate(&w->zs, flush);
+    if (ret == Z_STREAM_ERROR) {
+      errno = EIO;
+      return -1;
+    }
+    size_t have = sizeof(w->out) - w->zs.avail_out;
+    size_t off = 0;
+    while (off < have) {
+      ssize_t n = write(w->fd, w->out + off, have - off);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+      off += (size_t)n;
+    }
+  } while (w->zs.avail_out == 0);
+  return flush == Z_FINISH && ret != Z_STREAM_END ? -1 : 0;
+}
+
+static int writer_open(ObjectWriter *w, int hashing) {
+  snprintf(w->tmp_path, sizeof(w->tmp_path), OBJECTS_DIR "/tmp_obj_XXXXXX");
+  w->fd = mkstemp(w->tmp_path);
+  if (w->fd < 0)
+    return -1;
+  memset(&w->zs, 0, sizeof(w->zs));
+  if (deflateInit(&w->zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+    close(w->fd);
+    unlink(w->tmp_path);
+    return -1;
+  }
+  w->hashing = hashing;
+  if (hashing && hash_init(&w->hash) != 0) {
+    deflateEnd(&w->zs);
+    close(w->fd);
+    unlink(w->tmp_path);
+    return -1;
+  }
+  return 0;
+}
+
+static int writer_add(ObjectWriter *w, const void *data, size_t len) {
+  if (w->hashing)
+    hash_update(&w->hash, data, len);
+  w->zs.next_in = (unsigned char *)data;
+  w->zs.avail_in = (uInt)len;
+  return writer_flush(w, Z_NO_FLUSH);
+}
+
+static void writer_abort(ObjectWriter *w) {
+  if (w->hashing)
+    hash_discard(&w->hash);
+  deflateEnd(&w->zs);
+  close(w->fd);
+  unlink(w->tmp_path);
+}
+
+// Finish the stream and rename it to its content address. A hashing writer
+// discards the object if the content hashed differently from expected (the
+// source changed under us); otherwise expected is the object's ID.
+static int writer_commit(ObjectWriter *w, const ObjectId *expected) {
+  ObjectId oid;
+  if (writer_flush(w, Z_FINISH) != 0) {
+    writer_abort(w);
+    return -1;
+  }
+  if (w->hashing)
+    hash_final(&w->hash, &oid);
+  else
+    oid = *expected;
+  deflateEnd(&w->zs);
+  fchmod(w->fd, 0444);
+  int synced = fsync_written(w->fd) == 0;
+  if (close(w->fd) != 0 || !synced) {
+    unlink(w->tmp_path);
+    return -1;
+  }
+
+  if (expected && !oid_eq(expected, &oid)) {
+    unlink(w->tmp_path);
+    errno = EAGAIN;
+    return -1;
+  }
+
+  if (fsync_mode() == FSYNC_BATCH)
+    return stage_object(w->tmp_path, &oid);
+
+  char dir[256], path[256];
+  snprintf(dir, sizeof(dir), OBJECTS_DIR "/%02x", oid.hash[0]);
+  object_path(&oid, path, sizeof(path));
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    unlink(w->tmp_path);
+    return -1;
+  }
+  // Another writer may have stored the same content; either copy is fine
+  if (access(path, F_OK) == 0) {
+    unlink(w->tmp_path);
+  } else if (rename(w->tmp_path, path) != 0) {
+    unlink(w->tmp_path);
+    return -1;
+  } else {
+    fsync_renamed(path);
+    trace_count(TRACE_OBJECTS_WRITTEN, 1);
+  }
+  return 0;
+}
+
+// Compress an in-memory object whose ID is already known into the store.
+static int store_object(const ObjectId *oid, const void *header,
+                        size_t header_len, const void *data, size_t len) {
+  ObjectWriter *w = malloc(sizeof(ObjectWriter));
+  if (!w || writer_open(w, 0) != 0) {
+    free(w);
+    return -1;
+  }
+  uint64_t trace_start = trace_begin();
+  int ret = -1;
+  if (writer_add(w, header, header_len) != 0 || writer_add(w, data, len) != 0)
+    writer_abort(w);
+  else
+    ret = writer_commit(w, oid);
+  trace_end(TRACE_OBJECT_WRITE, trace_start);
+  free(w);
+  return ret;
+}
+
+// Store an in-memory object unless it is already present. Returns 0 and
+// fills oid_out on success, -1 on failure.
+int write_object(ObjectType type, const void *data, size_t len,
+                 ObjectId *oid_out) {
+  char header[OBJECT_HEADER_MAX];
+  int header_len = format_header(type, len, header);
+
+  ObjectId oid;
+  HashContext ctx;
+  if (hash_init(&ctx) != 0)
+    return -1;
+  hash_update(&ctx, header, header_len);
+  hash_update(&ctx, data, len);
+  hash_final(&ctx, &oid);
+
+  if (!object_exists(&oid) &&
+      store_object(&oid, header, header_len, data, len) != 0)
+    return -1;
+
+  *oid_out = oid;
+  return 0;
+}
+
+// Fails with ELOOP for a symlink, whose blob is its target instead.
+static int open_blob_source(const char *path, off_t *size) {
+  int fd = open(path, O_RDONLY | O_NOFOLLOW);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  *size = st.st_size;
+  return fd;
+}
+
+// Feed the blob header and the file contents to fn in fixed-size chunks.
+// Fails if the file does not hold exactly the size it had when opened.
+static int stream_blob(int fd, off_t size, int (*fn)(void *, const void *, size_t),
+                       void *arg) {
+  char header[OBJECT_HEADER_MAX];
+  int header_len = format_header(OBJ_BLOB, (size_t)size, header);
+  if (fn(arg, header, header_len) != 0)
+    return -1;
+
+  char buf[HASH_STREAM_BUFSZ];
+  off_t total = 0;
+  for (;;) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    total += n;
+    if (total > size)
+      break;
+    if (fn(arg, buf, (size_t)n) != 0)
+      return -1; // with fn's errno
+  }
+  if (total != size) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return 0;
+}
+
+static int hash_chunk(void *arg, const void *data, size_t len) {
+  hash_update(arg, data, len);
+  return 0;
+}
+
+static int write_chunk(void *arg, const void *data, size_t len) {
+  return writer_add(arg, data, len);
+}
+
+// A symlink is stored as a blob holding its target, as git does, and
+// never followed.
+static int link_blob(const char *path, ObjectId *oid_out, int store) {
+  char target[PATH_MAX];
+  ssize_t n = readlink(path, target, sizeof(target));
+  if (n < 0)
+    return -1;
+  if ((size_t)n == sizeof(target)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  if (store)
+    return write_object(OBJ_BLOB, target, (size_t)n, oid_out);
+
+  char header[OBJECT_HEADER_MAX];
+  int header_len = format_header(OBJ_BLOB, (size_t)n, header);
+  HashContext ctx;
+  if (hash_init(&ctx) != 0)
+    return -1;
+  hash_update(&ctx, header, header_len);
+  hash_update(&ctx, target, (size_t)n);
+  hash_final(&ctx, oid_out);
+  return 0;
+}
+
+// Compute a file's blob ID without storing it, in constant memory.
+int hash_blob_file(const char *path, ObjectId *oid_out) {
+  off_t size;
+  int fd = open_blob_source(path, &size);
+  if (fd < 0)
+    return errno == ELOOP ? link_blob(path, oid_out, 0) : -1;
+
+  HashContext ctx;
+  if (hash_init(&ctx) != 0) {
+    close(fd);
+    return -1;
+  }
+  int ret = stream_blob(fd, size, hash_chunk, &ctx);
+  int saved = errno;
+  hash_final(&ctx, oid_out);
+  close(fd);
+  errno = saved;
+  return ret;
+}
+
+// Compress a file whose ID is already known into the store.
+static int store_blob_file(const char *path, ObjectId *oid_out) {
+  off_t size;
+  int fd = open_blob_source(path, &size);
+  if (fd < 0)
+    return errno == ELOOP ? link_blob(path, oid_out, 1) : -1;
+
+  ObjectWriter *w = malloc(sizeof(ObjectWriter));
+  if (!w || writer_open(w, 1) != 0) {
+    free(w);
+    close(fd);
+    return -1;
+  }
+  if (stream_blob(fd, size, write_chunk, w) != 0) {
+    int saved = errno;
+    writer_abort(w);
+    free(w);
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  close(fd);
+
+  // The file must still hash to the ID we are about to store it under
+  int ret = writer_commit(w, oid_out);
+  free(w);
+  return ret;
+}
+
+// Hash a file and store it as a compressed blob if it is not already in
+// the object store. Memory use does not depend on the file size.
+int write_blob_file(const char *path, ObjectId *oid_out) {
+  if (hash_blob_file(path, oid_out) != 0)
+    return -1;
+  if (object_exists(oid_out))
+    return 0;
+
+  uint64_t trace_start = trace_begin();
+  int ret = store_blob_file(path, oid_out);
+  trace_end(TRACE_OBJECT_WRITE, trace_start);
+  return ret;
+}
+
+// Read exactly size bytes, failing if the file is shorter.
+static int read_blob_source(int fd, char *out, off_t size) {
+  off_t total = 0;
+  while (total < size) {
+    ssize_t n = read(fd, out + total, (size_t)(size - total));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    total += n;
+  }
+  if (total != size) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return 0;
+}
+
+// write_blob_file() for count files at once. Files up to BLOB_BATCH_MAX
+// bytes are read into memory and hashed together with hash_buffers();
+// larger ones are streamed. errors[i] is 0 or the errno for paths[i].
+void write_blob_files(const char *const *paths, size_t count,
+                      ObjectId *oids_out, int *errors) {
+  char **contents = calloc(count ? count : 1, sizeof(char *));
+  char(*headers)[OBJECT_HEADER_MAX] = malloc((count ? count : 1) *
+                                             OBJECT_HEADER_MAX);
+  const void **objects = malloc((count ? count : 1) * sizeof(void *));
+  size_t *lens = malloc((count ? count : 1) * sizeof(size_t));
+  size_t *which = malloc((count ? count : 1) * sizeof(size_t));
+  ObjectId *oids = malloc((count ? count : 1) * sizeof(ObjectId));
+  int batching = contents && headers && objects && lens && which && oids;
+
+  // Each file is read in just after room for its header, giving the form
+  // that is hashed and stored
+  size_t batched = 0;
+  for (size_t i = 0; i < count; i++) {
+    errors[i] = 0;
+    off_t size;
+    int fd = batching ? open_blob_source(paths[i], &size) : -1;
+    if (fd >= 0 && size <= BLOB_BATCH_MAX) {
+      int header_len = format_header(OBJ_BLOB, (size_t)size, headers[i]);
+      char *data = malloc((size_t)header_len + (size_t)size);
+      if (!data || read_blob_source(fd, data + header_len, size) != 0) {
+        errors[i] = data ? errno : ENOMEM;
+        free(data);
+        close(fd);
+        continue;
+      }
+      close(fd);
+      memcpy(data, headers[i], header_len);
+      contents[i] = data;
+      objects[batched] = data;
+      lens[batched] = (size_t)header_len + (size_t)size;
+      which[batched++] = i;
+      continue;
+    }
+    if (fd >= 0)
+      close(fd);
+    if (write_blob_file(paths[i], &oids_out[i]) != 0)
+      errors[i] = errno ? errno : EIO;
+  }
+
+  if (batched)
+    hash_buffers(objects, lens, oids, batched);
+  for (size_t k = 0; k < batched; k++) {
+    size_t i = which[k];
+    size_t header_len = strlen(headers[i]) + 1;
+    oids_out[i] = oids[k];
+    if (!object_exists(&oids[k]) &&
+        store_object(&oids[k], contents[i], header_len,
+                     contents[i] + header_len, lens[k] - header_len) != 0)
+      errors[i] = errno ? errno : EIO;
+    free(contents[i]);
+  }
+
+  free(contents);
+  free(headers);
+  free(objects);
+  free(lens);
+  free(which);
+  free(oids);
+}
+
+static int read_loose_object(const ObjectId *oid, ObjectType *type,
+                             char **data, size_t *len) {
+  char path[256];
+  if (find_loose_object(oid, path, sizeof(path)) != 0)
+    return -1;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK) {
+    close(fd);
+    return -1;
+  }
+
+  unsigned char in[HASH_STREAM_BUFSZ];
+  char header[OBJECT_HEADER_MAX];
+  size_t header_len = 0;
+  char *buf = NULL;
+  size_t size = 0, have = 0;
+  ObjectType obj_type = OBJ_NONE;
+  int ret = Z_OK, failed = 0;
+
+  // First inflate just the header, then the body straight into place
+  zs.next_out = (unsigned char *)header;
+  zs.avail_out = sizeof(header);
+  while (!failed && ret != Z_STREAM_END) {
+    if (zs.avail_in == 0) {
+      ssize_t n = read(fd, in, sizeof(in));
+      if (n <= 0) {
+        failed = 1;
+        break;
+      }
+      zs.next_in = in;
+      zs.avail_in = (uInt)n;
+    }
+    ret = inflate(&zs, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+      failed = 1;
+      break;
+    }
+
+    if (!buf) {
+      header_len = sizeof(header) - zs.avail_out;
+      char *nul = memchr(header, '\0', header_len);
+      if (!nul) {
+        if (header_len == sizeof(header))
+          failed = 1;
+        continue;
+      }
+      char *space = memchr(header, ' ', nul - header);
+      if (!space) {
+        failed = 1;
+        break;
+      }
+      obj_type = object_type_from_name(header, space - header);
+      size = strtoull(space + 1, NULL, 10);
+      if (size >= UINT_MAX) {
+        failed = 1; // too large to inflate in one piece
+        break;
+      }
+      buf = malloc(size + 1);
+      if (obj_type == OBJ_NONE || !buf) {
+        failed = 1;
+        break;
+      }
+      // Body bytes that arrived together with the header
+      have = header_len - (nul + 1 - header);
+      if (have > size) {
+        failed = 1;
+        break;
+      }
+      memcpy(buf, nul + 1, have);
+      zs.next_out = (unsigned char *)buf + have;
+      zs.avail_out = (uInt)(size + 1 - have);
+    } else {
+      // One spare byte of room lets an oversized object show up as such
+      have = size + 1 - zs.avail_out;
+      if (zs.avail_out == 0)
+        failed = 1;
+    }
+  }
+  inflateEnd(&zs);
+  close(fd);
+
+  if (failed || !buf || have != size) {
+    free(buf);
+    return -1;
+  }
+
+  buf[size] = '\0';
+  if (type)
+    *type = obj_type;
+  *data = buf;
+  if (len)
+    *len = size;
+  return 0;
+}
+
+// Inflate a loose object into fd a buffer at a time. Nothing is written
+// unless its header names the expected type.
+static int stream_loose_object(const ObjectId *oid, ObjectType type, int fd) {
+  char path[256];
+  if (find_loose_object(oid, path, sizeof(path)) != 0)
+    return -1;
+
+  int in_fd = open(path, O_RDONLY);
+  if (in_fd < 0)
+    return -1;
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK) {
+    close(in_fd);
+    return -1;
+  }
+
+  unsigned char in[HASH_STREAM_BUFSZ], out[HASH_STREAM_BUFSZ];
+  char header[OBJECT_HEADER_MAX];
+  size_t header_len = 0, size = 0, written = 0;
+  int in_header = 1, ret = Z_OK, failed = 0;
+  while (!failed && ret != Z_STREAM_END) {
+    if (zs.avail_in == 0) {
+      ssize_t n = read(in_fd, in, sizeof(in));
+      if (n <= 0) {
+        failed = 1;
+        break;
+      }
+      zs.next_in = in;
+      zs.avail_in = (uInt)n;
+    }
+    zs.next_out = out;
+    zs.avail_out = sizeof(out);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+      failed = 1;
+      break;
+    }
+
+    unsigned char *body = out;
+    size_t n = sizeof(out) - zs.avail_out;
+    if (in_header) {
+      // The header may arrive split across several inflate calls
+      unsigned char *nul = memchr(out, '\0', n);
+      size_t take = nul ? (size_t)(nul - out) + 1 : n;
+      if (header_len + take > sizeof(header)) {
+        failed = 1;
+        break;
+      }
+      memcpy(header + header_len, out, take);
+      header_len += take;
+      if (!nul)
+        continue;
+      char *space = memchr(header, ' ', header_len);
+      if (!space ||
+          object_type_from_name(header, space - header) != type) {
+        failed = 1;
+        break;
+      }
+      size = strtoull(space + 1, NULL, 10);
+      in_header = 0;
+      body += take;
+      n -= take;
+    }
+    if (written + n > size || write_fully(fd, body, n) != 0)
+      failed = 1;
+    written += n;
+  }
+  inflateEnd(&zs);
+  close(in_fd);
+  return failed || in_header || written != size ? -1 : 0;
+}
+
+// Write an object of the given type to fd without holding all of it in
+// memory, for blobs too large to read whole. Fails, having written
+// nothing, if the object is of another type.
+int read_object_to_fd(const ObjectId *oid, ObjectType type, int fd) {
+  uint64_t trace_start = trace_begin();
+  int ret = pack_has_object(oid) ? pack_read_object_to_fd(oid, type, fd)
+                                 : stream_loose_object(oid, type, fd);
+  if (ret == 0)
+    trace_count(TRACE_OBJECTS_READ, 1);
+  trace_end(TRACE_OBJECT_READ, trace_start);
+  return ret;
+}
+
+// Load an object into a malloc'd buffer, looking in packs before loose
+// objects. Returns 0 on success with *data NUL-terminated for convenience,
+// -1 if missing or corrupt.
+int read_object(const ObjectId *oid, ObjectType *type, char **data,
+                size_t *len) {
+  uint64_t trace_start = trace_begin();
+  int ret = pack_read_object(oid, type, data, len);
+  if (ret != 0)
+    ret = read_loose_object(oid, type, data, len);
+  if (ret == 0)
+    trace_count(TRACE_OBJECTS_READ, 1);
+  trace_end(TRACE_OBJECT_READ, trace_start);
+  return ret;
+}
@@ -0,0 +1,910 @@
+#include "pack.h"
+#include "buffer.h"
+#include "lockfile.h"
+#include "utils.h"
+
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define PACK_HEADER_SIZE 12
+#define PACK_IDX_HEADER_SIZE 8
+// IDs and checksums have the repository's object format
+#define PACK_CHECKSUM_SIZE (hash_algo->rawsz)
+#define RAW_OID_SIZE (hash_algo->rawsz)
+
+// Object type codes as stored in pack entry headers
+#define PACK_OBJ_COMMIT 1
+#define PACK_OBJ_TREE 2
+#define PACK_OBJ_BLOB 3
+#define PACK_OBJ_OFS_DELTA 6
+
+#define DELTA_BLOCK 16
+#define DELTA_MAX_INSERT 127
+#define DELTA_MAX_COPY 0xffffff
+
+typedef struct Pack {
+    char name[OID_HEX_SIZE + 8];  // "pack-<hex>"
+    unsigned char* idx_map;
+    size_t idx_size;
+    unsigned char* pack_map;
+    size_t pack_size;
+    uint32_t count;
+    const unsigned char* fanout;
+    const unsigned char* oids;
+    const unsigned char* offsets;
+} Pack;
+
+static Pack* packs;
+static int pack_count;
+static pthread_once_t packs_once = PTHREAD_ONCE_INIT;
+
+static void put_be32(unsigned char* p, uint32_t v) {
+    v = htobe32(v);
+    memcpy(p, &v, 4);
+}
+
+static void put_be64(unsigned char* p, uint64_t v) {
+    v = htobe64(v);
+    memcpy(p, &v, 8);
+}
+
+static uint32_t get_be32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return be32toh(v);
+}
+
+static uint64_t get_be64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return be64toh(v);
+}
+
+static int pack_type_code(ObjectType type) {
+    switch (type) {
+        case OBJ_COMMIT: return PACK_OBJ_COMMIT;
+        case OBJ_TREE: return PACK_OBJ_TREE;
+        case OBJ_BLOB: return PACK_OBJ_BLOB;
+        default: return 0;
+    }
+}
+
+static ObjectType object_type_from_pack(int code) {
+    switch (code) {
+        case PACK_OBJ_COMMIT: return OBJ_COMMIT;
+        case PACK_OBJ_TREE: return OBJ_TREE;
+        case PACK_OBJ_BLOB: return OBJ_BLOB;
+        default: return OBJ_NONE;
+    }
+}
+
+static void* map_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void* map = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) map = NULL;
+        else *size = st.st_size;
+    }
+    close(fd);
+    return map;
+}
+
+// Map a pack and its index and check that they belong together.
+static int open_pack(Pack* p, const char* name) {
+    char path[512];
+    memset(p, 0, sizeof(Pack));
+    snprintf(p->name, sizeof(p->name), "%s", name);
+
+    snprintf(path, sizeof(path), PACK_DIR "/%s.idx", name);
+    p->idx_map = map_file(path, &p->idx_size);
+    snprintf(path, sizeof(path), PACK_DIR "/%s.pack", name);
+    p->pack_map = map_file(path, &p->pack_size);
+    if (!p->idx_map || !p->pack_map) goto fail;
+
+    size_t min_idx = PACK_IDX_HEADER_SIZE + 256 * 4 + 2 * PACK_CHECKSUM_SIZE;
+    if (p->idx_size < min_idx ||
+        get_be32(p->idx_map) != PACK_IDX_SIGNATURE ||
+        get_be32(p->idx_map + 4) != PACK_IDX_VERSION)
+        goto fail;
+
+    p->fanout = p->idx_map + PACK_IDX_HEADER_SIZE;
+    p->count = get_be32(p->fanout + 255 * 4);
+    p->oids = p->fanout + 256 * 4;
+    p->offsets = p->oids + (size_t)p->count * RAW_OID_SIZE;
+    if (p->idx_size != min_idx + (size_t)p->count * (RAW_OID_SIZE + 8))
+        goto fail;
+
+    if (p->pack_size < PACK_HEADER_SIZE + PACK_CHECKSUM_SIZE ||
+        get_be32(p->pack_map) != PACK_SIGNATURE ||
+        get_be32(p->pack_map + 4) != PACK_VERSION ||
+        get_be32(p->pack_map + 8) != p->count)
+        goto fail;
+
+    // The idx records the checksum of the pack it was built for
+    const unsigned char* idx_pack_sum = p->idx_map + p->idx_size - 2 * PACK_CHECKSUM_SIZE;
+    if (memcmp(idx_pack_sum, p->pack_map + p->pack_size - PACK_CHECKSUM_SIZE,
+               PACK_CHECKSUM_SIZE) != 0)
+        goto fail;
+    return 0;
+
+fail:
+    fprintf(stderr, "Ignoring unusable pack %s\n", name);
+    if (p->idx_map) munmap(p->idx_map, p->idx_size);
+    if (p->pack_map) munmap(p->pack_map, p->pack_size);
+    return -1;
+}
+
+static void load_packs(void) {
+    DIR* dir = opendir(PACK_DIR);
+    if (!dir) return;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 5 || len - 4 >= OID_HEX_SIZE + 8 || strcmp(entry->d_name + len - 4, ".idx") != 0)
+            continue;
+
+        Pack* grown = realloc(packs, (pack_count + 1) * sizeof(Pack));
+        if (!grown) break;
+        packs = grown;
+
+        char name[OID_HEX_SIZE + 8];
+        memcpy(name, entry->d_name, len - 4);
+        name[len - 4] = '\0';
+        if (open_pack(&packs[pack_count], name) == 0)
+            pack_count++;
+    }
+    closedir(dir);
+}
+
+static void prepare_packs(void) {
+    pthread_once(&packs_once, load_packs);
+}
+
+// Binary search one pack's index, narrowed by the fan-out table.
+static int find_in_pack(const Pack* p, const unsigned char* oid, uint64_t* offset) {
+    uint32_t lo = oid[0] ? get_be32(p->fanout + (oid[0] - 1) * 4) : 0;
+    uint32_t hi = get_be32(p->fanout + oid[0] * 4);
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(p->oids + (size_t)mid * RAW_OID_SIZE, oid, RAW_OID_SIZE);
+        if (cmp == 0) {
+            *offset = get_be64(p->offsets + (size_t)mid * 8);
+            return 0;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+static const Pack* find_pack_entry(const ObjectId* oid, uint64_t* offset) {
+    prepare_packs();
+    for (int i = 0; i < pack_count; i++) {
+        if (find_in_pack(&packs[i], oid->hash, offset) == 0)
+            return &packs[i];
+    }
+    return NULL;
+}
+
+int pack_has_object(const ObjectId* oid) {
+    uint64_t offset;
+    return find_pack_entry(oid, &offset) != NULL;
+}
+
+// Inflate exactly size bytes of zlib data starting at pos in the pack.
+static char* inflate_at(const Pack* p, size_t pos, size_t size) {
+    size_t end = p->pack_size - PACK_CHECKSUM_SIZE;
+    if (pos >= end || size >= UINT32_MAX) return NULL;
+
+    char* buf = malloc(size + 1);
+    if (!buf) return NULL;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) != Z_OK) {
+        free(buf);
+        return NULL;
+    }
+    zs.next_in = (unsigned char*)p->pack_map + pos;
+    zs.avail_in = (uInt)((end - pos) > UINT32_MAX ? UINT32_MAX : end - pos);
+    zs.next_out = (unsigned char*)buf;
+    zs.avail_out = (uInt)(size + 1);
+    int ret = inflate(&zs, Z_FINISH);
+    size_t produced = size + 1 - zs.avail_out;
+    inflateEnd(&zs);
+
+    if (ret != Z_STREAM_END || produced != size) {
+        free(buf);
+        return NULL;
+    }
+    buf[size] = '\0';
+    return buf;
+}
+
+// Inflate exactly size bytes of zlib data starting at pos in the pack
+// into fd, a buffer at a time.
+static int inflate_to_fd(const Pack* p, size_t pos, size_t size, int fd) {
+    size_t end = p->pack_size - PACK_CHECKSUM_SIZE;
+    if (pos >= end) return -1;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) != Z_OK) return -1;
+    zs.next_in = (unsigned char*)p->pack_map + pos;
+    zs.avail_in = (uInt)((end - pos) > UINT32_MAX ? UINT32_MAX : end - pos);
+
+    unsigned char out[HASH_STREAM_BUFSZ];
+    size_t written = 0;
+    int ret = Z_OK, failed = 0;
+    while (!failed && ret != Z_STREAM_END) {
+        zs.next_out = out;
+        zs.avail_out = sizeof(out);
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            failed = 1;
+            break;
+        }
+        size_t n = sizeof(out) - zs.avail_out;
+        if (written + n > size || write_fully(fd, out, n) != 0) failed = 1;
+        written += n;
+    }
+    inflateEnd(&zs);
+    return failed || written != size ? -1 : 0;
+}
+
+static int read_varint_size(const unsigned char** p, const unsigned char* end, size_t* out) {
+    size_t v = 0;
+    int shift = 0;
+    unsigned char c;
+    do {
+        if (*p >= end || shift > 56) return -1;
+        c = *(*p)++;
+        v |= (size_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    *out = v;
+    return 0;
+}
+
+// Rebuild an object from its base and a git-style delta.
+static char* apply_delta(const char* base, size_t base_len,
+                         const unsigned char* delta, size_t delta_len,
+                         size_t* out_len) {
+    const unsigned char* p = delta;
+    const unsigned char* end = delta + delta_len;
+    size_t src_size, dst_size;
+    if (read_varint_size(&p, end, &src_size) != 0 || src_size != base_len ||
+        read_varint_size(&p, end, &dst_size) != 0)
+        return NULL;
+
+    char* out = malloc(dst_size + 1);
+    if (!out) return NULL;
+
+    size_t pos = 0;
+    while (p < end) {
+        unsigned char cmd = *p++;
+        if (cmd & 0x80) {
+            size_t off = 0, len = 0;
+            for (int i = 0; i < 4; i++)
+                if (cmd & (1 << i)) {
+                    if (p >= end) goto corrupt;
+                    off |= (size_t)*p++ << (8 * i);
+                }
+            for (int i = 0; i < 3; i++)
+                if (cmd & (0x10 << i)) {
+                    if (p >= end) goto corrupt;
+                    len |= (size_t)*p++ << (8 * i);
+                }
+            if (len == 0) len = 0x10000;
+            if (off + len > base_len || pos + len > dst_size) goto corrupt;
+            memcpy(out + pos, base + off, len);
+            pos += len;
+        } else if (cmd) {
+            if (p + cmd > end || pos + cmd > dst_size) goto corrupt;
+            memcpy(out + pos, p, cmd);
+            p += cmd;
+            pos += cmd;
+        } else {
+            goto corrupt;
+        }
+    }
+    if (pos != dst_size) goto corrupt;
+
+    out[dst_size] = '\0';
+    *out_len = dst_size;
+    return out;
+
+corrupt:
+    free(out);
+    return NULL;
+}
+
+// Parse the type/size header of the entry at offset. *data_pos is where
+// its zlib data (or, for a delta, its base offset) starts.
+static int read_entry_header(const Pack* p, uint64_t offset, int* code,
+                             size_t* size, const unsigned char** data_pos) {
+    const unsigned char* pos = p->pack_map + offset;
+    const unsigned char* end = p->pack_map + p->pack_size - PACK_CHECKSUM_SIZE;
+    if (offset < PACK_HEADER_SIZE || pos >= end) return -1;
+
+    unsigned char c = *pos++;
+    *code = (c >> 4) & 7;
+    *size = c & 15;
+    int shift = 4;
+    while (c & 0x80) {
+        if (pos >= end || shift > 56) return -1;
+        c = *pos++;
+        *size |= (size_t)(c & 0x7f) << shift;
+        shift += 7;
+    }
+    *data_pos = pos;
+    return 0;
+}
+
+static int unpack_entry(const Pack* p, uint64_t offset, int depth,
+                        int* type, char** data, size_t* len) {
+    const unsigned char* pos;
+    const unsigned char* end = p->pack_map + p->pack_size - PACK_CHECKSUM_SIZE;
+    int code;
+    size_t size;
+    if (depth > PACK_MAX_DELTA_DEPTH || read_entry_header(p, offset, &code, &size, &pos) != 0)
+        return -1;
+
+    if (code != PACK_OBJ_OFS_DELTA) {
+        *data = inflate_at(p, pos - p->pack_map, size);
+        if (!*data) return -1;
+        *type = code;
+        *len = size;
+        return 0;
+    }
+
+    if (pos >= end) return -1;
+    unsigned char c = *pos++;
+    uint64_t rel = c & 127;
+    while (c & 128) {
+        if (pos >= end) return -1;
+        rel += 1;
+        c = *pos++;
+        rel = (rel << 7) + (c & 127);
+    }
+    if (rel == 0 || rel > offset) return -1;
+
+    char* delta = inflate_at(p, pos - p->pack_map, size);
+    if (!delta) return -1;
+
+    char* base;
+    size_t base_len;
+    if (unpack_entry(p, offset - rel, depth + 1, type, &base, &base_len) != 0) {
+        free(delta);
+        return -1;
+    }
+
+    *data = apply_delta(base, base_len, (unsigned char*)delta, size, len);
+    free(base);
+    free(delta);
+    return *data ? 0 : -1;
+}
+
+// Read an object from whichever pack holds it. Returns -1 if no pack has it.
+int pack_read_object(const ObjectId* oid, ObjectType* type, char** data, size_t* len) {
+    uint64_t offset;
+    const Pack* p = find_pack_entry(oid, &offset);
+    if (!p) return -1;
+
+    int code;
+    size_t size;
+    if (unpack_entry(p, offset, 0, &code, data, &size) != 0) {
+        char hex[OID_HEX_SIZE + 1];
+        fprintf(stderr, "Corrupt object %s in %s\n", oid_to_hex(oid, hex), p->name);
+        return -1;
+    }
+    if (type) *type = object_type_from_pack(code);
+    if (len) *len = size;
+    return 0;
+}
+
+// Write a packed object of the given type to fd. An object stored whole
+// is inflated straight into fd; a delta is rebuilt in memory first, which
+// PACK_MAX_OBJECT_SIZE bounds. Nothing is written if the type differs.
+int pack_read_object_to_fd(const ObjectId* oid, ObjectType type, int fd) {
+    uint64_t offset;
+    const Pack* p = find_pack_entry(oid, &offset);
+    if (!p) return -1;
+
+    const unsigned char* pos;
+    int code;
+    size_t size;
+    if (read_entry_header(p, offset, &code, &size, &pos) != 0) return -1;
+    if (code != PACK_OBJ_OFS_DELTA) {
+        if (object_type_from_pack(code) != type) return -1;
+        return inflate_to_fd(p, pos - p->pack_map, size, fd);
+    }
+
+    char* data;
+    if (unpack_entry(p, offset, 0, &code, &data, &size) != 0) return -1;
+    int ret = object_type_from_pack(code) == type ? write_fully(fd, data, size) : -1;
+    free(data);
+    return ret;
+}
+
+/* ---- Writing packs ---- */
+
+static int delta_insert(Buffer* v, const unsigned char* data, size_t len) {
+    while (len > 0) {
+        unsigned char n = len > DELTA_MAX_INSERT ? DELTA_MAX_INSERT : (unsigned char)len;
+        if (buffer_put(v, &n, 1) != 0 || buffer_put(v, data, n) != 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int delta_copy(Buffer* v, size_t off, size_t len) {
+    while (len > 0) {
+        size_t n = len > DELTA_MAX_COPY ? DELTA_MAX_COPY : len;
+        unsigned char op[8];
+        int k = 1;
+        op[0] = 0x80;
+        for (int i = 0; i < 4; i++) {
+            unsigned char b = (off >> (8 * i)) & 0xff;
+            if (b) {
+                op[0] |= 1 << i;
+                op[k++] = b;
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            unsigned char b = (n >> (8 * i)) & 0xff;
+            if (b) {
+                op[0] |= 0x10 << i;
+                op[k++] = b;
+            }
+        }
+        if (buffer_put(v, op, k) != 0) return -1;
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static uint32_t block_hash(const unsigned char* p) {
+    uint64_t a, b;
+    memcpy(&a, p, 8);
+    memcpy(&b, p + 8, 8);
+    uint64_t h = (a * 0x9E3779B97F4A7C15ull) ^ (b * 0xC2B2AE3D27D4EB4Full);
+    return (uint32_t)(h >> 32);
+}
+
+// Encode target as copies from base plus literal inserts. Gives up and
+// returns -1 once the delta would exceed max_len bytes.
+static int create_delta(const unsigned char* base, size_t base_len,
+                        const unsigned char* target, size_t target_len,
+                        size_t max_len, Buffer* out) {
+    buffer_reset(out);
+    if (base_len < DELTA_BLOCK || target_len < DELTA_BLOCK) return -1;
+
+    size_t blocks = base_len / DELTA_BLOCK;
+    size_t buckets = 1;
+    while (buckets < blocks * 2) buckets <<= 1;
+    int64_t* table = malloc(buckets * sizeof(int64_t));
+    if (!table) return -1;
+    for (size_t i = 0; i < buckets; i++) table[i] = -1;
+    // Walk backwards so the earliest block wins each bucket
+    for (size_t b = blocks; b-- > 0;)
+        table[block_hash(base + b * DELTA_BLOCK) & (buckets - 1)] = (int64_t)(b * DELTA_BLOCK);
+
+    int ret = -1;
+    if (buffer_put_varint(out, base_len) != 0 || buffer_put_varint(out, target_len) != 0)
+        goto done;
+
+    size_t insert_from = 0, i = 0;
+    while (i + DELTA_BLOCK <= target_len) {
+        int64_t cand = table[block_hash(target + i) & (buckets - 1)];
+        if (cand < 0 || memcmp(base + cand, target + i, DELTA_BLOCK) != 0) {
+            i++;
+            continue;
+        }
+
+        size_t src = (size_t)cand, len = DELTA_BLOCK;
+        while (src + len < base_len && i + len < target_len &&
+               base[src + len] == target[i + len])
+            len++;
+        // Grow the match backwards over bytes we were about to insert
+        while (i > insert_from && src > 0 && base[src - 1] == target[i - 1]) {
+            i--;
+            src--;
+            len++;
+        }
+
+        if (delta_insert(out, target + insert_from, i - insert_from) != 0 ||
+            delta_copy(out, src, len) != 0)
+            goto done;
+        i += len;
+        insert_from = i;
+        if (out->len >= max_len) goto done;
+    }
+    if (delta_insert(out, target + insert_from, target_len - insert_from) != 0)
+        goto done;
+    ret = out->len < max_len ? 0 : -1;
+
+done:
+    free(table);
+    return ret;
+}
+
+typedef struct PackObject {
+    ObjectId oid;
+    ObjectType type;
+    size_t size;
+    uint64_t offset;
+} PackObject;
+
+typedef struct WindowEntry {
+    PackObject* obj;
+    char* data;
+    size_t len;
+    int depth;
+} WindowEntry;
+
+typedef struct PackWriter {
+    FILE* file;
+    HashContext hash;
+    uint64_t offset;
+} PackWriter;
+
+static int pack_write(PackWriter* w, const void* data, size_t len) {
+    if (fwrite(data, 1, len, w->file) != len) return -1;
+    hash_update(&w->hash, data, len);
+    w->offset += len;
+    return 0;
+}
+
+static int pack_write_entry(PackWriter* w, int code, const void* data, size_t len,
+                            uint64_t base_rel) {
+    unsigned char header[24];
+    int n = 0;
+    size_t size = len;
+    unsigned char c = (unsigned char)((code << 4) | (size & 15));
+    size >>= 4;
+    while (size) {
+        header[n++] = c | 0x80;
+        c = size & 0x7f;
+        size >>= 7;
+    }
+    header[n++] = c;
+
+    if (code == PACK_OBJ_OFS_DELTA) {
+        unsigned char ofs[16];
+        int pos = sizeof(ofs) - 1;
+        ofs[pos] = base_rel & 127;
+        while (base_rel >>= 7)
+            ofs[--pos] = 128 | (--base_rel & 127);
+        memcpy(header + n, ofs + pos, sizeof(ofs) - pos);
+        n += sizeof(ofs) - pos;
+    }
+
+    uLongf zlen = compressBound(len);
+    unsigned char* z = malloc(zlen);
+    if (!z) return -1;
+    int ok = compress2(z, &zlen, data, len, Z_DEFAULT_COMPRESSION) == Z_OK &&
+             pack_write(w, header, n) == 0 && pack_write(w, z, zlen) == 0;
+    free(z);
+    return ok ? 0 : -1;
+}
+
+static int is_hex_name(const char* s, size_t len) {
+    if (strlen(s) != len) return 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return 0;
+    }
+    return 1;
+}
+
+static int add_candidate(PackObject** list, size_t* count, size_t* cap, const ObjectId* oid) {
+    if (*count == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 256;
+        PackObject* grown = realloc(*list, new_cap * sizeof(PackObject));
+        if (!grown) return -1;
+        *list = grown;
+        *cap = new_cap;
+    }
+    PackObject* obj = &(*list)[(*count)++];
+    memset(obj, 0, sizeof(PackObject));
+    obj->oid = *oid;
+    return 0;
+}
+
+// Every object we could pack: all loose objects and all packed ones.
+static int collect_objects(PackObject** list, size_t* count) {
+    size_t cap = 0;
+    *list = NULL;
+    *count = 0;
+
+    for (int i = 0; i < pack_count; i++) {
+        for (uint32_t k = 0; k < packs[i].count; k++) {
+            ObjectId oid = {{0}};
+            memcpy(oid.hash, packs[i].oids + (size_t)k * RAW_OID_SIZE, RAW_OID_SIZE);
+            if (add_candidate(list, count, &cap, &oid) != 0) return -1;
+        }
+    }
+
+    for (int fan = 0; fan < 256; fan++) {
+        char dir_path[256];
+        snprintf(dir_path, sizeof(dir_path), OBJECTS_DIR "/%02x", fan);
+        DIR* dir = opendir(dir_path);
+        if (!dir) continue;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (!is_hex_name(entry->d_name, hash_algo->hexsz - 2)) continue;
+            ObjectId oid = {{0}};
+            oid.hash[0] = (unsigned char)fan;
+            hex_to_bytes(entry->d_name, oid.hash + 1, RAW_OID_SIZE - 1);
+            if (add_candidate(list, count, &cap, &oid) != 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+    }
+    return 0;
+}
+
+static int compare_oid(const void* a, const void* b) {
+    return oid_cmp(&((const PackObject*)a)->oid, &((const PackObject*)b)->oid);
+}
+
+// Similar objects end up next to each other: same type, then by size,
+// largest first so deltas mostly remove data.
+static int compare_for_delta(const void* a, const void* b) {
+    const PackObject* x = *(const PackObject* const*)a;
+    const PackObject* y = *(const PackObject* const*)b;
+    if (x->type != y->type) return x->type < y->type ? -1 : 1;
+    if (x->size != y->size) return x->size > y->size ? -1 : 1;
+    return oid_cmp(&x->oid, &y->oid);
+}
+
+static int write_pack_idx(const char* tmp_path, PackObject* objs, size_t count,
+                          const unsigned char* pack_sum) {
+    qsort(objs, count, sizeof(PackObject), compare_oid);
+
+    size_t size = PACK_IDX_HEADER_SIZE + 256 * 4 + count * (RAW_OID_SIZE + 8) +
+                  2 * PACK_CHECKSUM_SIZE;
+    unsigned char* buf = calloc(1, size);
+    if (!buf) return -1;
+
+    put_be32(buf, PACK_IDX_SIGNATURE);
+    put_be32(buf + 4, PACK_IDX_VERSION);
+    unsigned char* fanout = buf + PACK_IDX_HEADER_SIZE;
+    unsigned char* oids = fanout + 256 * 4;
+    unsigned char* offsets = oids + count * RAW_OID_SIZE;
+
+    size_t k = 0;
+    for (int b = 0; b < 256; b++) {
+        while (k < count && objs[k].oid.hash[0] == b) k++;
+        put_be32(fanout + b * 4, (uint32_t)k);
+    }
+    for (size_t i = 0; i < count; i++) {
+        memcpy(oids + i * RAW_OID_SIZE, objs[i].oid.hash, RAW_OID_SIZE);
+        put_be64(offsets + i * 8, objs[i].offset);
+    }
+    unsigned char* trailer = offsets + count * 8;
+    memcpy(trailer, pack_sum, PACK_CHECKSUM_SIZE);
+
+    ObjectId idx_sum;
+    calculate_hash(buf, size - PACK_CHECKSUM_SIZE, &idx_sum);
+    memcpy(trailer + PACK_CHECKSUM_SIZE, idx_sum.hash, PACK_CHECKSUM_SIZE);
+
+    FILE* f = fopen(tmp_path, "wb");
+    int ok = f && fwrite(buf, 1, size, f) == size;
+    if (ok && (fflush(f) != 0 || fsync_written(fileno(f)) != 0)) ok = 0;
+    if (f && fclose(f) != 0) ok = 0;
+    free(buf);
+    return ok ? 0 : -1;
+}
+
+static void remove_packed_loose(const PackObject* objs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        char path[256];
+        object_path(&objs[i].oid, path, sizeof(path));
+        unlink(path);
+    }
+    // Fan-out directories that are now empty; rmdir fails on the others
+    for (int fan = 0; fan < 256; fan++) {
+        char dir_path[256];
+        snprintf(dir_path, sizeof(dir_path), OBJECTS_DIR "/%02x", fan);
+        rmdir(dir_path);
+    }
+}
+
+static void remove_old_packs(const char* keep) {
+    for (int i = 0; i < pack_count; i++) {
+        if (strcmp(packs[i].name, keep) == 0) continue;
+        char path[512];
+        snprintf(path, sizeof(path), PACK_DIR "/%s.idx", packs[i].name);
+        unlink(path);
+        snprintf(path, sizeof(path), PACK_DIR "/%s.pack", packs[i].name);
+        unlink(path);
+    }
+}
+
+// Write every object small enough into one new pack with OFS deltas
+// between similar objects, then drop the loose copies and older packs.
+// Returns 0 on success, -1 on failure (leaving the old objects intact).
+int repack_objects(void) {
+    prepare_packs();
+    ensure_directory_exists(PACK_DIR);
+
+    PackObject* all;
+    size_t all_count;
+    if (collect_objects(&all, &all_count) != 0) {
+        free(all);
+        return -1;
+    }
+
+    // Drop duplicates (objects both loose and packed)
+    qsort(all, all_count, sizeof(PackObject), compare_oid);
+    size_t count = 0;
+    for (size_t i = 0; i < all_count; i++) {
+        if (count && oid_eq(&all[count - 1].oid, &all[i].oid)) continue;
+        all[count++] = all[i];
+    }
+
+    // Learn each object's type and size; oversized ones stay loose
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        char* data;
+        if (read_object(&all[i].oid, &all[i].type, &data, &all[i].size) != 0) {
+            char hex[OID_HEX_SIZE + 1];
+            fprintf(stderr, "Skipping unreadable object %s\n", oid_to_hex(&all[i].oid, hex));
+            continue;
+        }
+        free(data);
+        if (all[i].size > PACK_MAX_OBJECT_SIZE || !pack_type_code(all[i].type)) continue;
+        all[kept++] = all[i];
+    }
+    count = kept;
+
+    if (count == 0) {
+        free(all);
+        printf("Nothing to pack\n");
+        return 0;
+    }
+
+    PackObject** order = malloc(count * sizeof(PackObject*));
+    if (!order) {
+        free(all);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) order[i] = &all[i];
+    qsort(order, count, sizeof(PackObject*), compare_for_delta);
+
+    char tmp_pack[256], tmp_idx[sizeof(tmp_pack) + 4];  // tmp_pack plus ".idx"
+    snprintf(tmp_pack, sizeof(tmp_pack), PACK_DIR "/tmp_pack_XXXXXX");
+    int fd = mkstemp(tmp_pack);
+    PackWriter w = {0};
+    w.file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!w.file || hash_init(&w.hash) != 0) {
+        if (w.file) fclose(w.file);
+        else if (fd >= 0) close(fd);
+        if (fd >= 0) unlink(tmp_pack);
+        free(order);
+        free(all);
+        return -1;
+    }
+
+    unsigned char header[PACK_HEADER_SIZE];
+    put_be32(header, PACK_SIGNATURE);
+    put_be32(header + 4, PACK_VERSION);
+    put_be32(header + 8, (uint32_t)count);
+    int failed = pack_write(&w, header, sizeof(header)) != 0;
+
+    WindowEntry window[PACK_DELTA_WINDOW];
+    memset(window, 0, sizeof(window));
+    int window_next = 0;
+    Buffer delta = BUFFER_INIT, best = BUFFER_INIT;
+    size_t deltas = 0;
+
+    for (size_t i = 0; i < count && !failed; i++) {
+        PackObject* obj = order[i];
+        char* data;
+        size_t len;
+        if (read_object(&obj->oid, NULL, &data, &len) != 0) {
+            failed = 1;
+            break;
+        }
+
+        // Try every recent object of the same type as a delta base
+        WindowEntry* base = NULL;
+        buffer_reset(&best);
+        for (int k = 0; k < PACK_DELTA_WINDOW; k++) {
+            WindowEntry* cand = &window[k];
+            if (!cand->data || cand->obj->type != obj->type ||
+                cand->depth >= PACK_MAX_DELTA_DEPTH || cand->len < len / 4)
+                continue;
+            size_t limit = best.len ? best.len : len / 2;
+            if (create_delta((unsigned char*)cand->data, cand->len,
+                             (unsigned char*)data, len, limit, &delta) == 0) {
+                Buffer tmp = best;
+                best = delta;
+                delta = tmp;
+                base = cand;
+            }
+        }
+
+        obj->offset = w.offset;
+        if (base) {
+            failed = pack_write_entry(&w, PACK_OBJ_OFS_DELTA, best.data, best.len,
+                                      obj->offset - base->obj->offset) != 0;
+            deltas++;
+        } else {
+            failed = pack_write_entry(&w, pack_type_code(obj->type), data, len, 0) != 0;
+        }
+
+        WindowEntry* slot = &window[window_next];
+        window_next = (window_next + 1) % PACK_DELTA_WINDOW;
+        free(slot->data);
+        slot->obj = obj;
+        slot->data = data;
+        slot->len = len;
+        slot->depth = base ? base->depth + 1 : 0;
+    }
+    for (int k = 0; k < PACK_DELTA_WINDOW; k++) free(window[k].data);
+    buffer_free(&delta);
+    buffer_free(&best);
+    free(order);
+
+    ObjectId sum;
+    char sum_hex[OID_HEX_SIZE + 1];
+    hash_final(&w.hash, &sum);
+    oid_to_hex(&sum, sum_hex);
+    if (!failed && fwrite(sum.hash, 1, PACK_CHECKSUM_SIZE, w.file) != PACK_CHECKSUM_SIZE) failed = 1;
+    if (!failed && (fflush(w.file) != 0 || fsync_written(fileno(w.file)) != 0)) failed = 1;
+    if (fclose(w.file) != 0) failed = 1;
+
+    if ((size_t)snprintf(tmp_idx, sizeof(tmp_idx), "%s.idx", tmp_pack) >= sizeof(tmp_idx))
+        failed = 1;
+    if (!failed) failed = write_pack_idx(tmp_idx, all, count, sum.hash) != 0;
+
+    char name[OID_HEX_SIZE + 8], pack_path[512], idx_path[512];
+    snprintf(name, sizeof(name), "pack-%s", sum_hex);
+    snprintf(pack_path, sizeof(pack_path), PACK_DIR "/%s.pack", name);
+    snprintf(idx_path, sizeof(idx_path), PACK_DIR "/%s.idx", name);
+
+    // The .pack goes first: an .idx is what makes a pack visible. Neither
+    // is renamed until its contents are on disk.
+    if (!failed) failed = fsync_barrier() != 0;
+    if (failed || rename(tmp_pack, pack_path) != 0 || rename(tmp_idx, idx_path) != 0) {
+        unlink(tmp_pack);
+        unlink(tmp_idx);
+        free(all);
+        return -1;
+    }
+    fsync_renamed(pack_path);
+    fsync_renamed(idx_path);
+
+    // The loose copies may only go once the pack is on disk
+    if (fsync_barrier() != 0) {
+        free(all);
+        return -1;
+    }
+    remove_packed_loose(all, count);
+    remove_old_packs(name);
+    printf("Packed %zu objects (%zu as deltas) into %s\n", count, deltas, name);
+    free(all);
+    return 0;
+}
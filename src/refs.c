@@ -0,0 +1,193 @@
+#include "refs.h"
+#include "branch.h"
+#include "buffer.h"
+#include "lockfile.h"
+#include "utils.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define REF_PREFIX "refs/heads/"
+
+// Read a whole file into a NUL-terminated buffer. NULL if it cannot be read.
+static char* read_whole_file(const char* path, size_t* len_out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    char* data = NULL;
+    if (fstat(fd, &st) == 0 && (data = malloc((size_t)st.st_size + 1))) {
+        size_t len = 0;
+        while (len < (size_t)st.st_size) {
+            ssize_t n = read(fd, data + len, (size_t)st.st_size - len);
+            if (n <= 0) break;
+            len += (size_t)n;
+        }
+        data[len] = '\0';
+        *len_out = len;
+    }
+    close(fd);
+    return data;
+}
+
+static Branch* ref_branch(Repository* repo, const char* name) {
+    Branch* branch = find_branch(repo, name);
+    return branch ? branch : create_branch_silent(repo, name);
+}
+
+static int load_packed_refs(Repository* repo) {
+    size_t len;
+    char* data = read_whole_file(PACKED_REFS_FILE, &len);
+    if (!data) return 0;
+
+    char* line = data;
+    while (line < data + len) {
+        char* end = strchr(line, '\n');
+        if (end) *end = '\0';
+
+        ObjectId oid;
+        size_t hexsz = hash_algo->hexsz;
+        if (line[0] != '#' && oid_from_hex(&oid, line) == 0 && line[hexsz] == ' ' &&
+            strncmp(line + hexsz + 1, REF_PREFIX, strlen(REF_PREFIX)) == 0) {
+            Branch* branch = ref_branch(repo, line + hexsz + 1 + strlen(REF_PREFIX));
+            if (!branch) {
+                free(data);
+                return -1;
+            }
+            branch->oid = oid;
+        }
+        if (!end) break;
+        line = end + 1;
+    }
+    free(data);
+    return 0;
+}
+
+static int load_loose_refs(Repository* repo) {
+    DIR* dir = opendir(REFS_HEADS_DIR);
+    if (!dir) return 0;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", REFS_HEADS_DIR, entry->d_name);
+        size_t len;
+        char* data = read_whole_file(path, &len);
+        if (!data) continue;
+
+        Branch* branch = ref_branch(repo, entry->d_name);
+        if (!branch) {
+            free(data);
+            closedir(dir);
+            return -1;
+        }
+        // An empty ref is a branch with no commits yet
+        ObjectId oid = {{0}};
+        oid_from_hex(&oid, data);
+        branch->oid = oid;
+        free(data);
+    }
+    closedir(dir);
+    return 0;
+}
+
+// Create a branch for every ref. Only the IDs are read; commits are
+// loaded when a branch's head is first used.
+int load_refs(Repository* repo) {
+    if (!repo) return -1;
+    if (load_packed_refs(repo) != 0) return -1;
+    return load_loose_refs(repo);
+}
+
+// Write a branch's loose ref under its lock. It replaces the old ref when
+// the command's locks are committed.
+int write_ref(Branch* branch) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", REFS_HEADS_DIR, branch->name);
+    LockFile* lock = hold_lock_file(path);
+    if (!lock) return -1;
+
+    char line[OID_HEX_SIZE + 2] = "";
+    if (!oid_is_null(&branch->oid)) oid_to_hex(&branch->oid, line);
+    strcat(line, "\n");
+    if (write_lock_file(lock, line, strlen(line)) != 0) {
+        rollback_lock_file(lock);
+        return -1;
+    }
+    branch->ref_dirty = 0;
+    return 0;
+}
+
+// Point HEAD at the current branch, like write_ref.
+int write_head(Repository* repo) {
+    LockFile* lock = hold_lock_file(HEAD_FILE);
+    if (!lock) return -1;
+
+    char line[300];
+    int len = snprintf(line, sizeof(line), "ref: " REF_PREFIX "%s\n",
+                       repo->current_branch ? repo->current_branch->name : "main");
+    if (write_lock_file(lock, line, (size_t)len) != 0) {
+        rollback_lock_file(lock);
+        return -1;
+    }
+    repo->head_dirty = 0;
+    return 0;
+}
+
+static int compare_branch_names(const void* a, const void* b) {
+    return strcmp((*(Branch* const*)a)->name, (*(Branch* const*)b)->name);
+}
+
+// Move every branch with a commit into packed-refs and remove its loose
+// ref. Returns the number of refs packed, or -1 on failure.
+int pack_refs(Repository* repo) {
+    if (!repo) return -1;
+
+    Branch** sorted = malloc((repo->branch_count ? repo->branch_count : 1) * sizeof(Branch*));
+    if (!sorted) return -1;
+    size_t count = 0;
+    for (Branch* branch = repo->branches; branch; branch = branch->next) {
+        if (!oid_is_null(&branch->oid)) sorted[count++] = branch;
+    }
+    qsort(sorted, count, sizeof(Branch*), compare_branch_names);
+
+    Buffer buf = BUFFER_INIT;
+    int failed = buffer_puts(&buf, PACKED_REFS_HEADER) != 0;
+    for (size_t i = 0; i < count && !failed; i++) {
+        char hex[OID_HEX_SIZE + 1];
+        failed = buffer_putf(&buf, "%s " REF_PREFIX "%s\n",
+                             oid_to_hex(&sorted[i]->oid, hex), sorted[i]->name) != 0;
+    }
+
+    // The loose refs may only go once packed-refs is in place
+    if (!failed) {
+        LockFile* lock = hold_lock_file(PACKED_REFS_FILE);
+        if (!lock) {
+            failed = 1;
+        } else if (write_lock_file(lock, buf.data, buf.len) != 0) {
+            rollback_lock_file(lock);
+            failed = 1;
+        } else {
+            failed = commit_lock_file(lock) != 0;
+        }
+    }
+    buffer_free(&buf);
+
+    if (!failed) {
+        for (size_t i = 0; i < count; i++) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", REFS_HEADS_DIR, sorted[i]->name);
+            unlink(path);
+            sorted[i]->ref_dirty = 0;
+        }
+    }
+    free(sorted);
+    return failed ? -1 : (int)count;
+}
@@ -1,15 +1,52 @@
 #include "repository.h"
 #include "utils.h"
 #include "commit.h"
+#include "commit_table.h"
 #include "branch.h"
+#include "refs.h"
+#include "trace.h"
+#include "tree.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
+#define CONFIG_FILE ".babygit/config"
+
+// Record the object format, in the layout git uses for the same setting.
+static int write_config(ObjectFormat format) {
+    FILE* f = fopen(CONFIG_FILE, "w");
+    if (!f) return -1;
+    fprintf(f, "[core]\n\trepositoryformatversion = 1\n"
+               "[extensions]\n\tobjectformat = %s\n",
+            format == OBJECT_FORMAT_SHA256 ? "sha256" : "sha1");
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+// Read the object format recorded by init. Repositories made before it was
+// recorded have no config and use SHA-1.
+static int read_object_format(ObjectFormat* out) {
+    *out = OBJECT_FORMAT_SHA1;
+    FILE* f = fopen(CONFIG_FILE, "r");
+    if (!f) return 0;
+
+    char line[256], name[64];
+    int ret = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, " objectformat = %63s", name) == 1 &&
+            object_format_from_name(name, out) != 0) {
+            fprintf(stderr, "Unsupported object format '%s'\n", name);
+            ret = -1;
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
 void ensure_main_branch(Repository* repo) {
     if (!find_branch(repo, "main")) {
         create_branch(repo, "main");
@@ -17,184 +54,111 @@ void ensure_main_branch(Repository* repo) {
     }
 }
 
-Repository *init_repository() {
+Repository *init_repository(ObjectFormat format) {
+    hash_set_format(format);
     ensure_directory_exists(".babygit");
     ensure_directory_exists(".babygit/objects");
     ensure_directory_exists(".babygit/refs");
     ensure_directory_exists(".babygit/refs/heads");
     ensure_directory_exists(".babygit/refs/remotes");
-
-    FILE *head = fopen(".babygit/HEAD", "w");
-    if (!head) {
-        perror("Failed to create HEAD file");
+    if (write_config(format) != 0) {
+        perror("Failed to write config");
         return NULL;
     }
-    fprintf(head, "ref: refs/heads/master\n");
-    fclose(head);
 
-    Repository *repo = malloc(sizeof(Repository));
+    Repository *repo = calloc(1, sizeof(Repository));
     if (!repo)
         return NULL;
+    arena_init(&repo->arena);
+    commit_table_init(&repo->commits, commit_cache_default_size(), &repo->arena);
 
-    load_branches(repo);
-    load_all_branch_heads(repo);
-
-    repo->branches = NULL;
-    repo->current_branch = NULL;
-    repo->commits = NULL;
-    repo->staged_files = NULL;
-    repo->staged_count = 0;
-
+    load_refs(repo);
     ensure_main_branch(repo);
 
     printf("Initialized empty babygit repository\n");
     return repo;
 }
 
-void save_repository(Repository* repo) {
-    if (!repo) return;
+// Returns -1 if HEAD or a ref could not be written.
+int save_repository(Repository* repo) {
+    if (!repo) return 0;
 
-    mkdir(".babygit", 0755);
-    mkdir(".babygit/objects", 0755);
-    mkdir(".babygit/refs", 0755);
-    mkdir(".babygit/refs/heads", 0755);
-
-    FILE* head_file = fopen(".babygit/HEAD", "w");
-    if (head_file) {
-        if (repo->current_branch) {
-            fprintf(head_file, "ref: refs/heads/%s\n", repo->current_branch->name);
-        } else {
-            fprintf(head_file, "ref: refs/heads/main\n");
-        }
-        fclose(head_file);
-    }
-
-    Branch* branch = repo->branches;
-    while (branch) {
-        char branch_path[256];
-        int written = snprintf(branch_path, sizeof(branch_path),
-                               ".babygit/refs/heads/%s", branch->name);
-        if (written < 0 || (size_t)written >= sizeof(branch_path)) {
-            fprintf(stderr, "Branch path too long for branch: %s\n", branch->name);
-            branch = branch->next;
-            continue;
-        }
-
-        FILE* branch_file = fopen(branch_path, "w");
-        if (branch_file) {
-            if (branch->head) {
-                fprintf(branch_file, "%s", branch->head->hash);
-            }
-            fclose(branch_file);
-        }
-        branch = branch->next;
+    int result = 0;
+    if (repo->head_dirty && write_head(repo) != 0) {
+        printf("Warning: Could not update HEAD file\n");
+        result = -1;
     }
 
-    FILE* index_file = fopen(".babygit/index", "w");
-    if (index_file) {
-        for (int i = 0; i < repo->staged_count; i++) {
-            fprintf(index_file, "%s %s\n", 
-                   repo->staged_files[i].hash, 
-                   repo->staged_files[i].filename);
-        }
-        fclose(index_file);
+    // Only refs that moved are rewritten
+    for (Branch* branch = repo->branches; branch; branch = branch->next) {
+        if (update_branch_ref(branch) != 0) result = -1;
     }
+    return result;
 }
 
 void free_repository(Repository *repo) {
     if (!repo) return;
 
-    free_branch(repo->branches);
-
-    Commit *current = repo->commits;
-    while (current) {
-        Commit *next = current->next;
-        free(current);
-        current = next;
-    }
+    commit_table_free(&repo->commits);
 
     if (repo->staged_files) {
         free(repo->staged_files);
     }
+    cache_tree_free(repo->cache_tree);
+    if (repo->index_map) munmap((void*)repo->index_map, repo->index_map_size);
+    free(repo->fsmonitor_token);
+    for (size_t i = 0; i < repo->untracked_count; i++) {
+        free(repo->untracked[i]);
+    }
+    free(repo->untracked);
+    free(repo->branch_map);
+    arena_destroy(&repo->arena);
 
     free(repo);
 }
 
-void load_branches(Repository* repo) {
-    DIR* dir;
-    struct dirent* entry;
-    char path[256];
-
-    snprintf(path, sizeof(path), ".babygit/refs/heads");
-    dir = opendir(path);
-    if (!dir) return;
-
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_type == DT_REG) {
-            create_branch(repo, entry->d_name);
-        }
-    }
-    closedir(dir);
-}
+static Repository* read_repository(void) {
+    // Every ID read from here on has the repository's width
+    ObjectFormat format;
+    if (read_object_format(&format) != 0) return NULL;
+    hash_set_format(format);
 
-Repository* load_repository() {
-    if (access(".babygit", F_OK) != 0) return NULL;
+    Repository* repo = calloc(1, sizeof(Repository));
+    if (!repo) return NULL;
+    arena_init(&repo->arena);
+    commit_table_init(&repo->commits, commit_cache_default_size(), &repo->arena);
 
-    Repository* repo = malloc(sizeof(Repository));
-    repo->branches = NULL;
-    repo->current_branch = NULL;
-    repo->commits = NULL;
-    repo->staged_files = NULL;
-    repo->staged_count = 0;
-
-    // Load existing branches
-    DIR* dir = opendir(".babygit/refs/heads");
-    if (dir) {
-        struct dirent* entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-                continue;
-            create_branch_silent(repo, entry->d_name);
-        }
-        closedir(dir);
+    if (load_refs(repo) != 0) {
+        fprintf(stderr, "Failed to read branch refs\n");
+        free_repository(repo);
+        return NULL;
     }
 
     // Load HEAD and set current branch
-    FILE* head_file = fopen(".babygit/HEAD", "r");
+    FILE* head_file = fopen(HEAD_FILE, "r");
     if (head_file) {
         char branch_name[256];
         if (fscanf(head_file, "ref: refs/heads/%255s", branch_name) == 1) {
-            checkout_branch(repo, branch_name);
+            repo->current_branch = find_branch(repo, branch_name);
         }
         fclose(head_file);
     }
 
-    // Now load commit for current branch
-    Branch* branch = repo->current_branch;
-    if (!branch) {
+    // HEAD must name an existing branch
+    if (!repo->current_branch) {
         fprintf(stderr, "Current branch not set. HEAD might be corrupt.\n");
+        free_repository(repo);
         return NULL;
     }
 
-    char branch_path[256];
-    int written = snprintf(branch_path, sizeof(branch_path),
-                           ".babygit/refs/heads/%s", branch->name);
-    if (written < 0 || (size_t)written >= sizeof(branch_path)) {
-        fprintf(stderr, "Branch path too long for branch: %s\n", branch->name);
-        return NULL;
-    }
+    return repo;
+}
 
-    FILE* branch_file = fopen(branch_path, "r");
-    if (branch_file) {
-        char commit_hash[65];
-        if (fscanf(branch_file, "%64s", commit_hash) == 1) {
-            Commit* head_commit = load_commit(commit_hash);
-            if (head_commit) {
-                repo->current_branch->head = head_commit;
-            }
-        }
-        fclose(branch_file);
-    }
+Repository* load_repository() {
+    if (access(".babygit", F_OK) != 0) return NULL;
 
+    uint64_t trace_start = trace_begin();
+    Repository* repo = read_repository();
+    trace_end(TRACE_LOAD_REPOSITORY, trace_start);
     return repo;
 }
@@ -1,61 +1,84 @@
 #include "staging.h"
+#include "fsmonitor.h"
+#include "index.h"
+#include "tree.h"
+#include "object_store.h"
 #include "utils.h"
 #include "branch.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "worktree.h"
 
-#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+
+// Point an existing entry at freshly hashed content.
+static void update_entry(Repository *repo, FileStatus *entry,
+                         const ObjectId *oid, const struct stat *st) {
+  const char *old_mode = tree_entry_mode(entry->mode);
+  // Rewriting the index also makes a racy entry's stat data trustworthy
+  if (!index_stat_data_matches(entry, st) || index_entry_is_racy(repo, entry))
+    repo->index_dirty = 1;
+  if (!oid_eq(&entry->oid, oid)) {
+    entry->oid = *oid;
+    if (entry->status != 2)
+      entry->status = 1; // Modified
+    cache_tree_invalidate(repo->cache_tree, entry->filename);
+    repo->index_dirty = 1;
+    printf("Added %s to staging area\n", entry->filename);
+  } else if (entry->status == 3) {
+    entry->status = 0; // Restored with identical content
+    cache_tree_invalidate(repo->cache_tree, entry->filename);
+    repo->index_dirty = 1;
+  }
+  index_fill_stat_data(entry, st);
+  if (strcmp(old_mode, tree_entry_mode(entry->mode)) != 0)
+    cache_tree_invalidate(repo->cache_tree, entry->filename);
+}
+
+static void init_new_entry(Repository *repo, FileStatus *entry,
+                           const ObjectId *oid, const struct stat *st) {
+  entry->oid = *oid;
+  entry->status = 2; // Added
+  index_fill_stat_data(entry, st);
+  cache_tree_invalidate(repo->cache_tree, entry->filename);
+  repo->index_dirty = 1;
+  printf("Added %s to staging area\n", entry->filename);
+}
 
 void add_to_index(Repository *repo, const char *filepath) {
   if (!repo || !filepath)
     return;
 
-  FILE *file = fopen(filepath, "rb");
-  if (!file) {
-    perror("Failed to open file");
+  struct stat st;
+  trace_count(TRACE_FILES_STATED, 1);
+  if (lstat(filepath, &st) != 0) {
+    perror("Failed to stat file");
     return;
   }
 
-  fseek(file, 0, SEEK_END);
-  long size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  char *content = malloc(size);
-  if (!content) {
-    fclose(file);
+  ObjectId oid;
+  FileStatus *cached = find_index_entry(repo, filepath);
+  if (cached && index_entry_up_to_date(repo, cached, &st)) {
+    oid = cached->oid;
+  } else if (write_blob_file(filepath, &oid) != 0) {
+    perror("Failed to read file");
     return;
   }
 
-  fread(content, 1, size, file);
-  fclose(file);
-
-  char hash[41];
-  calculate_hash(content, size, hash);
-  free(content);
-
-  // Check if file already staged
-  for (int i = 0; i < repo->staged_count; i++) {
-    if (strcmp(repo->staged_files[i].filename, filepath) == 0) {
-      strcpy(repo->staged_files[i].hash, hash);
-      repo->staged_files[i].status = 1; // Modified
-      return;
-    }
+  int pos = index_entry_pos(repo, filepath);
+  if (pos >= 0) {
+    update_entry(repo, &repo->staged_files[pos], &oid, &st);
+  } else {
+    FileStatus *entry = index_insert_entry(repo, -pos - 1, filepath);
+    if (entry)
+      init_new_entry(repo, entry, &oid, &st);
   }
-
-  // Add new file to staging
-  FileStatus *new_files = realloc(repo->staged_files, (repo->staged_count + 1) *
-                                                          sizeof(FileStatus));
-  if (!new_files)
-    return;
-
-  repo->staged_files = new_files;
-  strncpy(repo->staged_files[repo->staged_count].filename, filepath, 255);
-  strncpy(repo->staged_files[repo->staged_count].hash, hash, 40);
-  repo->staged_files[repo->staged_count].status = 2; // Added
-  repo->staged_count++;
-
-  printf("Added %s to staging area\n", filepath);
 }
 
 void clear_staging_area(Repository *repo) {
@@ -67,101 +90,601 @@ void clear_staging_area(Repository *repo) {
     repo->staged_files = NULL;
   }
   repo->staged_count = 0;
+  cache_tree_free(repo->cache_tree);
+  repo->cache_tree = NULL;
+  fsmonitor_clear(repo);
+  repo->index_dirty = 1;
+}
+
+// A growable list of paths; walks keep one per worker.
+typedef struct PathList {
+  char **paths;
+  size_t count;
+  size_t cap;
+} PathList;
+
+static void path_list_add(PathList *list, const char *path) {
+  if (list->count == list->cap) {
+    size_t new_cap = list->cap ? list->cap * 2 : 16;
+    char **grown = realloc(list->paths, new_cap * sizeof(char *));
+    if (!grown)
+      return;
+    list->paths = grown;
+    list->cap = new_cap;
+  }
+  char *copy = strdup(path);
+  if (copy)
+    list->paths[list->count++] = copy;
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
 
-  FILE *index = fopen(".babygit/index", "w");
-  if (index)
-    fclose(index);
+// Set an entry's fsmonitor bit, marking the index dirty if it changed.
+static void mark_fsmonitor_valid(Repository *repo, FileStatus *entry,
+                                 int valid) {
+  if (entry->fsmonitor_valid != valid) {
+    entry->fsmonitor_valid = valid;
+    repo->index_dirty = 1;
+  }
+}
+
+// One file of a parallel `add .`, stat'd and if needed hashed by a walker
+// thread.
+typedef struct StageJob {
+  char filename[256];
+  ObjectId oid;
+  struct stat st;
+  const FileStatus *cached; // existing index entry, NULL if untracked
+  int cache_valid;          // cached entry is not racy
+  int error;                // errno from stat/hash, 0 on success
+} StageJob;
+
+// Stat a job's file. Returns 1 if its contents still need to be hashed.
+static int stat_stage_job(StageJob *job) {
+  trace_count(TRACE_FILES_STATED, 1);
+  if (lstat(job->filename, &job->st) != 0) {
+    job->error = errno;
+    return 0;
+  }
+  if (job->cached && job->cache_valid &&
+      index_stat_data_matches(job->cached, &job->st)) {
+    trace_count(TRACE_INDEX_STAT_HITS, 1);
+    job->oid = job->cached->oid;
+    return 0;
+  }
+  return 1;
+}
+
+static int compare_stage_jobs(const void *a, const void *b) {
+  const StageJob *ja = *(const StageJob *const *)a;
+  const StageJob *jb = *(const StageJob *const *)b;
+  return strcmp(ja->filename, jb->filename);
+}
+
+// Files a worker hashes together with write_blob_files()
+#define STAGE_HASH_BATCH 16
+
+// Per-worker results of a parallel `add .`, merged once the walk is done.
+typedef struct StageJobList {
+  StageJob **jobs;
+  size_t count;
+  size_t cap;
+  StageJob *pending[STAGE_HASH_BATCH]; // waiting to be hashed
+  size_t pending_count;
+} StageJobList;
+
+static void hash_pending_jobs(StageJobList *list) {
+  if (!list->pending_count)
+    return;
+  const char *paths[STAGE_HASH_BATCH];
+  ObjectId oids[STAGE_HASH_BATCH];
+  int errors[STAGE_HASH_BATCH];
+  for (size_t k = 0; k < list->pending_count; k++)
+    paths[k] = list->pending[k]->filename;
+  write_blob_files(paths, list->pending_count, oids, errors);
+  for (size_t k = 0; k < list->pending_count; k++) {
+    list->pending[k]->oid = oids[k];
+    list->pending[k]->error = errors[k];
+  }
+  list->pending_count = 0;
+}
+
+typedef struct StageWalk {
+  Repository *repo;
+  StageJobList *lists;
+  int partial; // visiting fsmonitor's candidates rather than walking
+} StageWalk;
+
+// Visit the files a path from fsmonitor stands for: the file or symlink
+// itself, or everything below a directory. Returns -1 if a directory could
+// not be walked.
+static int visit_changed_path(const char *path, int num_threads,
+                              worktree_visit_fn visit, void *ctx) {
+  char dir[PATH_MAX];
+  size_t len = strlen(path);
+  struct stat st;
+  trace_count(TRACE_FILES_STATED, 1);
+  if (len && path[len - 1] == '/') {
+    if (len >= sizeof(dir))
+      return 0;
+    memcpy(dir, path, len - 1);
+    dir[len - 1] = '\0';
+    if (lstat(dir, &st) == 0 && S_ISDIR(st.st_mode))
+      return walk_worktree_dir(dir, num_threads, visit, ctx);
+  } else if (lstat(path, &st) == 0 &&
+             (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))) {
+    visit(0, path, ctx);
+  }
+  return 0;
+}
+
+static void stage_visit(int worker, const char *path, void *ctx) {
+  StageWalk *walk = ctx;
+  StageJobList *list = &walk->lists[worker];
+
+  if (strlen(path) >= sizeof(((StageJob *)0)->filename)) {
+    fprintf(stderr, "Skipping %s: path too long\n", path);
+    return;
+  }
+
+  StageJob *job = calloc(1, sizeof(StageJob));
+  if (!job)
+    return;
+  strcpy(job->filename, path);
+  // The index is not modified until the walk finishes, so lookups from
+  // several workers are safe
+  job->cached = find_index_entry(walk->repo, job->filename);
+  job->cache_valid =
+      job->cached && !index_entry_is_racy(walk->repo, job->cached);
+  int needs_hash = stat_stage_job(job);
+  // A candidate that is gone or no longer a file has nothing to add
+  if (walk->partial &&
+      (job->error ? job->error == ENOENT || job->error == ENOTDIR
+                  : !S_ISREG(job->st.st_mode) && !S_ISLNK(job->st.st_mode))) {
+    free(job);
+    return;
+  }
+
+  if (list->count == list->cap) {
+    size_t new_cap = list->cap ? list->cap * 2 : 64;
+    StageJob **grown = realloc(list->jobs, new_cap * sizeof(StageJob *));
+    if (!grown) {
+      free(job);
+      return;
+    }
+    list->jobs = grown;
+    list->cap = new_cap;
+  }
+  list->jobs[list->count++] = job;
+  if (needs_hash) {
+    list->pending[list->pending_count++] = job;
+    if (list->pending_count == STAGE_HASH_BATCH)
+      hash_pending_jobs(list);
+  }
 }
 
 void update_file_status(Repository *repo) {
   if (!repo)
     return;
 
-  clear_staging_area(repo);
+  FsmonitorChanges changes;
+  int monitored = fsmonitor_refresh(repo, &changes) == 0;
 
-  DIR *dir = opendir(".");
-  if (!dir)
+  int num_threads = thread_pool_default_size();
+  StageWalk walk = {repo, calloc(num_threads, sizeof(StageJobList)),
+                    monitored && !changes.full};
+  if (!walk.lists) {
+    fsmonitor_changes_free(&changes);
+    fsmonitor_clear(repo);
     return;
+  }
+
+  int walk_failed = 0;
+  if (walk.partial) {
+    // Only what fsmonitor cannot vouch for: tracked files not known to be
+    // unchanged, changed paths and the files that were untracked
+    for (int i = 0; i < repo->staged_count; i++) {
+      if (!repo->staged_files[i].fsmonitor_valid)
+        stage_visit(0, repo->staged_files[i].filename, &walk);
+    }
+    for (size_t k = 0; k < changes.count && !walk_failed; k++)
+      walk_failed = visit_changed_path(changes.paths[k], num_threads, stage_visit,
+                                  &walk) != 0;
+    for (size_t k = 0; k < repo->untracked_count; k++) {
+      if (!fsmonitor_changed(&changes, repo->untracked[k]))
+        stage_visit(0, repo->untracked[k], &walk);
+    }
+  } else {
+    // Traverse and hash the whole tree on the walker's threads
+    walk_failed = walk_worktree(num_threads, stage_visit, &walk) != 0;
+  }
+  if (walk_failed) {
+    perror("Failed to read working tree");
+    for (int t = 0; t < num_threads; t++) {
+      for (size_t k = 0; k < walk.lists[t].count; k++)
+        free(walk.lists[t].jobs[k]);
+      free(walk.lists[t].jobs);
+    }
+    free(walk.lists);
+    fsmonitor_changes_free(&changes);
+    fsmonitor_clear(repo);
+    return;
+  }
+  fsmonitor_changes_free(&changes);
+
+  size_t job_count = 0;
+  for (int t = 0; t < num_threads; t++) {
+    hash_pending_jobs(&walk.lists[t]);
+    job_count += walk.lists[t].count;
+  }
+
+  StageJob **jobs = malloc((job_count ? job_count : 1) * sizeof(StageJob *));
+  if (!jobs) {
+    free(walk.lists);
+    fsmonitor_clear(repo);
+    return;
+  }
+  job_count = 0;
+  for (int t = 0; t < num_threads; t++) {
+    memcpy(jobs + job_count, walk.lists[t].jobs,
+           walk.lists[t].count * sizeof(StageJob *));
+    job_count += walk.lists[t].count;
+    free(walk.lists[t].jobs);
+  }
+  free(walk.lists);
+
+  // Both the jobs and the index are sorted by path, so merge them in one
+  // pass; the result does not depend on scheduling
+  qsort(jobs, job_count, sizeof(StageJob *), compare_stage_jobs);
+
+  // fsmonitor's candidates can name a file more than once
+  size_t unique = 0;
+  for (size_t k = 0; k < job_count; k++) {
+    if (unique && strcmp(jobs[unique - 1]->filename, jobs[k]->filename) == 0)
+      free(jobs[k]);
+    else
+      jobs[unique++] = jobs[k];
+  }
+  job_count = unique;
+
+  FileStatus *merged = malloc((repo->staged_count + job_count) *
+                              sizeof(FileStatus));
+  if (!merged) {
+    for (size_t j = 0; j < job_count; j++)
+      free(jobs[j]);
+    free(jobs);
+    fsmonitor_clear(repo);
+    return;
+  }
 
-  struct dirent *entry;
-  while ((entry = readdir(dir)) != NULL) {
-    if (entry->d_type != DT_REG)
+  // Files that could not be added stay untracked
+  PathList failed = {NULL, 0, 0};
+
+  int count = 0, i = 0;
+  size_t j = 0;
+  while (i < repo->staged_count || j < job_count) {
+    int cmp;
+    if (i == repo->staged_count)
+      cmp = 1;
+    else if (j == job_count)
+      cmp = -1;
+    else
+      cmp = strcmp(repo->staged_files[i].filename, jobs[j]->filename);
+
+    if (cmp < 0) {
+      FileStatus *entry = &repo->staged_files[i++];
+      if (walk.partial && entry->fsmonitor_valid) {
+        merged[count++] = *entry; // Unchanged, so not visited
+        continue;
+      }
+      // Tracked but no longer in the working tree
+      if (entry->status != 3) {
+        cache_tree_invalidate(repo->cache_tree, entry->filename);
+        repo->index_dirty = 1;
+      }
+      if (entry->status == 2)
+        continue; // never committed, just drop it
+      merged[count] = *entry;
+      merged[count++].status = 3; // Deleted
       continue;
+    }
 
-    add_to_index(repo, entry->d_name);
+    StageJob *job = jobs[j++];
+    if (job->error) {
+      fprintf(stderr, "Failed to read file %s: %s\n", job->filename,
+              strerror(job->error));
+      if (cmp == 0) {
+        merged[count] = repo->staged_files[i++];
+        if (merged[count].fsmonitor_valid) {
+          merged[count].fsmonitor_valid = 0;
+          repo->index_dirty = 1;
+        }
+        count++;
+      } else if (monitored) {
+        path_list_add(&failed, job->filename);
+      }
+    } else if (cmp == 0) {
+      merged[count] = repo->staged_files[i++];
+      update_entry(repo, &merged[count], &job->oid, &job->st);
+      mark_fsmonitor_valid(repo, &merged[count++], monitored);
+    } else {
+      const char *name = arena_strdup(&repo->arena, job->filename);
+      if (name) {
+        FileStatus *entry = &merged[count++];
+        memset(entry, 0, sizeof(FileStatus));
+        entry->filename = name;
+        init_new_entry(repo, entry, &job->oid, &job->st);
+        entry->fsmonitor_valid = monitored;
+      } else if (monitored) {
+        path_list_add(&failed, job->filename);
+      }
+    }
+    free(job);
   }
-  closedir(dir);
+  free(jobs);
+
+  free(repo->staged_files);
+  repo->staged_files = merged;
+  repo->staged_count = count;
+  if (monitored)
+    fsmonitor_set_untracked(repo, failed.paths, failed.count);
 }
 
-void print_status(Repository *repo) {
-  if (!repo || !repo->current_branch)
-    return;
+// Per-worker lists of paths found in the working tree but not the index.
+typedef struct UntrackedWalk {
+  Repository *repo;
+  PathList *lists;
+} UntrackedWalk;
 
-  printf("On branch %s\n",
-         repo->current_branch ? repo->current_branch->name : "none");
-  printf("\nStaged changes:\n");
+static void untracked_visit(int worker, const char *path, void *ctx) {
+  UntrackedWalk *walk = ctx;
+  if (!find_index_entry(walk->repo, path))
+    path_list_add(&walk->lists[worker], path);
+}
 
-  for (int i = 0; i < repo->staged_count; i++) {
-    const char *status;
-    switch (repo->staged_files[i].status) {
-    case 0:
-      status = "unmodified";
-      break;
-    case 1:
-      status = "modified";
-      break;
-    case 2:
-      status = "added";
-      break;
-    case 3:
-      status = "deleted";
-      break;
-    default:
-      status = "unknown";
+// Sorted untracked files. With fsmonitor's changes (unless they are full)
+// only the recorded list and what changed since it are looked at, not the
+// whole tree. Returns NULL if the tree could not be read.
+static char **collect_untracked_files(Repository *repo,
+                                      const FsmonitorChanges *changes,
+                                      size_t *count) {
+  int num_threads = thread_pool_default_size();
+  UntrackedWalk walk = {repo, calloc(num_threads, sizeof(PathList))};
+  if (!walk.lists)
+    return NULL;
+
+  int ok = 1;
+  if (changes && !changes->full) {
+    for (size_t k = 0; k < repo->untracked_count; k++) {
+      const char *path = repo->untracked[k];
+      if (!fsmonitor_changed(changes, path) && !find_index_entry(repo, path))
+        path_list_add(&walk.lists[0], path);
     }
-    printf("  %s: %s\n", status, repo->staged_files[i].filename);
+    for (size_t k = 0; k < changes->count && ok; k++)
+      ok = visit_changed_path(changes->paths[k], num_threads, untracked_visit,
+                              &walk) == 0;
+  } else {
+    ok = walk_worktree(num_threads, untracked_visit, &walk) == 0;
   }
+
+  size_t total = 0;
+  for (int t = 0; t < num_threads; t++)
+    total += walk.lists[t].count;
+  char **all = ok ? malloc((total ? total : 1) * sizeof(char *)) : NULL;
+  size_t n = 0;
+  for (int t = 0; t < num_threads; t++) {
+    for (size_t k = 0; k < walk.lists[t].count; k++) {
+      if (all)
+        all[n++] = walk.lists[t].paths[k];
+      else
+        free(walk.lists[t].paths[k]);
+    }
+    free(walk.lists[t].paths);
+  }
+  free(walk.lists);
+  if (!all)
+    return NULL;
+
+  // A file below two changed directories is found twice
+  qsort(all, n, sizeof(char *), compare_paths);
+  size_t unique = 0;
+  for (size_t k = 0; k < n; k++) {
+    if (unique && strcmp(all[unique - 1], all[k]) == 0)
+      free(all[k]);
+    else
+      all[unique++] = all[k];
+  }
+  *count = unique;
+  return all;
 }
 
-void save_index(Repository *repo) {
-  if (!repo) return;
+static void print_untracked_files(Repository *repo,
+                                  const FsmonitorChanges *changes) {
+  size_t count = 0;
+  char **untracked = collect_untracked_files(repo, changes, &count);
+  if (!untracked) {
+    if (changes)
+      fsmonitor_clear(repo);
+    return;
+  }
 
-  FILE *f = fopen(".babygit/index", "w");
-  if (!f) return;
+  printf("\nUntracked files:\n");
+  for (size_t k = 0; k < count; k++)
+    printf("  %s\n", untracked[k]);
 
-  for (int i = 0; i < repo->staged_count; i++) {
-    fprintf(f, "%s %s %d\n", repo->staged_files[i].filename,
-                            repo->staged_files[i].hash,
-                            repo->staged_files[i].status);
+  // Kept in the index for the next status to start from
+  if (changes) {
+    fsmonitor_set_untracked(repo, untracked, count);
+    return;
   }
+  for (size_t k = 0; k < count; k++)
+    free(untracked[k]);
+  free(untracked);
+}
 
-  fclose(f);
+static const char *status_name(int status) {
+  switch (status) {
+  case 0:
+    return "unmodified";
+  case 1:
+    return "modified";
+  case 2:
+    return "added";
+  case 3:
+    return "deleted";
+  default:
+    return "unknown";
+  }
 }
 
-void load_index(Repository *repo) {
-  if (!repo) return;
+// Index entries a status worker checks against the working tree at a time
+#define STATUS_CHUNK 256
+
+// Working tree against index for `status`. Workers check chunks of the
+// index in parallel while results are printed in index order, each chunk
+// as soon as it and those before it are done.
+typedef struct WorktreeCheck {
+  Repository *repo;
+  unsigned char *results; // per entry: 0 unchanged, 1 modified, 3 deleted
+  int monitored;          // fsmonitor_valid entries need not be looked at
+  int validated;          // some entries were newly found unchanged
+  int chunk_count;
+  int *chunk_done;
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+} WorktreeCheck;
+
+typedef struct CheckChunk {
+  WorktreeCheck *check;
+  int chunk;
+} CheckChunk;
+
+// How an entry's file differs from the index: 0 not at all, 1 modified or
+// 3 deleted. Only files whose stat data no longer matches are hashed.
+int check_worktree_entry(const Repository *repo, const FileStatus *entry) {
+  struct stat st;
+  trace_count(TRACE_FILES_STATED, 1);
+  if (lstat(entry->filename, &st) != 0 || S_ISDIR(st.st_mode))
+    return 3;
+  if (index_entry_up_to_date(repo, entry, &st)) {
+    trace_count(TRACE_INDEX_STAT_HITS, 1);
+    return 0;
+  }
+  ObjectId oid;
+  if (hash_blob_file(entry->filename, &oid) != 0 ||
+      !oid_eq(&oid, &entry->oid) ||
+      strcmp(tree_entry_mode(st.st_mode), tree_entry_mode(entry->mode)) != 0)
+    return 1;
+  return 0;
+}
 
-  FILE *f = fopen(".babygit/index", "r");
-  if (!f) return;
+static void check_chunk(void *arg) {
+  CheckChunk *job = arg;
+  WorktreeCheck *check = job->check;
+  Repository *repo = check->repo;
+  int start = job->chunk * STATUS_CHUNK;
+  int end = start + STATUS_CHUNK < repo->staged_count ? start + STATUS_CHUNK
+                                                      : repo->staged_count;
+
+  // Entries staged as deleted have nothing in the working tree to compare
+  int validated = 0;
+  for (int i = start; i < end; i++) {
+    FileStatus *entry = &repo->staged_files[i];
+    if (entry->status == 3) {
+      check->results[i] = 0;
+    } else if (check->monitored && entry->fsmonitor_valid) {
+      trace_count(TRACE_FSMONITOR_HITS, 1);
+      check->results[i] = 0;
+    } else {
+      check->results[i] = check_worktree_entry(repo, entry);
+      if (check->monitored && !check->results[i]) {
+        entry->fsmonitor_valid = 1;
+        validated = 1;
+      }
+    }
+  }
 
-  char filename[256];
-  char hash[41];
-  int status;
+  pthread_mutex_lock(&check->lock);
+  if (validated)
+    check->validated = 1;
+  check->chunk_done[job->chunk] = 1;
+  pthread_cond_broadcast(&check->done);
+  pthread_mutex_unlock(&check->lock);
+}
 
-  repo->staged_files = NULL;
-  repo->staged_count = 0;
+static void print_staged_change(const char *path, int status, void *ctx) {
+  (void)ctx;
+  printf("  %s: %s\n", status_name(status), path);
+}
 
-  while (fscanf(f, "%255s %40s %d\n", filename, hash, &status) == 3) {
-    FileStatus *new_files = realloc(repo->staged_files,
-                                    (repo->staged_count + 1) * sizeof(FileStatus));
-    if (!new_files) break;
+void print_status(Repository *repo) {
+  if (!repo || !repo->current_branch)
+    return;
 
-    repo->staged_files = new_files;
-    strncpy(repo->staged_files[repo->staged_count].filename, filename, 255);
-    strncpy(repo->staged_files[repo->staged_count].hash, hash, 40);
-    repo->staged_files[repo->staged_count].status = status;
-    repo->staged_count++;
+  printf("On branch %s\n", repo->current_branch->name);
+
+  FsmonitorChanges changes;
+  int monitored = fsmonitor_refresh(repo, &changes) == 0;
+
+  // Start on the working tree first; it is the slow part
+  WorktreeCheck check = {repo, NULL, monitored, 0, 0, NULL,
+                         PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+  check.chunk_count = (repo->staged_count + STATUS_CHUNK - 1) / STATUS_CHUNK;
+  check.results = malloc(repo->staged_count ? repo->staged_count : 1);
+  check.chunk_done = calloc(check.chunk_count ? check.chunk_count : 1,
+                            sizeof(int));
+  CheckChunk *jobs = malloc((check.chunk_count ? check.chunk_count : 1) *
+                            sizeof(CheckChunk));
+  if (!check.results || !check.chunk_done || !jobs) {
+    free(check.results);
+    free(check.chunk_done);
+    free(jobs);
+    fsmonitor_changes_free(&changes);
+    fsmonitor_clear(repo);
+    printf("Out of memory\n");
+    return;
+  }
+  ThreadPool *pool = thread_pool_create(thread_pool_default_size());
+  for (int k = 0; k < check.chunk_count; k++) {
+    jobs[k] = (CheckChunk){&check, k};
+    if (!pool || thread_pool_submit(pool, check_chunk, &jobs[k]) != 0)
+      check_chunk(&jobs[k]);
   }
 
-  fclose(f);
+  printf("\nStaged changes:\n");
+  Commit *head = branch_head(repo, repo->current_branch);
+  if (diff_index_with_tree(repo, head ? &head->tree : NULL,
+                           print_staged_change, NULL) != 0)
+    printf("  (could not read the tree of HEAD)\n");
+
+  printf("\nChanges not staged for commit:\n");
+  for (int k = 0; k < check.chunk_count; k++) {
+    pthread_mutex_lock(&check.lock);
+    while (!check.chunk_done[k])
+      pthread_cond_wait(&check.done, &check.lock);
+    pthread_mutex_unlock(&check.lock);
+
+    int end = (k + 1) * STATUS_CHUNK < repo->staged_count
+                  ? (k + 1) * STATUS_CHUNK
+                  : repo->staged_count;
+    for (int i = k * STATUS_CHUNK; i < end; i++) {
+      if (check.results[i])
+        printf("  %s: %s\n", status_name(check.results[i]),
+               repo->staged_files[i].filename);
+    }
+  }
+  if (pool) {
+    thread_pool_wait(pool);
+    thread_pool_destroy(pool);
+  }
+  if (check.validated)
+    repo->index_dirty = 1;
+  free(check.results);
+  free(check.chunk_done);
+  free(jobs);
+
+  print_untracked_files(repo, monitored ? &changes : NULL);
+  fsmonitor_changes_free(&changes);
 }
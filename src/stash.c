@@ -1,5 +1,6 @@
 #include "stash.h"
 #include "commit.h"
+#include "commit_table.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,12 +16,15 @@ void stash_changes(Repository *repo, const char *message) {
     return;
 
   // Create stash item
-  Stash *stash = malloc(sizeof(Stash));
+  Stash *stash = arena_alloc(&repo->arena, sizeof(Stash));
   if (!stash)
     return;
 
-  strncpy(stash->message, message, 255);
+  stash->message = arena_strdup(&repo->arena, message);
+  if (!stash->message)
+    return;
   stash->commit = stash_commit;
+  commit_pin(&repo->commits, stash_commit);
   stash->next = NULL;
 
   // Add to stash list
@@ -63,7 +67,9 @@ void list_stashes(Repository *repo) {
 
   printf("Stashes:\n");
   while (stash) {
-    printf("%d: %s (%s)\n", index++, stash->message, stash->commit->hash);
+    char hex[OID_HEX_SIZE + 1];
+    printf("%d: %s (%s)\n", index++, stash->message,
+           oid_to_hex(&stash->commit->oid, hex));
     stash = stash->next;
   }
 }
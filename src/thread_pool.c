@@ -0,0 +1,135 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define THREAD_POOL_MAX_THREADS 256
+
+typedef struct ThreadJob {
+    thread_job_fn fn;
+    void* arg;
+    struct ThreadJob* next;
+} ThreadJob;
+
+struct ThreadPool {
+    pthread_t* threads;
+    int num_threads;
+    ThreadJob* head;
+    ThreadJob* tail;
+    int pending;        // queued + running jobs
+    int shutting_down;
+    pthread_mutex_t lock;
+    pthread_cond_t has_work;
+    pthread_cond_t idle;
+};
+
+// Number of workers to use: BABYGIT_THREADS if set, else online CPUs.
+int thread_pool_default_size(void) {
+    const char* env = getenv("BABYGIT_THREADS");
+    long n = env ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > THREAD_POOL_MAX_THREADS) n = THREAD_POOL_MAX_THREADS;
+    return (int)n;
+}
+
+static void* worker_main(void* data) {
+    ThreadPool* pool = data;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->head && !pool->shutting_down)
+            pthread_cond_wait(&pool->has_work, &pool->lock);
+        if (!pool->head && pool->shutting_down)
+            break;
+
+        ThreadJob* job = pool->head;
+        pool->head = job->next;
+        if (!pool->head) pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->fn(job->arg);
+        free(job);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_broadcast(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool* thread_pool_create(int num_threads) {
+    if (num_threads < 1) num_threads = 1;
+
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) return NULL;
+
+    pool->threads = calloc(num_threads, sizeof(pthread_t));
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->has_work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0)
+            break;
+        pool->num_threads++;
+    }
+
+    if (pool->num_threads == 0) {
+        thread_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// Queue a job. Returns 0 on success, -1 if the job could not be queued.
+int thread_pool_submit(ThreadPool* pool, thread_job_fn fn, void* arg) {
+    ThreadJob* job = malloc(sizeof(ThreadJob));
+    if (!job) return -1;
+    job->fn = fn;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail)
+        pool->tail->next = job;
+    else
+        pool->head = job;
+    pool->tail = job;
+    pool->pending++;
+    pthread_cond_signal(&pool->has_work);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+// Block until every submitted job has finished running.
+void thread_pool_wait(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_destroy(ThreadPool* pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = 1;
+    pthread_cond_broadcast(&pool->has_work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->has_work);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->threads);
+    free(pool);
+}
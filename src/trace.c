@@ -0,0 +1,183 @@
+#define _GNU_SOURCE  // gettid
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Chrome events kept per command; regions past this are still summed
+#define TRACE_EVENT_MAX 65536
+
+typedef enum TraceFormat {
+    TRACE_JSON,
+    TRACE_CHROME
+} TraceFormat;
+
+typedef struct TraceEvent {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    int tid;
+    TraceRegion region;
+} TraceEvent;
+
+#ifndef NO_TRACE
+int trace_enabled;
+uint64_t trace_counters[TRACE_COUNTER_COUNT];
+
+static const char* const region_names[TRACE_REGION_COUNT] = {
+    "command",     "load_repository", "load_index", "traverse", "hash",
+    "object_read", "object_write",    "serialize",  "diff",     "save",
+};
+
+static const char* const counter_names[TRACE_COUNTER_COUNT] = {
+    "files_stated",     "bytes_hashed",     "objects_read",      "objects_written",
+    "index_stat_hits",  "cache_tree_hits",  "fsmonitor_hits",    "commit_cache_hits",
+    "commit_cache_misses",
+};
+
+static TraceFormat format;
+static char* output_path;
+static const char* command_name;
+static uint64_t start_ns;
+
+static uint64_t region_calls[TRACE_REGION_COUNT];
+static uint64_t region_ns[TRACE_REGION_COUNT];
+
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceEvent* events;
+static size_t event_count;
+static uint64_t events_dropped;
+
+static __thread int thread_id;
+
+uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void trace_record(TraceRegion region, uint64_t start) {
+    uint64_t duration = trace_now_ns() - start;
+    __atomic_fetch_add(&region_calls[region], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&region_ns[region], duration, __ATOMIC_RELAXED);
+    if (format != TRACE_CHROME) return;
+
+    if (!thread_id) thread_id = gettid();
+    pthread_mutex_lock(&events_lock);
+    if (!events) events = malloc(TRACE_EVENT_MAX * sizeof(TraceEvent));
+    if (events && event_count < TRACE_EVENT_MAX) {
+        events[event_count++] = (TraceEvent){start, duration, thread_id, region};
+    } else {
+        events_dropped++;
+    }
+    pthread_mutex_unlock(&events_lock);
+}
+
+// The command name comes from argv, so it is escaped like any JSON string.
+static void write_escaped(FILE* out, const char* s) {
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+}
+
+static void write_json(FILE* out, uint64_t wall_ns) {
+    fprintf(out, "{\"command\": \"");
+    write_escaped(out, command_name);
+    fprintf(out, "\", \"wall_ms\": %.3f,\n \"regions\": {", wall_ns / 1e6);
+    int first = 1;
+    for (int i = 0; i < TRACE_REGION_COUNT; i++) {
+        if (!region_calls[i]) continue;
+        fprintf(out, "%s\n  \"%s\": {\"count\": %llu, \"ms\": %.3f}", first ? "" : ",",
+                region_names[i], (unsigned long long)region_calls[i], region_ns[i] / 1e6);
+        first = 0;
+    }
+    fprintf(out, "},\n \"counters\": {");
+    for (int i = 0; i < TRACE_COUNTER_COUNT; i++) {
+        fprintf(out, "%s\n  \"%s\": %llu", i ? "," : "", counter_names[i],
+                (unsigned long long)trace_counters[i]);
+    }
+    fprintf(out, "}}\n");
+}
+
+// Timestamps are microseconds since the command started.
+static void write_chrome(FILE* out, uint64_t end_ns) {
+    int pid = getpid();
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+                 "\"args\": {\"name\": \"babygit ", pid);
+    write_escaped(out, command_name);
+    fprintf(out, "\"}}");
+    for (size_t i = 0; i < event_count; i++) {
+        const TraceEvent* e = &events[i];
+        fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                     "\"pid\": %d, \"tid\": %d}",
+                region_names[e->region], (e->start_ns - start_ns) / 1e3, e->duration_ns / 1e3,
+                pid, e->tid);
+    }
+    fprintf(out, ",\n{\"name\": \"counters\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": %d, \"args\": {",
+            (end_ns - start_ns) / 1e3, pid);
+    for (int i = 0; i < TRACE_COUNTER_COUNT; i++) {
+        fprintf(out, "%s\"%s\": %llu", i ? ", " : "", counter_names[i],
+                (unsigned long long)trace_counters[i]);
+    }
+    fprintf(out, "}}\n], \"eventsDropped\": %llu}\n", (unsigned long long)events_dropped);
+}
+
+static void trace_finish(void) {
+    trace_record(TRACE_COMMAND, start_ns);
+    trace_enabled = 0;
+    uint64_t end_ns = trace_now_ns();
+
+    FILE* out = output_path ? fopen(output_path, "w") : stderr;
+    if (!out) {
+        perror(output_path);
+        return;
+    }
+    if (format == TRACE_CHROME) {
+        write_chrome(out, end_ns);
+    } else {
+        write_json(out, end_ns - start_ns);
+    }
+    if (out != stderr) fclose(out);
+    free(events);
+    free(output_path);
+}
+
+// Read BABYGIT_TRACE and start timing the command. Output is written when
+// the process exits.
+void trace_setup(const char* command) {
+    const char* env = getenv("BABYGIT_TRACE");
+    if (!env || !*env || strcmp(env, "0") == 0) return;
+
+    const char* colon = strchr(env, ':');
+    size_t len = colon ? (size_t)(colon - env) : strlen(env);
+    if (len == 6 && strncmp(env, "chrome", 6) == 0) {
+        format = TRACE_CHROME;
+    } else if ((len == 4 && strncmp(env, "json", 4) == 0) || (len == 1 && env[0] == '1')) {
+        format = TRACE_JSON;
+    } else {
+        fprintf(stderr, "Unknown BABYGIT_TRACE format '%.*s', using json\n", (int)len, env);
+        format = TRACE_JSON;
+    }
+    if (colon && colon[1]) output_path = strdup(colon + 1);
+
+    command_name = command ? command : "";
+    start_ns = trace_now_ns();
+    trace_enabled = 1;
+    atexit(trace_finish);
+}
+#else
+void trace_setup(const char* command) {
+    (void)command;
+}
+#endif
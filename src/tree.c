@@ -0,0 +1,600 @@
+#include "tree.h"
+#include "buffer.h"
+#include "index.h"
+#include "object_store.h"
+#include "trace.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static int tree_put_entry(Buffer *buf, const char *mode, const char *name,
+                          size_t name_len, const unsigned char *oid) {
+  if (buffer_putf(buf, "%s ", mode) != 0 ||
+      buffer_put(buf, name, name_len) != 0 || buffer_put(buf, "", 1) != 0)
+    return -1;
+  return buffer_put(buf, oid, hash_algo->rawsz);
+}
+
+// Tree entry mode for a file with the given stat mode.
+const char *tree_entry_mode(unsigned int st_mode) {
+  if (S_ISLNK(st_mode))
+    return TREE_MODE_SYMLINK;
+  if (st_mode & S_IXUSR)
+    return TREE_MODE_EXECUTABLE;
+  return TREE_MODE_FILE;
+}
+
+static CacheTree *cache_tree_new(const char *name, size_t len) {
+  CacheTree *tree = calloc(1, sizeof(CacheTree));
+  if (!tree)
+    return NULL;
+  tree->name = malloc(len + 1);
+  if (!tree->name) {
+    free(tree);
+    return NULL;
+  }
+  memcpy(tree->name, name, len);
+  tree->name[len] = '\0';
+  tree->entry_count = -1;
+  return tree;
+}
+
+void cache_tree_free(CacheTree *tree) {
+  if (!tree)
+    return;
+  for (int i = 0; i < tree->subtree_count; i++)
+    cache_tree_free(tree->subtrees[i]);
+  free(tree->subtrees);
+  free(tree->name);
+  free(tree);
+}
+
+// Binary search the subtrees. Returns the position of name, or
+// -(insert position) - 1 if there is no such subtree.
+static int subtree_pos(const CacheTree *tree, const char *name, size_t len) {
+  int lo = 0, hi = tree->subtree_count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    const char *other = tree->subtrees[mid]->name;
+    int cmp = strncmp(other, name, len);
+    if (cmp == 0)
+      cmp = other[len] ? 1 : 0;
+    if (cmp == 0)
+      return mid;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -lo - 1;
+}
+
+static CacheTree *subtree_get(CacheTree *tree, const char *name, size_t len) {
+  int pos = subtree_pos(tree, name, len);
+  if (pos >= 0)
+    return tree->subtrees[pos];
+
+  pos = -pos - 1;
+  if (tree->subtree_count == tree->subtree_alloc) {
+    int alloc = tree->subtree_alloc ? tree->subtree_alloc * 2 : 4;
+    CacheTree **grown = realloc(tree->subtrees, alloc * sizeof(CacheTree *));
+    if (!grown)
+      return NULL;
+    tree->subtrees = grown;
+    tree->subtree_alloc = alloc;
+  }
+  CacheTree *sub = cache_tree_new(name, len);
+  if (!sub)
+    return NULL;
+  memmove(&tree->subtrees[pos + 1], &tree->subtrees[pos],
+          (tree->subtree_count - pos) * sizeof(CacheTree *));
+  tree->subtrees[pos] = sub;
+  tree->subtree_count++;
+  return sub;
+}
+
+// Mark every directory on the way to path as changed.
+void cache_tree_invalidate(CacheTree *root, const char *path) {
+  CacheTree *tree = root;
+  while (tree) {
+    tree->entry_count = -1;
+    const char *slash = strchr(path, '/');
+    if (!slash)
+      return;
+    int pos = subtree_pos(tree, path, slash - path);
+    tree = pos >= 0 ? tree->subtrees[pos] : NULL;
+    path = slash + 1;
+  }
+}
+
+// Write the tree for the directory base (baselen bytes, ending in '/'
+// unless it is the root) from the index entries starting at entries.
+// Returns the number of index entries consumed, or -1 on failure.
+static int update_one(CacheTree *tree, const FileStatus *entries, int count,
+                      const char *base, size_t baselen) {
+  if (tree->entry_count >= 0) {
+    trace_count(TRACE_CACHE_TREE_HITS, 1);
+    return tree->entry_count;
+  }
+
+  for (int k = 0; k < tree->subtree_count; k++)
+    tree->subtrees[k]->used = 0;
+
+  Buffer buf = BUFFER_INIT;
+  int i = 0, tracked = 0;
+  while (i < count) {
+    const FileStatus *entry = &entries[i];
+    if (strncmp(entry->filename, base, baselen) != 0)
+      break;
+    if (entry->status == 3) { // deleted, not part of the snapshot
+      i++;
+      continue;
+    }
+
+    const char *name = entry->filename + baselen;
+    const char *slash = strchr(name, '/');
+    if (!slash) {
+      if (tree_put_entry(&buf, tree_entry_mode(entry->mode), name,
+                         strlen(name), entry->oid.hash) != 0)
+        goto fail;
+      tracked++;
+      i++;
+      continue;
+    }
+
+    CacheTree *sub = subtree_get(tree, name, slash - name);
+    if (!sub)
+      goto fail;
+    int used = update_one(sub, entries + i, count - i, entry->filename,
+                          slash - entry->filename + 1);
+    if (used < 0)
+      goto fail;
+    sub->used = 1;
+    i += used;
+    if (sub->entry_count == 0)
+      continue; // every file below was deleted
+    if (tree_put_entry(&buf, TREE_MODE_DIR, sub->name, strlen(sub->name),
+                       sub->oid.hash) != 0)
+      goto fail;
+    tracked += sub->entry_count;
+  }
+
+  // Directories that no longer have any entries
+  int kept = 0;
+  for (int k = 0; k < tree->subtree_count; k++) {
+    if (tree->subtrees[k]->used)
+      tree->subtrees[kept++] = tree->subtrees[k];
+    else
+      cache_tree_free(tree->subtrees[k]);
+  }
+  tree->subtree_count = kept;
+
+  if (write_object(OBJ_TREE, buf.data ? buf.data : "", buf.len, &tree->oid) !=
+      0)
+    goto fail;
+  buffer_free(&buf);
+  tree->entry_count = tracked;
+  return i;
+
+fail:
+  buffer_free(&buf);
+  return -1;
+}
+
+// Write tree objects for the index, rewriting only directories that have
+// changed since the last call, and return the root tree's ID.
+int cache_tree_update(Repository *repo, ObjectId *tree_oid) {
+  if (!repo->cache_tree) {
+    repo->cache_tree = cache_tree_new("", 0);
+    if (!repo->cache_tree)
+      return -1;
+  }
+  if (update_one(repo->cache_tree, repo->staged_files, repo->staged_count, "",
+                 0) < 0)
+    return -1;
+  *tree_oid = repo->cache_tree->oid;
+  return 0;
+}
+
+// Read a tree object for tree_desc_next(). Returns -1 if it is missing or
+// not a tree.
+int tree_desc_open(TreeDesc *desc, const ObjectId *oid) {
+  ObjectType type;
+  desc->pos = 0;
+  if (read_object(oid, &type, &desc->data, &desc->len) != 0)
+    return -1;
+  if (type != OBJ_TREE) {
+    free(desc->data);
+    desc->data = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+// Returns 1 and fills entry, 0 at the end of the tree, or -1 if the tree
+// is malformed.
+int tree_desc_next(TreeDesc *desc, TreeEntry *entry) {
+  if (desc->pos >= desc->len)
+    return 0;
+  const char *p = desc->data + desc->pos;
+  const char *end = desc->data + desc->len;
+  const char *space = memchr(p, ' ', end - p);
+  const char *nul = space ? memchr(space, '\0', end - space) : NULL;
+  if (!nul || (size_t)(end - nul - 1) < hash_algo->rawsz)
+    return -1;
+
+  entry->mode = (unsigned int)strtoul(p, NULL, 8);
+  entry->name = space + 1;
+  entry->name_len = nul - space - 1;
+  memset(&entry->oid, 0, sizeof(entry->oid));
+  memcpy(entry->oid.hash, nul + 1, hash_algo->rawsz);
+  desc->pos = (nul + 1 + hash_algo->rawsz) - desc->data;
+  return 1;
+}
+
+void tree_desc_close(TreeDesc *desc) {
+  free(desc->data);
+  desc->data = NULL;
+}
+
+typedef struct TreeDiff {
+  const FileStatus *entries;
+  int count;
+  int pos; // next index entry to compare
+  tree_change_fn fn;
+  void *ctx;
+} TreeDiff;
+
+// Position of the first entry at or after pos that is not below prefix.
+static int prefix_end(const TreeDiff *diff, int pos, const char *prefix,
+                      size_t len) {
+  int lo = pos, hi = diff->count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (strncmp(diff->entries[mid].filename, prefix, len) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// The next index entry below path[0..baselen), skipping staged deletions.
+static const FileStatus *next_index_entry(TreeDiff *diff, const char *path,
+                                          size_t baselen) {
+  while (diff->pos < diff->count) {
+    const FileStatus *entry = &diff->entries[diff->pos];
+    if (strncmp(entry->filename, path, baselen) != 0)
+      return NULL;
+    if (entry->status != 3)
+      return entry;
+    diff->pos++;
+  }
+  return NULL;
+}
+
+// Compare the directory path[0..baselen) of the index with tree. A
+// directory the cache tree already records with tree's ID is skipped
+// without reading it. path has room for any index path.
+static int diff_tree_dir(TreeDiff *diff, const ObjectId *tree,
+                         CacheTree *cache, char *path, size_t baselen) {
+  if (cache && cache->entry_count >= 0 && oid_eq(&cache->oid, tree)) {
+    trace_count(TRACE_CACHE_TREE_HITS, 1);
+    diff->pos = prefix_end(diff, diff->pos, path, baselen);
+    return 0;
+  }
+
+  TreeDesc desc;
+  if (tree_desc_open(&desc, tree) != 0)
+    return -1;
+
+  TreeEntry t;
+  int have = tree_desc_next(&desc, &t);
+  for (;;) {
+    const FileStatus *x = next_index_entry(diff, path, baselen);
+    if (have < 0)
+      break;
+    if (!have && !x)
+      break;
+
+    // Tree order sorts a directory as if its name ended in '/', which
+    // makes it agree with the index's plain strcmp order
+    size_t len = baselen;
+    int is_dir = 0, cmp = -1;
+    if (have) {
+      if (baselen + t.name_len + 2 > FILE_PATH_MAX) {
+        have = -1;
+        break;
+      }
+      memcpy(path + baselen, t.name, t.name_len);
+      len += t.name_len;
+      is_dir = S_ISDIR(t.mode);
+      if (is_dir)
+        path[len++] = '/';
+      path[len] = '\0';
+      if (!x)
+        cmp = 1;
+      else if (is_dir && strncmp(x->filename, path, len) == 0)
+        cmp = 0;
+      else
+        cmp = strcmp(x->filename, path);
+    }
+
+    if (cmp < 0) {
+      diff->fn(x->filename, 2, diff->ctx);
+      diff->pos++;
+      continue;
+    }
+    if (is_dir) {
+      // With no index entries below it, every file in it was deleted
+      CacheTree *sub = NULL;
+      if (cmp == 0 && cache) {
+        int pos = subtree_pos(cache, t.name, t.name_len);
+        sub = pos >= 0 ? cache->subtrees[pos] : NULL;
+      }
+      if (diff_tree_dir(diff, &t.oid, sub, path, len) != 0) {
+        have = -1;
+        break;
+      }
+    } else if (cmp > 0) {
+      diff->fn(path, 3, diff->ctx);
+    } else {
+      if (!oid_eq(&x->oid, &t.oid) ||
+          strcmp(tree_entry_mode(x->mode), tree_entry_mode(t.mode)) != 0)
+        diff->fn(x->filename, 1, diff->ctx);
+      diff->pos++;
+    }
+    have = tree_desc_next(&desc, &t);
+  }
+  tree_desc_close(&desc);
+  path[baselen] = '\0';
+  return have < 0 ? -1 : 0;
+}
+
+// Report how the index differs from tree, the snapshot of a commit; a NULL
+// tree is an empty one. Returns -1 if a tree cannot be read.
+int diff_index_with_tree(Repository *repo, const ObjectId *tree,
+                         tree_change_fn fn, void *ctx) {
+  TreeDiff diff = {repo->staged_files, repo->staged_count, 0, fn, ctx};
+  if (!tree) {
+    for (int i = 0; i < repo->staged_count; i++) {
+      if (repo->staged_files[i].status != 3)
+        fn(repo->staged_files[i].filename, 2, ctx);
+    }
+    return 0;
+  }
+
+  char path[FILE_PATH_MAX] = "";
+  return diff_tree_dir(&diff, tree, repo->cache_tree, path, 0);
+}
+
+// Order two entries of one directory the way trees sort them, a directory
+// as if its name ended in '/'.
+static int tree_entry_cmp(const TreeEntry *a, const TreeEntry *b) {
+  size_t len = a->name_len < b->name_len ? a->name_len : b->name_len;
+  int cmp = memcmp(a->name, b->name, len);
+  if (cmp)
+    return cmp;
+  unsigned char ca = len < a->name_len ? (unsigned char)a->name[len]
+                                       : (S_ISDIR(a->mode) ? '/' : '\0');
+  unsigned char cb = len < b->name_len ? (unsigned char)b->name[len]
+                                       : (S_ISDIR(b->mode) ? '/' : '\0');
+  return ca - cb;
+}
+
+// Report one side's entry: a file directly, a directory file by file.
+static int diff_tree_side(const TreeEntry *t, int is_old, char *path,
+                          size_t len, tree_pair_fn fn, void *ctx);
+
+// Compare the directory path[0..baselen) of two trees, either of which
+// may be NULL for an empty one. Subtrees with equal IDs are not read.
+static int diff_tree_pair(const ObjectId *a, const ObjectId *b, char *path,
+                          size_t baselen, tree_pair_fn fn, void *ctx) {
+  TreeDesc da = {NULL, 0, 0}, db = {NULL, 0, 0};
+  if ((a && tree_desc_open(&da, a) != 0) ||
+      (b && tree_desc_open(&db, b) != 0)) {
+    tree_desc_close(&da);
+    return -1;
+  }
+
+  TreeEntry ta, tb;
+  int have_a = tree_desc_next(&da, &ta);
+  int have_b = tree_desc_next(&db, &tb);
+  int ret = 0;
+  while (ret == 0 && (have_a > 0 || have_b > 0)) {
+    if (have_a < 0 || have_b < 0) {
+      ret = -1;
+      break;
+    }
+    int cmp = !have_a ? 1 : !have_b ? -1 : tree_entry_cmp(&ta, &tb);
+    const TreeEntry *t = cmp <= 0 ? &ta : &tb;
+    if (baselen + t->name_len + 2 > FILE_PATH_MAX) {
+      ret = -1;
+      break;
+    }
+    memcpy(path + baselen, t->name, t->name_len);
+    size_t len = baselen + t->name_len;
+    path[len] = '\0';
+
+    if (cmp < 0) {
+      ret = diff_tree_side(&ta, 1, path, len, fn, ctx);
+    } else if (cmp > 0) {
+      ret = diff_tree_side(&tb, 0, path, len, fn, ctx);
+    } else if (S_ISDIR(ta.mode)) {
+      if (!oid_eq(&ta.oid, &tb.oid)) {
+        path[len++] = '/';
+        path[len] = '\0';
+        ret = diff_tree_pair(&ta.oid, &tb.oid, path, len, fn, ctx);
+      }
+    } else if (!oid_eq(&ta.oid, &tb.oid) ||
+               strcmp(tree_entry_mode(ta.mode), tree_entry_mode(tb.mode)) != 0) {
+      fn(path, &ta, &tb, ctx);
+    }
+
+    if (cmp <= 0)
+      have_a = tree_desc_next(&da, &ta);
+    if (cmp >= 0)
+      have_b = tree_desc_next(&db, &tb);
+  }
+  tree_desc_close(&da);
+  tree_desc_close(&db);
+  path[baselen] = '\0';
+  return ret;
+}
+
+static int diff_tree_side(const TreeEntry *t, int is_old, char *path,
+                          size_t len, tree_pair_fn fn, void *ctx) {
+  if (!S_ISDIR(t->mode)) {
+    fn(path, is_old ? t : NULL, is_old ? NULL : t, ctx);
+    return 0;
+  }
+  path[len++] = '/';
+  path[len] = '\0';
+  return is_old ? diff_tree_pair(&t->oid, NULL, path, len, fn, ctx)
+                : diff_tree_pair(NULL, &t->oid, path, len, fn, ctx);
+}
+
+// Report the files that differ between two trees; NULL stands for an
+// empty tree. Returns -1 if a tree cannot be read.
+int diff_trees(const ObjectId *old_tree, const ObjectId *new_tree,
+               tree_pair_fn fn, void *ctx) {
+  if (old_tree && new_tree && oid_eq(old_tree, new_tree))
+    return 0;
+  char path[FILE_PATH_MAX] = "";
+  return diff_tree_pair(old_tree, new_tree, path, 0, fn, ctx);
+}
+
+// Look up the file at path in tree, filling in entry's mode and ID (its
+// name is not kept). Returns 1 if found, 0 if not, -1 if a tree cannot be
+// read.
+int tree_find_path(const ObjectId *tree, const char *path, TreeEntry *entry) {
+  ObjectId dir = *tree;
+  for (;;) {
+    const char *slash = strchr(path, '/');
+    size_t len = slash ? (size_t)(slash - path) : strlen(path);
+    TreeDesc desc;
+    if (tree_desc_open(&desc, &dir) != 0)
+      return -1;
+
+    int have;
+    while ((have = tree_desc_next(&desc, entry)) > 0) {
+      if (entry->name_len == len && memcmp(entry->name, path, len) == 0 &&
+          !S_ISDIR(entry->mode) == !slash)
+        break;
+    }
+    tree_desc_close(&desc);
+    entry->name = NULL;
+    entry->name_len = 0;
+    if (have <= 0)
+      return have;
+    if (!slash)
+      return 1;
+    dir = entry->oid;
+    path = slash + 1;
+  }
+}
+
+// The index extension stores each directory depth-first as
+// "<name>\0<entry_count> <subtree_count>\n" followed by its raw ID when
+// entry_count is not -1.
+static int ext_header(const CacheTree *tree, char *out, size_t size) {
+  return snprintf(out, size, "%d %d\n", tree->entry_count,
+                  tree->subtree_count);
+}
+
+size_t cache_tree_ext_size(const CacheTree *root) {
+  if (!root)
+    return 0;
+  char header[32];
+  size_t size = strlen(root->name) + 1 + ext_header(root, header, sizeof(header));
+  if (root->entry_count >= 0)
+    size += hash_algo->rawsz;
+  for (int i = 0; i < root->subtree_count; i++)
+    size += cache_tree_ext_size(root->subtrees[i]);
+  return size;
+}
+
+unsigned char *cache_tree_ext_write(const CacheTree *root, unsigned char *out) {
+  if (!root)
+    return out;
+  size_t len = strlen(root->name) + 1;
+  memcpy(out, root->name, len);
+  out += len;
+
+  char header[32];
+  int header_len = ext_header(root, header, sizeof(header));
+  memcpy(out, header, header_len);
+  out += header_len;
+
+  if (root->entry_count >= 0) {
+    memcpy(out, root->oid.hash, hash_algo->rawsz);
+    out += hash_algo->rawsz;
+  }
+  for (int i = 0; i < root->subtree_count; i++)
+    out = cache_tree_ext_write(root->subtrees[i], out);
+  return out;
+}
+
+static CacheTree *ext_read_one(const unsigned char **pos,
+                               const unsigned char *end) {
+  const unsigned char *p = *pos;
+  const unsigned char *nul = memchr(p, '\0', end - p);
+  if (!nul)
+    return NULL;
+  const unsigned char *newline = memchr(nul + 1, '\n', end - nul - 1);
+  if (!newline || newline - nul > 24)
+    return NULL;
+
+  char header[32];
+  memcpy(header, nul + 1, newline - nul - 1);
+  header[newline - nul - 1] = '\0';
+  int entry_count, subtree_count;
+  if (sscanf(header, "%d %d", &entry_count, &subtree_count) != 2 ||
+      entry_count < -1 || subtree_count < 0)
+    return NULL;
+
+  CacheTree *tree = cache_tree_new((const char *)p, nul - p);
+  if (!tree)
+    return NULL;
+  tree->entry_count = entry_count;
+  p = newline + 1;
+  if (entry_count >= 0) {
+    if ((size_t)(end - p) < hash_algo->rawsz)
+      goto fail;
+    memcpy(tree->oid.hash, p, hash_algo->rawsz);
+    p += hash_algo->rawsz;
+  }
+
+  if (subtree_count) {
+    tree->subtrees = calloc(subtree_count, sizeof(CacheTree *));
+    if (!tree->subtrees)
+      goto fail;
+    tree->subtree_alloc = subtree_count;
+  }
+  for (int i = 0; i < subtree_count; i++) {
+    CacheTree *sub = ext_read_one(&p, end);
+    if (!sub)
+      goto fail;
+    tree->subtrees[tree->subtree_count++] = sub;
+  }
+  *pos = p;
+  return tree;
+
+fail:
+  cache_tree_free(tree);
+  return NULL;
+}
+
+// Rebuild a cache tree from its index extension; NULL if it is malformed.
+CacheTree *cache_tree_ext_read(const unsigned char *data, size_t len) {
+  const unsigned char *p = data;
+  CacheTree *root = ext_read_one(&p, data + len);
+  if (root && p != data + len) {
+    cache_tree_free(root);
+    return NULL;
+  }
+  return root;
+}
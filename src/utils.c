@@ -1,17 +1,77 @@
 #include "utils.h"
 
-#include <openssl/sha.h>
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
-void calculate_hash(const char *content, size_t len, char *output) {
-  unsigned char hash[SHA_DIGEST_LENGTH];
-  SHA1((unsigned char *)content, len, hash);
+// Value of each hex digit, -1 for anything else
+static const signed char hex_values[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,  ['5'] = 6,
+    ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10, ['a'] = 11, ['b'] = 12,
+    ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16, ['A'] = 11, ['B'] = 12,
+    ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+#define HEX_VALUE(c) (hex_values[(unsigned char)(c)] - 1)
 
-  for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
-    sprintf(output + (i * 2), "%02x", hash[i]);
+// Decode len bytes from 2*len hex digits. Returns 0 on success, -1 if the
+// input is short or contains a non-hex character.
+int hex_to_bytes(const char *hex, unsigned char *out, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    int hi = HEX_VALUE(hex[2 * i]);
+    if (hi < 0)
+      return -1; // also stops at the end of a short string
+    int lo = HEX_VALUE(hex[2 * i + 1]);
+    if (lo < 0)
+      return -1;
+    out[i] = (unsigned char)(hi << 4 | lo);
   }
-  output[40] = '\0';
+  return 0;
+}
+
+// Two output digits per byte, looked up together.
+void bytes_to_hex(const unsigned char *bytes, size_t len, char *out) {
+  static const char pairs[] =
+      "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+      "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+      "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+      "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+      "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+      "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+      "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+      "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+  for (size_t i = 0; i < len; i++)
+    memcpy(out + 2 * i, pairs + 2 * bytes[i], 2);
+  out[2 * len] = '\0';
+}
+
+// Parse an ID of the repository's format. The unused tail is zeroed.
+int oid_from_hex(ObjectId *oid, const char *hex) {
+  memset(oid->hash + hash_algo->rawsz, 0, OID_RAW_SIZE - hash_algo->rawsz);
+  return hex_to_bytes(hex, oid->hash, hash_algo->rawsz);
+}
+
+// Write the hex form plus a NUL to out, which must have room for
+// OID_HEX_SIZE + 1 bytes, and return it.
+char *oid_to_hex(const ObjectId *oid, char *out) {
+  bytes_to_hex(oid->hash, hash_algo->rawsz, out);
+  return out;
+}
+
+// Write all of data, retrying short writes. Returns 0 or -1 with errno set.
+int write_fully(int fd, const void *data, size_t len) {
+  const char *p = data;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
 }
 
 int file_exists(const char *path) {
@@ -0,0 +1,285 @@
+#include "worktree.h"
+#include "trace.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Directories still to be read, one deque per worker. The owner pushes and
+// pops at the tail; idle workers steal from the head of someone else's.
+typedef struct DirQueue {
+    char** paths;
+    size_t head;
+    size_t tail;
+    size_t cap;
+    pthread_mutex_t lock;
+} DirQueue;
+
+typedef struct Walker {
+    int root_fd;
+    int num_threads;
+    DirQueue* queues;
+    long pending;  // directories queued or being read
+    long queued;   // directories waiting in some queue
+    int idle;      // workers asleep in wait_for_work()
+    pthread_mutex_t idle_lock;
+    pthread_cond_t work;  // a directory was queued, or pending reached 0
+    worktree_visit_fn visit;
+    void* ctx;
+} Walker;
+
+typedef struct WalkerThread {
+    Walker* walker;
+    int id;
+} WalkerThread;
+
+static int queue_push(DirQueue* q, char* path) {
+    pthread_mutex_lock(&q->lock);
+    if (q->tail == q->cap) {
+        // Reclaim stolen slots at the front before growing
+        if (q->head > 0) {
+            memmove(q->paths, q->paths + q->head,
+                    (q->tail - q->head) * sizeof(char*));
+            q->tail -= q->head;
+            q->head = 0;
+        }
+        if (q->tail == q->cap) {
+            size_t new_cap = q->cap ? q->cap * 2 : 64;
+            char** grown = realloc(q->paths, new_cap * sizeof(char*));
+            if (!grown) {
+                pthread_mutex_unlock(&q->lock);
+                return -1;
+            }
+            q->paths = grown;
+            q->cap = new_cap;
+        }
+    }
+    q->paths[q->tail++] = path;
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+static char* queue_pop(DirQueue* q) {
+    char* path = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head)
+        path = q->paths[--q->tail];
+    pthread_mutex_unlock(&q->lock);
+    return path;
+}
+
+static char* queue_steal(DirQueue* q) {
+    char* path = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head)
+        path = q->paths[q->head++];
+    pthread_mutex_unlock(&q->lock);
+    return path;
+}
+
+// Wake one idle worker, or all of them once the walk is over. The idle
+// count is read before taking the lock: a worker about to sleep counts
+// itself first, then re-checks queued and pending, so it cannot miss the
+// change its waker just made.
+static void wake_workers(Walker* walker, int all) {
+    if (__atomic_load_n(&walker->idle, __ATOMIC_SEQ_CST) == 0) return;
+    pthread_mutex_lock(&walker->idle_lock);
+    if (all)
+        pthread_cond_broadcast(&walker->work);
+    else
+        pthread_cond_signal(&walker->work);
+    pthread_mutex_unlock(&walker->idle_lock);
+}
+
+// Sleep until a directory is queued or the walk is over. Returns -1 once
+// there is nothing left to read.
+static int wait_for_work(Walker* walker) {
+    pthread_mutex_lock(&walker->idle_lock);
+    __atomic_add_fetch(&walker->idle, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&walker->queued, __ATOMIC_SEQ_CST) == 0 &&
+           __atomic_load_n(&walker->pending, __ATOMIC_SEQ_CST) > 0)
+        pthread_cond_wait(&walker->work, &walker->idle_lock);
+    __atomic_sub_fetch(&walker->idle, 1, __ATOMIC_SEQ_CST);
+    int done = __atomic_load_n(&walker->pending, __ATOMIC_SEQ_CST) == 0;
+    pthread_mutex_unlock(&walker->idle_lock);
+    return done ? -1 : 0;
+}
+
+// Symlinks count as files: they are tracked by their target, not followed.
+static int is_dir_entry(int dir_fd, const struct dirent* entry, int* is_file) {
+    unsigned char type = entry->d_type;
+    if (type == DT_UNKNOWN) {
+        struct stat st;
+        trace_count(TRACE_FILES_STATED, 1);
+        if (fstatat(dir_fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            return 0;
+        if (S_ISDIR(st.st_mode)) type = DT_DIR;
+        else if (S_ISREG(st.st_mode)) type = DT_REG;
+        else if (S_ISLNK(st.st_mode)) type = DT_LNK;
+    }
+    *is_file = type == DT_REG || type == DT_LNK;
+    return type == DT_DIR;
+}
+
+// Read one directory: report its files, queue its subdirectories.
+static void read_directory(Walker* walker, int id, const char* dir_path) {
+    int fd = openat(walker->root_fd, dir_path[0] ? dir_path : ".",
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open directory %s\n", dir_path);
+        return;
+    }
+    DIR* dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return;
+    }
+
+    char path[PATH_MAX];
+    size_t prefix = 0;
+    if (dir_path[0]) {
+        prefix = strlen(dir_path);
+        memcpy(path, dir_path, prefix);
+        path[prefix++] = '/';
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strcmp(name, ".babygit") == 0)
+            continue;
+
+        size_t len = strlen(name);
+        if (prefix + len >= sizeof(path)) {
+            fprintf(stderr, "Path too long: %s/%s\n", dir_path, name);
+            continue;
+        }
+        memcpy(path + prefix, name, len + 1);
+
+        int is_file = 0;
+        if (is_dir_entry(fd, entry, &is_file)) {
+            char* sub = strdup(path);
+            if (!sub) continue;
+            __atomic_add_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST);
+            if (queue_push(&walker->queues[id], sub) != 0) {
+                __atomic_sub_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST);
+                free(sub);
+                continue;
+            }
+            __atomic_add_fetch(&walker->queued, 1, __ATOMIC_SEQ_CST);
+            wake_workers(walker, 0);
+        } else if (is_file) {
+            walker->visit(id, path, walker->ctx);
+        }
+    }
+    closedir(dir);
+}
+
+static void* walker_main(void* data) {
+    WalkerThread* self = data;
+    Walker* walker = self->walker;
+    int id = self->id;
+
+    for (;;) {
+        char* dir_path = queue_pop(&walker->queues[id]);
+        for (int i = 1; !dir_path && i < walker->num_threads; i++)
+            dir_path = queue_steal(&walker->queues[(id + i) % walker->num_threads]);
+
+        if (!dir_path) {
+            if (wait_for_work(walker) != 0) break;
+            continue;
+        }
+        __atomic_sub_fetch(&walker->queued, 1, __ATOMIC_SEQ_CST);
+
+        read_directory(walker, id, dir_path);
+        free(dir_path);
+        if (__atomic_sub_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST) == 0)
+            wake_workers(walker, 1);
+    }
+    return NULL;
+}
+
+// Recursively visit every file and symlink below dir, a path relative to the
+// current directory ("" for all of it), skipping .babygit, using
+// num_threads work-stealing threads.
+// Returns 0 on success, -1 if the walk could not be started.
+int walk_worktree_dir(const char* dir, int num_threads, worktree_visit_fn visit,
+                      void* ctx) {
+    if (num_threads < 1) num_threads = 1;
+
+    Walker walker;
+    memset(&walker, 0, sizeof(walker));
+    walker.root_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (walker.root_fd < 0) return -1;
+    uint64_t trace_start = trace_begin();
+    walker.num_threads = num_threads;
+    walker.visit = visit;
+    walker.ctx = ctx;
+
+    walker.queues = calloc(num_threads, sizeof(DirQueue));
+    WalkerThread* threads = calloc(num_threads, sizeof(WalkerThread));
+    pthread_t* tids = calloc(num_threads, sizeof(pthread_t));
+    char* root = strdup(dir);
+    if (!walker.queues || !threads || !tids || !root) {
+        free(walker.queues);
+        free(threads);
+        free(tids);
+        free(root);
+        close(walker.root_fd);
+        return -1;
+    }
+
+    for (int i = 0; i < num_threads; i++)
+        pthread_mutex_init(&walker.queues[i].lock, NULL);
+    pthread_mutex_init(&walker.idle_lock, NULL);
+    pthread_cond_init(&walker.work, NULL);
+
+    // Nothing is walked, and -1 returned, if even the root cannot be queued
+    int ret = queue_push(&walker.queues[0], root);
+    if (ret == 0) {
+        walker.pending = 1;
+        walker.queued = 1;
+
+        // Worker 0 runs on the calling thread
+        int started = 1;
+        for (int i = 1; i < num_threads; i++) {
+            threads[i].walker = &walker;
+            threads[i].id = i;
+            if (pthread_create(&tids[i], NULL, walker_main, &threads[i]) != 0)
+                break;
+            started++;
+        }
+        threads[0].walker = &walker;
+        threads[0].id = 0;
+        walker_main(&threads[0]);
+
+        for (int i = 1; i < started; i++)
+            pthread_join(tids[i], NULL);
+    } else {
+        free(root);
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_destroy(&walker.queues[i].lock);
+        free(walker.queues[i].paths);
+    }
+    pthread_mutex_destroy(&walker.idle_lock);
+    pthread_cond_destroy(&walker.work);
+    free(walker.queues);
+    free(threads);
+    free(tids);
+    close(walker.root_fd);
+    trace_end(TRACE_TRAVERSE, trace_start);
+    return ret;
+}
+
+int walk_worktree(int num_threads, worktree_visit_fn visit, void* ctx) {
+    return walk_worktree_dir("", num_threads, visit, ctx);
+}